@@ -0,0 +1,68 @@
+#version 330 core
+
+// CDLOD terrain patch (see CdlodTerrain): one instance per selected
+// quadtree node, displaced by the R32F height texture. Vertices morph onto
+// the next coarser level's grid as they near the end of their level's
+// range, so neighbouring levels share their boundary vertices.
+
+layout(location = 0) in vec2 aGrid;  // patch vertex, 0..uGrid
+layout(location = 1) in vec4 aNode;  // first cell x, z, size in cells, level
+
+out vec3 vNormal;
+out vec2 vTexCoord;
+out float vHeight; // world-space height
+
+uniform mat4 uModelViewMatrix;
+uniform mat4 uProjectionMatrix;
+uniform mat3 uNormalMatrix;
+
+uniform sampler2D uHeightMap; // R32F, one texel per heightmap cell
+uniform ivec2 uTerrainSize;   // heightmap width, depth
+uniform vec3 uTerrainOffset;
+uniform vec2 uTerrainScale;   // world units per cell in x, z
+uniform vec3 uCameraPos;      // in terrain space
+uniform vec2 uMorph[16];      // morph start, end distance per level
+uniform float uGrid;          // patch quads per side
+
+float heightAt(vec2 cell) {
+    vec2 size = vec2(uTerrainSize);
+    cell = clamp(cell, vec2(0.0), size - 1.0);
+    return textureLod(uHeightMap, (cell + 0.5) / size, 0.0).r;
+}
+
+vec3 worldAt(vec2 cell) {
+    cell = clamp(cell, vec2(0.0), vec2(uTerrainSize - 1));
+    return uTerrainOffset +
+        vec3(cell.x * uTerrainScale.x, heightAt(cell), cell.y * uTerrainScale.y);
+}
+
+void main() {
+    float spacing = aNode.z / uGrid;
+    int level = int(aNode.w);
+
+    // morph odd vertices towards their even neighbours, i.e. onto the grid
+    // of the next level, with the camera distance
+    float dist = distance(worldAt(aNode.xy + aGrid * spacing), uCameraPos);
+    vec2 morph = uMorph[level];
+    float k = clamp((dist - morph.x) / (morph.y - morph.x), 0.0, 1.0);
+    vec2 grid = aGrid - fract(aGrid * 0.5) * 2.0 * k;
+    vec2 cell = clamp(aNode.xy + grid * spacing, vec2(0.0),
+                      vec2(uTerrainSize - 1));
+
+    vec3 position = worldAt(cell);
+
+    // central differences one vertex spacing apart
+    vec2 dx = vec2(spacing, 0.0), dz = vec2(0.0, spacing);
+    float slopeX = (heightAt(cell + dx) - heightAt(cell - dx)) /
+                   (2.0 * spacing * uTerrainScale.x);
+    float slopeZ = (heightAt(cell + dz) - heightAt(cell - dz)) /
+                   (2.0 * spacing * uTerrainScale.y);
+    vec3 normal = normalize(vec3(-slopeX, 1.0, -slopeZ));
+
+    vHeight = position.y;
+    vTexCoord = cell / vec2(uTerrainSize - 1);
+    vNormal = normalize(uNormalMatrix * normal);
+
+    vec4 viewPos = uModelViewMatrix * vec4(position, 1.0);
+    gl_Position = uProjectionMatrix * viewPos;
+}
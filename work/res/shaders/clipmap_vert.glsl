@@ -0,0 +1,72 @@
+#version 330 core
+
+// One level of ClipmapTerrain: an N x N grid whose vertex g shows level
+// sample uOrigin + g. Heights live in the level's layer of a texture array,
+// addressed toroidally. Towards the border the surface blends into the
+// next coarser level's (the average of the neighbouring even samples), and
+// matches it exactly on the border, so the rings meet without cracks.
+
+out vec3 vNormal;
+out vec2 vTexCoord;
+out float vHeight; // world-space height
+
+uniform mat4 uModelViewMatrix;
+uniform mat4 uProjectionMatrix;
+uniform mat3 uNormalMatrix;
+
+uniform sampler2DArray uHeightMaps; // R32F, one layer per level
+uniform int uN;            // samples per level side
+uniform int uLevel;        // samples are 2^uLevel cells apart
+uniform ivec2 uOrigin;     // first sample of the window
+uniform int uTransition;   // width of the blend band, in samples
+uniform bool uBlend;       // false for the coarsest level
+uniform vec3 uTerrainOffset;
+uniform vec2 uTerrainScale; // world units per cell in x, z
+uniform vec2 uFlyOffset;
+uniform ivec2 uTerrainSize; // of the generated map, for texture tiling
+
+float heightAt(ivec2 s) {
+    ivec2 t = ((s % uN) + uN) % uN;
+    return texelFetch(uHeightMaps, ivec3(t, uLevel), 0).r;
+}
+
+void main() {
+    ivec2 g = ivec2(gl_VertexID % uN, gl_VertexID / uN);
+    ivec2 s = uOrigin + g;
+    float h = heightAt(s);
+
+    if (uBlend) {
+        // the coarser level interpolates odd samples from the even ones
+        ivec2 odd = g & 1;
+        float coarse = 0.25 * (heightAt(s - odd) + heightAt(s + odd) +
+                               heightAt(s + ivec2(odd.x, -odd.y)) +
+                               heightAt(s + ivec2(-odd.x, odd.y)));
+        int edge = min(min(g.x, g.y), min(uN - 1 - g.x, uN - 1 - g.y));
+        float alpha = clamp(1.0 - float(edge) / float(uTransition), 0.0, 1.0);
+        h = mix(h, coarse, alpha);
+    }
+
+    float cells = float(1 << uLevel);
+    vec2 cell = vec2(s) * cells;
+    vec2 spacing = cells * uTerrainScale;
+
+    vec3 position = uTerrainOffset +
+        vec3(cell.x * uTerrainScale.x - uFlyOffset.x, h,
+             cell.y * uTerrainScale.y - uFlyOffset.y);
+
+    // central differences within the window
+    ivec2 lo = uOrigin + max(g - 1, ivec2(0));
+    ivec2 hi = uOrigin + min(g + 1, ivec2(uN - 1));
+    float slopeX = (heightAt(ivec2(hi.x, s.y)) - heightAt(ivec2(lo.x, s.y))) /
+                   (float(hi.x - lo.x) * spacing.x);
+    float slopeZ = (heightAt(ivec2(s.x, hi.y)) - heightAt(ivec2(s.x, lo.y))) /
+                   (float(hi.y - lo.y) * spacing.y);
+    vec3 normal = normalize(vec3(-slopeX, 1.0, -slopeZ));
+
+    vHeight = position.y;
+    vTexCoord = cell / vec2(uTerrainSize - 1);
+    vNormal = normalize(uNormalMatrix * normal);
+
+    vec4 viewPos = uModelViewMatrix * vec4(position, 1.0);
+    gl_Position = uProjectionMatrix * viewPos;
+}
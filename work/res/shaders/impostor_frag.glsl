@@ -0,0 +1,23 @@
+#version 330 core
+
+// uniform data
+uniform sampler2D uAtlas; // ImpostorAtlas, lighting baked in
+
+// viewspace data (this must match the output of the vertex shader)
+in VertexData {
+	vec3 position;
+	vec3 normal;
+	vec2 textureCoord;
+	vec3 color;
+} f_in;
+
+// framebuffer output
+out vec4 fb_color;
+
+void main() {
+	vec4 texel = texture(uAtlas, f_in.textureCoord);
+	if (texel.a < 0.5) discard;
+
+	// output to the frambuffer
+	fb_color = vec4(texel.rgb * f_in.color, 1);
+}
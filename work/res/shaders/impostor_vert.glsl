@@ -0,0 +1,64 @@
+#version 330 core
+
+// Draws octahedral impostors (see ImpostorAtlas) as one quad per instance.
+// The instance data is the same as lod_instanced_vert.glsl's, and
+// uModelViewMatrix likewise holds only the view.
+
+// uniform data
+uniform mat4 uProjectionMatrix;
+uniform mat4 uModelViewMatrix;
+uniform vec3 uCenter;  // bounding sphere of the baked mesh, in its space
+uniform float uRadius;
+uniform int uFrames;   // ImpostorAtlas::FRAMES
+
+// mesh data
+layout(location = 0) in vec2 aCorner; // -1 to 1
+
+// instance data
+layout(location = 4) in mat4 aModel; // locations 4-7
+layout(location = 8) in vec3 aTint;
+
+// model data (this must match the input of the fragment shader)
+out VertexData {
+	vec3 position;
+	vec3 normal;
+	vec2 textureCoord;
+	vec3 color;
+} v_out;
+
+// hemi-octahedral mapping, as ImpostorAtlas::encode/decode
+vec2 encode(vec3 dir) {
+	dir.y = max(dir.y, 0);
+	vec2 p = dir.xz / (abs(dir.x) + dir.y + abs(dir.z));
+	return vec2(p.x + p.y, p.x - p.y);
+}
+
+vec3 decode(vec2 p) {
+	vec2 q = vec2(p.x + p.y, p.x - p.y) * 0.5;
+	return normalize(vec3(q.x, 1 - abs(q.x) - abs(q.y), q.y));
+}
+
+void main() {
+	mat4 modelView = uModelViewMatrix * aModel;
+
+	// direction to the eye in the mesh's space (the model-view matrix is a
+	// rotation and a uniform scale, so its transpose inverts the rotation)
+	vec3 center = (modelView * vec4(uCenter, 1)).xyz;
+	vec3 dir = normalize(transpose(mat3(modelView)) * -center);
+
+	// nearest frame, and the axes of the camera it was baked with
+	vec2 cell = (encode(dir) * 0.5 + 0.5) * uFrames;
+	vec2 frame = clamp(floor(cell), vec2(0), vec2(uFrames - 1));
+	vec3 frameDir = decode((frame + 0.5) / uFrames * 2 - 1);
+	vec3 right = normalize(cross(vec3(0, 1, 0), frameDir));
+	vec3 up = cross(frameDir, right);
+
+	vec3 position = uCenter + (aCorner.x * right + aCorner.y * up) * uRadius;
+	v_out.position = (modelView * vec4(position, 1)).xyz;
+	v_out.normal = normalize((modelView * vec4(frameDir, 0)).xyz);
+	v_out.textureCoord = (frame + aCorner * 0.5 + 0.5) / uFrames;
+	v_out.color = aTint;
+
+	// set the screenspace position (needed for converting to fragment data)
+	gl_Position = uProjectionMatrix * vec4(v_out.position, 1);
+}
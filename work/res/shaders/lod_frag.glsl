@@ -10,6 +10,7 @@ in VertexData {
 	vec3 position;
 	vec3 normal;
 	vec2 textureCoord;
+	vec3 color;
 } f_in;
 
 // framebuffer output
@@ -19,7 +20,7 @@ void main() {
 	// calculate lighting (hack)
 	vec3 eye = normalize(-f_in.position);
 	float light = abs(dot(normalize(f_in.normal), eye));
-	vec3 color = mix(uColor / 4, uColor, light);
+	vec3 color = mix(f_in.color / 4, f_in.color, light);
 
 	// output to the frambuffer
 	fb_color = vec4(color, 1);
@@ -0,0 +1,39 @@
+#version 330 core
+
+// Instanced variant of lod_vert.glsl: the model matrix and a colour tint
+// come from the instance buffer, so uModelViewMatrix holds only the view.
+
+// uniform data
+uniform mat4 uProjectionMatrix;
+uniform mat4 uModelViewMatrix;
+uniform vec3 uColor;
+
+// mesh data
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoord;
+
+// instance data
+layout(location = 4) in mat4 aModel; // locations 4-7
+layout(location = 8) in vec3 aTint;
+
+// model data (this must match the input of the fragment shader)
+out VertexData {
+	vec3 position;
+	vec3 normal;
+	vec2 textureCoord;
+	vec3 color;
+} v_out;
+
+void main() {
+	mat4 modelView = uModelViewMatrix * aModel;
+
+	// transform vertex data to viewspace
+	v_out.position = (modelView * vec4(aPosition, 1)).xyz;
+	v_out.normal = normalize((modelView * vec4(aNormal, 0)).xyz);
+	v_out.textureCoord = aTexCoord;
+	v_out.color = uColor * aTint;
+
+	// set the screenspace position (needed for converting to fragment data)
+	gl_Position = uProjectionMatrix * modelView * vec4(aPosition, 1);
+}
@@ -15,6 +15,7 @@ out VertexData {
 	vec3 position;
 	vec3 normal;
 	vec2 textureCoord;
+	vec3 color;
 } v_out;
 
 void main() {
@@ -22,6 +23,7 @@ void main() {
 	v_out.position = (uModelViewMatrix * vec4(aPosition, 1)).xyz;
 	v_out.normal = normalize((uModelViewMatrix * vec4(aNormal, 0)).xyz);
 	v_out.textureCoord = aTexCoord;
+	v_out.color = uColor;
 
 	// set the screenspace position (needed for converting to fragment data)
 	gl_Position = uProjectionMatrix * uModelViewMatrix * vec4(aPosition, 1);
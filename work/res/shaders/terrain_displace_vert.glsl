@@ -0,0 +1,51 @@
+#version 330 core
+
+// Height-texture variant of terrain_vert.glsl: the mesh is a bare index
+// buffer over the lattice, and heights come from an R32F texture holding
+// the whole heightmap. Normals are central differences between the
+// neighbouring lattice samples.
+
+out vec3 vNormal;
+out vec2 vTexCoord;
+out float vHeight; // world-space height
+
+uniform mat4 uModelViewMatrix;
+uniform mat4 uProjectionMatrix;
+uniform mat3 uNormalMatrix;
+
+uniform sampler2D uHeightMap; // R32F, one texel per heightmap cell
+
+uniform ivec2 uTerrainSize;  // heightmap width, depth
+uniform int uGridCols;       // lattice samples per row
+uniform int uGridStride;     // heightmap cells between lattice samples
+uniform vec3 uTerrainOffset;
+uniform vec2 uTerrainScale;  // world units per cell in x, z
+
+float heightAt(ivec2 cell) {
+    return texelFetch(uHeightMap, clamp(cell, ivec2(0), uTerrainSize - 1), 0).r;
+}
+
+void main() {
+    // same as HeightmapGenerator::latticeIndex
+    ivec2 k = ivec2(gl_VertexID % uGridCols, gl_VertexID / uGridCols);
+    ivec2 cell = min(k * uGridStride, uTerrainSize - 1);
+
+    vec3 position = uTerrainOffset +
+        vec3(cell.x * uTerrainScale.x, heightAt(cell), cell.y * uTerrainScale.y);
+
+    // neighbouring lattice samples; during a preview only those are current
+    ivec2 lo = min(max(k - 1, 0) * uGridStride, uTerrainSize - 1);
+    ivec2 hi = min((k + 1) * uGridStride, uTerrainSize - 1);
+    float dx = (heightAt(ivec2(hi.x, cell.y)) - heightAt(ivec2(lo.x, cell.y))) /
+               (float(max(hi.x - lo.x, 1)) * uTerrainScale.x);
+    float dz = (heightAt(ivec2(cell.x, hi.y)) - heightAt(ivec2(cell.x, lo.y))) /
+               (float(max(hi.y - lo.y, 1)) * uTerrainScale.y);
+    vec3 normal = normalize(vec3(-dx, 1.0, -dz));
+
+    vHeight = position.y;
+    vTexCoord = vec2(cell) / vec2(uTerrainSize - 1);
+    vNormal = normalize(uNormalMatrix * normal);
+
+    vec4 viewPos = uModelViewMatrix * vec4(position, 1.0);
+    gl_Position = uProjectionMatrix * viewPos;
+}
@@ -0,0 +1,48 @@
+#version 330 core
+
+// Terrain variant of lambert_vert.glsl for TerrainMesh's 8-byte vertices.
+// Only the height and a packed normal are stored; the grid position and UV
+// come from the vertex index, which is the row-major lattice index.
+
+layout(location = 0) in float aHeight;
+layout(location = 1) in vec2 aNormal; // octahedral, snorm16 x 2
+
+out vec3 vNormal;
+out vec2 vTexCoord;
+out float vHeight; // world-space height
+
+uniform mat4 uModelViewMatrix;
+uniform mat4 uProjectionMatrix;
+uniform mat3 uNormalMatrix;
+
+uniform ivec2 uTerrainSize;  // heightmap width, depth
+uniform int uGridCols;       // lattice samples per row
+uniform int uGridStride;     // heightmap cells between lattice samples
+uniform vec3 uTerrainOffset;
+uniform vec2 uTerrainScale;  // world units per cell in x, z
+
+vec3 decodeNormal(vec2 e) {
+    // the octahedron is folded along y, the terrain's up axis
+    vec3 n = vec3(e.x, 1.0 - abs(e.x) - abs(e.y), e.y);
+    if (n.y < 0.0) {
+        vec2 s = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.z >= 0.0 ? 1.0 : -1.0);
+        n.xz = (1.0 - abs(n.zx)) * s;
+    }
+    return normalize(n);
+}
+
+void main() {
+    // same as HeightmapGenerator::latticeIndex
+    ivec2 k = ivec2(gl_VertexID % uGridCols, gl_VertexID / uGridCols);
+    ivec2 cell = min(k * uGridStride, uTerrainSize - 1);
+
+    vec3 position = uTerrainOffset +
+        vec3(cell.x * uTerrainScale.x, aHeight, cell.y * uTerrainScale.y);
+
+    vHeight = position.y;
+    vTexCoord = vec2(cell) / vec2(uTerrainSize - 1);
+    vNormal = normalize(uNormalMatrix * decodeNormal(aNormal));
+
+    vec4 viewPos = uModelViewMatrix * vec4(position, 1.0);
+    gl_Position = uProjectionMatrix * viewPos;
+}
@@ -14,6 +14,7 @@
 #include "cgra/cgra_image.hpp"
 #include "cgra/cgra_shader.hpp"
 #include "cgra/cgra_wavefront.hpp"
+#include "terrain_benchmark.hpp"
 
 // Lod
 #include "level_of_detail.h"
@@ -97,11 +98,26 @@ void basic_model::draw(const glm::mat4& view, const glm::mat4 proj) {
   glUniform1f(glGetUniformLocation(shader, "uMinHeight"), minHeight);
   glUniform1f(glGetUniformLocation(shader, "uMaxHeight"), maxHeight);
 
-  mesh.draw();
+  if (renderer == 2)
+    cdlod.draw(shader, view, proj, modelTransform);
+  else if (renderer == 3)
+    clipmap.draw(shader, view, modelTransform);
+  else if (renderer == 4)
+    tin.draw();
+  else
+    mesh.draw(shader, proj * modelview);
 }
 
 Application::Application(GLFWwindow* window) : m_window(window) {
   std::vector<std::pair<std::string, std::string>> shaderPaths = {
+      {std::string(CGRA_SRCDIR) + "//res//shaders//terrain_vert.glsl",
+       std::string(CGRA_SRCDIR) + "//res//shaders//lambert_frag.glsl"},
+      {std::string(CGRA_SRCDIR) + "//res//shaders//terrain_displace_vert.glsl",
+       std::string(CGRA_SRCDIR) + "//res//shaders//lambert_frag.glsl"},
+      {std::string(CGRA_SRCDIR) + "//res//shaders//cdlod_vert.glsl",
+       std::string(CGRA_SRCDIR) + "//res//shaders//lambert_frag.glsl"},
+      {std::string(CGRA_SRCDIR) + "//res//shaders//clipmap_vert.glsl",
+       std::string(CGRA_SRCDIR) + "//res//shaders//lambert_frag.glsl"},
       {std::string(CGRA_SRCDIR) + "//res//shaders//lambert_vert.glsl",
        std::string(CGRA_SRCDIR) + "//res//shaders//lambert_frag.glsl"}};
 
@@ -129,9 +145,7 @@ Application::Application(GLFWwindow* window) : m_window(window) {
 
   m_currentShaderIdx = 0;
   m_model.shader = m_shaders[m_currentShaderIdx];
-
-  m_model.mesh =
-      plane_terrain(m_terrain.getWidth(), m_terrain.getDepth(), m_terrain);
+  m_model.clipmap.setSource(&m_terrain);
 
   regenerateTerrain();
 
@@ -144,21 +158,130 @@ Application::Application(GLFWwindow* window) : m_window(window) {
   GLuint lod_shader = sb_lod.build();
   LOD.shader = lod_shader;
 
+  shader_builder sb_lod_instanced;
+  sb_lod_instanced.set_shader(
+      GL_VERTEX_SHADER,
+      CGRA_SRCDIR + std::string("//res//shaders//lod_instanced_vert.glsl"));
+  sb_lod_instanced.set_shader(
+      GL_FRAGMENT_SHADER,
+      CGRA_SRCDIR + std::string("//res//shaders//lod_frag.glsl"));
+  LOD.instanced_shader = sb_lod_instanced.build();
+
+  shader_builder sb_impostor;
+  sb_impostor.set_shader(
+      GL_VERTEX_SHADER,
+      CGRA_SRCDIR + std::string("//res//shaders//impostor_vert.glsl"));
+  sb_impostor.set_shader(
+      GL_FRAGMENT_SHADER,
+      CGRA_SRCDIR + std::string("//res//shaders//impostor_frag.glsl"));
+  LOD.impostor_shader = sb_impostor.build();
+  LOD.bake_impostor();
+
   // Create trees
   LOD.generate_trees(m_terrain, grassTopHeight);
 
   LOD.max_height = *std::max_element(m_terrain.getHeights().begin(),
                                      m_terrain.getHeights().end());
-
-  vector<float> thresholds = {10};
-  LOD.lod_thresholds = thresholds;
 }
 
+// Also reached from applyNoiseEdit for edits that only re-weight cached
+// fields, so the clipmap is invalidated here for those too
 void Application::regenerateTerrain() {
   m_terrain.setParameters(ui_octaves, ui_frequency, ui_amplitude, ui_gain,
                           ui_lacunarity);
+  m_terrain.setThreadCount(ui_threads);
+  m_model.clipmap.invalidate();  // shows the noise function itself
+
+  auto start = chrono::steady_clock::now();
   m_terrain.regenerate();
+  m_lastRegenMs = chrono::duration<double, milli>(chrono::steady_clock::now() -
+                                                  start)
+                      .count();
+
+  updateTerrainViews(true);
+}
+
+// Regenerates in the background with the current parameters, which are
+// captured now
+void Application::startRegenerationJob() {
+  startTerrainJob("Regenerating",
+                  [octaves = ui_octaves, frequency = ui_frequency,
+                   amplitude = ui_amplitude, gain = ui_gain,
+                   lacunarity = ui_lacunarity,
+                   threads = ui_threads](HeightmapGenerator& terrain) {
+                    terrain.setParameters(octaves, frequency, amplitude, gain,
+                                          lacunarity);
+                    terrain.setThreadCount(threads);
+                    terrain.regenerate();
+                  },
+                  true);
+}
+
+// Applies an amplitude or layer edit. Edits that only re-weight cached
+// fields are recombined at once; anything that has to evaluate noise
+// (a new or re-frequencied layer, stale base parameters) goes to the
+// background like a regeneration.
+void Application::applyNoiseEdit() {
+  m_terrain.setParameters(ui_octaves, ui_frequency, ui_amplitude, ui_gain,
+                          ui_lacunarity);
+  bool evaluates = m_terrain.isBaseDirty();
+  for (size_t i = 0; i < m_terrain.getLayers().size(); ++i)
+    evaluates |= m_terrain.isLayerDirty(i);
+
+  if (evaluates)
+    startRegenerationJob();
+  else
+    regenerateTerrain();
+}
 
+// Starts a progressive preview of the current parameters; render() refines
+// it a little every frame
+void Application::previewTerrain() {
+  m_terrain.setParameters(ui_octaves, ui_frequency, ui_amplitude, ui_gain,
+                          ui_lacunarity);
+  m_terrain.setThreadCount(ui_threads);
+
+  auto start = chrono::steady_clock::now();
+  m_terrain.beginPreview();
+  m_model.clipmap.invalidate();
+  updateTerrainMesh(m_terrain.getPreviewStride());
+  m_lastPreviewMs = chrono::duration<double, milli>(
+                        chrono::steady_clock::now() - start)
+                        .count();
+}
+
+// Uploads every stride-th height sample into the terrain's GPU buffers
+void Application::updateTerrainMesh(int stride) {
+  // The clipmap evaluates the noise function itself, so height-only changes
+  // (erosion, preview refinement) leave it alone. It is invalidated where
+  // the noise parameters or layers change instead.
+  if (m_model.renderer == 3) return;
+  if (m_model.renderer == 2)
+    m_model.cdlod.update(m_terrain, stride);
+  else if (m_model.renderer == 4) {
+    // too slow to follow previews or the water simulation frame by frame,
+    // so only full-resolution results are triangulated, in the background
+    m_tinStale = true;
+    if (stride == 1 && !m_pipeRunning) buildTin();
+  } else
+    m_model.mesh.update(m_terrain, stride);
+}
+
+// Starts rebuilding the TIN renderer's mesh from the full-resolution
+// heights on a background thread; render() uploads it once built. If a
+// build is already running it is queued to follow that one.
+void Application::buildTin() {
+  if (m_tinJob.start(m_terrain.getHeights(), terrainWidth, terrainDepth,
+                     ui_tinMaxError)) {
+    m_tinStale = false;
+    m_tinQueued = false;
+  } else {
+    m_tinQueued = true;
+  }
+}
+
+// Refreshes everything derived from m_terrain's heights
+void Application::updateTerrainViews(bool replaceTrees) {
   auto mm = m_terrain.computeMinMax();
   m_model.minHeight = mm.first;
   m_model.maxHeight = mm.second;
@@ -167,9 +290,17 @@ void Application::regenerateTerrain() {
 
   grassTopHeight = mm.first + distance * 0.3f;
 
-  m_model.mesh =
-      plane_terrain(m_terrain.getWidth(), m_terrain.getDepth(), m_terrain);
-  LOD.generate_trees(m_terrain, grassTopHeight);
+  updateTerrainMesh(1);
+  if (replaceTrees) LOD.generate_trees(m_terrain, grassTopHeight);
+}
+
+// Runs work on a copy of the terrain in the background; render() swaps the
+// result in once it is done. The GUI must not modify m_terrain meanwhile.
+void Application::startTerrainJob(const std::string& name,
+                                  TerrainJob::Work work, bool replaceTrees) {
+  m_terrain.finishPreview();
+  if (m_job.start(name, m_terrain, std::move(work)))
+    m_jobReplacesTrees = replaceTrees;
 }
 
 void Application::render() {
@@ -204,11 +335,62 @@ void Application::render() {
   if (m_show_axis) drawAxis(view, proj);
   glPolygonMode(GL_FRONT_AND_BACK, (m_showWireframe) ? GL_LINE : GL_FILL);
 
+  // swap in a finished background job between frames
+  if (m_job.poll(m_terrain)) {
+    if (m_jobReplacesTrees) {
+      // a regeneration, with the parameters it was started with
+      m_lastRegenMs = m_job.getLastMs();
+      m_model.clipmap.invalidate();
+    }
+    updateTerrainViews(m_jobReplacesTrees);
+  }
+
+  // upload a finished TIN, unless the heights changed while it was built:
+  // its vertices would then sit at heights it was not fitted to. A queued
+  // rebuild replaces it instead.
+  if (m_tinJob.poll(m_tin) && m_model.renderer == 4) {
+    if (m_tinQueued)
+      buildTin();
+    else if (!m_tinStale) {
+      m_model.tin.destroy();
+      m_model.tin = tin_terrain(m_tin, m_terrain);
+    }
+  }
+
+  // refine a parameter preview within a slice of the frame
+  if (m_terrain.isPreviewing() && !m_job.isActive()) {
+    const int shown = m_terrain.getPreviewStride();
+    const int stride = m_terrain.refinePreview(PREVIEW_BUDGET_MS);
+    if (stride == 1)
+      updateTerrainViews(true);
+    else if (stride < shown)
+      updateTerrainMesh(stride);
+  }
+
+  // advance the water simulation a few steps, so it erodes progressively
+  if (m_pipeRunning && !m_job.isActive()) {
+    PipeErosion::Params params;
+    params.rainRate = ui_pipeRain;
+    m_terrain.stepPipeErosion(params, ui_pipeStepsPerFrame);
+    updateTerrainViews(false);
+  }
+
+  // fly over the clipmap terrain along the camera's heading
+  if (m_model.renderer == 3 && ui_flySpeed > 0.0f) {
+    const vec3 forward = -vec3(inverse(view)[2]);
+    const vec2 heading(forward.x, forward.z);
+    if (length(heading) > 0.0f) {
+      m_model.clipmap.setFlyOffset(
+          m_model.clipmap.getFlyOffset() +
+          normalize(heading) * ui_flySpeed * ImGui::GetIO().DeltaTime);
+    }
+  }
+
   // draw the model
   m_model.draw(view, proj);
 
   // Draw lod models
-  LOD.update_lod(view, proj);
+  LOD.update_lod(view, proj, float(height));
 
   LOD.draw_lod_target(view, proj);
 }
@@ -279,106 +461,337 @@ void Application::renderGUI() {
       m_model.tintGrass = glm::vec3(tintGrass[0], tintGrass[1], tintGrass[2]);
     }
 
-    ImGui::Spacing();
-    ImGui::Text("Base fbm2d Layer Parameters");
+    if (m_job.isActive()) {
+      // the job reads the displayed terrain, so no edits until it lands
+      ImGui::Spacing();
+      ImGui::Text("%s...", m_job.getName().c_str());
+      ImGui::ProgressBar(m_job.getProgress());
+      if (ImGui::Button("Cancel")) m_job.cancel();
+    } else {
+      renderTerrainEditGUI();
+    }
+  }
+
+  ImGui::Separator();
+
+  if (ImGui::CollapsingHeader("Performance")) {
+    ImGui::Text("Last regenerate: %.1f ms", m_lastRegenMs);
+    ImGui::Text("Last preview (1/%d + mesh): %.1f ms",
+                HeightmapGenerator::PREVIEW_STRIDE, m_lastPreviewMs);
+    // shader i draws renderer i; only the active renderer keeps GPU data
+    int renderer = m_model.renderer;
+    if (ImGui::Combo("Terrain renderer", &renderer,
+                     "Vertex buffer\0Height texture\0CDLOD quadtree\0"
+                     "Clipmap (unbounded)\0TIN (static)\0")) {
+      if (m_model.renderer < 2 && renderer >= 2) m_model.mesh.destroy();
+      if (m_model.renderer == 2) m_model.cdlod.destroy();
+      if (m_model.renderer == 3) m_model.clipmap.destroy();
+      if (m_model.renderer == 4) {
+        m_model.tin.destroy();
+        m_model.tin = gl_mesh();
+      }
+      m_model.renderer = renderer;
+      m_model.mesh.setHeightTexture(renderer == 1);
+      m_currentShaderIdx = renderer;
+      m_model.shader = m_shaders[m_currentShaderIdx];
+      updateTerrainMesh(m_terrain.getPreviewStride());
+    }
+    if (m_model.renderer == 4) {
+      ImGui::SliderFloat("TIN max error", &ui_tinMaxError, 0.001f, 0.2f,
+                         "%.3f", 2.0f);
+      if (ImGui::Button("Build TIN") && !m_job.isActive()) buildTin();
+      if (m_tinJob.isActive()) {
+        ImGui::SameLine();
+        ImGui::Text("(building...)");
+      } else if (m_tinStale) {
+        ImGui::SameLine();
+        ImGui::Text("(terrain changed)");
+      }
+      const double full = 2.0 * (terrainWidth - 1) * (terrainDepth - 1);
+      ImGui::Text("%zu vertices, %zu triangles (%.1fx fewer)",
+                  m_tin.vertices.size(), m_tin.triangles.size(),
+                  full / std::max<size_t>(m_tin.triangles.size(), 1));
+      ImGui::Text("Built in %.0f ms, max error %.4f", m_tin.buildMs,
+                  m_tin.maxError);
+    } else if (m_model.renderer == 2) {
+      float lodDistance = m_model.cdlod.getLodDistance();
+      if (ImGui::SliderFloat("LOD distance", &lodDistance, 0.5f, 20.0f))
+        m_model.cdlod.setLodDistance(lodDistance);
+      ImGui::Text("%d levels: %d nodes drawn, %d culled, %.0fk triangles",
+                  m_model.cdlod.getLevelCount(), m_model.cdlod.getNodesDrawn(),
+                  m_model.cdlod.getNodesCulled(),
+                  m_model.cdlod.getTrianglesDrawn() / 1000.0);
+      ImGui::Text("Select %.2f ms, pyramid %.1f ms, upload %.1f ms",
+                  m_model.cdlod.getLastSelectMs(),
+                  m_model.cdlod.getLastBuildMs(),
+                  m_model.cdlod.getLastUploadMs());
+    } else if (m_model.renderer == 3) {
+      ImGui::SliderFloat("Fly speed", &ui_flySpeed, 0.0f, 50.0f);
+      vec2 fly = m_model.clipmap.getFlyOffset();
+      if (ImGui::DragFloat2("Fly offset", value_ptr(fly), 1.0f))
+        m_model.clipmap.setFlyOffset(fly);
+      ImGui::Text("%d levels of %dx%d, %.1f MB of heights",
+                  ClipmapTerrain::LEVELS, ClipmapTerrain::N,
+                  ClipmapTerrain::N,
+                  m_model.clipmap.getTextureBytes() / (1024.0 * 1024.0));
+      ImGui::Text("Last frame: %lld samples updated in %.2f ms",
+                  m_model.clipmap.getSamplesUpdated(),
+                  m_model.clipmap.getLastUpdateMs());
+    } else {
+      ImGui::Text("Mesh build %.1f ms, upload %.1f ms",
+                  m_model.mesh.getLastBuildMs(),
+                  m_model.mesh.getLastUploadMs());
+      ImGui::Text("Vertices %.1f MB, height texture %.1f MB",
+                  m_model.mesh.getVertexBytes() / (1024.0 * 1024.0),
+                  m_model.mesh.getTextureBytes() / (1024.0 * 1024.0));
+      ImGui::Text("(%d allocations, %d index builds)",
+                  m_model.mesh.getAllocations(),
+                  m_model.mesh.getIndexBuilds());
+      bool culling = m_model.mesh.getCulling();
+      if (ImGui::Checkbox("Cull terrain chunks", &culling))
+        m_model.mesh.setCulling(culling);
+      ImGui::SameLine();
+      ImGui::Text("%d drawn, %d culled", m_model.mesh.getChunksDrawn(),
+                  m_model.mesh.getChunksCulled());
+    }
+    ImGui::Text("Noise caches: %.1f MB",
+                m_terrain.cacheBytes() / (1024.0 * 1024.0));
+    bool octaveCaching = m_terrain.getOctaveCaching();
+    if (ImGui::Checkbox("Cache fBm octaves", &octaveCaching) &&
+        !m_job.isActive())
+      m_terrain.setOctaveCaching(octaveCaching);
+    if (octaveCaching && !m_terrain.octaveCacheFits()) {
+      ImGui::SameLine();
+      ImGui::Text("(over budget)");
+    }
+    if (ImGui::SliderInt("Threads (0 = all)", &ui_threads, 0,
+                         parallel::hardwareThreads()) &&
+        !m_job.isActive())
+      m_terrain.setThreadCount(ui_threads);
+    if (ImGui::Button("Benchmark thread scaling"))
+      benchmark::regenerateScaling(m_terrain);
+    if (ImGui::Button("Check noise batch parity"))
+      benchmark::noiseBatchParity();
+    if (ImGui::Button("Check normal packing round trip"))
+      benchmark::normalPacking();
+    if (ImGui::Button("Benchmark fused evaluation"))
+      benchmark::fusedEvaluation(m_terrain);
+    if (ImGui::Button("Benchmark erosion tiling (2k-8k)"))
+      benchmark::erosionTiling();
+    if (ImGui::Button("Benchmark droplet erosion (1M on 2k)"))
+      benchmark::dropletErosion();
+    if (ImGui::Button("Benchmark CDLOD budget (1k-8k)"))
+      benchmark::cdlodBudget();
+    if (ImGui::Button("Benchmark TIN reduction (1k)"))
+      benchmark::tinReduction();
+    if (ImGui::Button("Benchmark tree grid (10k-1M)"))
+      benchmark::treeGrid();
+    if (ImGui::Button("Benchmark LOD selection (1M)"))
+      benchmark::lodSelection();
+    if (ImGui::Button("Benchmark vegetation scatter (1M)"))
+      benchmark::vegetationScatter(m_terrain);
+    if (ImGui::Button("Check mesh regeneration loop") && !m_job.isActive() &&
+        m_model.renderer < 2) {
+      benchmark::meshRegenLoop(m_terrain, m_model.mesh);
+      updateTerrainViews(false);
+    }
+  }
 
-    ImGui::SliderInt("Octaves", &ui_octaves, 1, 16);
+  ImGui::Separator();
 
-    if (ImGui::InputFloat("Frequency", &ui_frequency, 0.001f, 0.0f))
-      ui_frequency = std::clamp(ui_frequency, 0.00001f, 1.0f);
+  // LOD Stuff
+  if (ImGui::CollapsingHeader("LOD", ImGuiTreeNodeFlags_DefaultOpen)) {
+    ImGui::Checkbox("Show Target", &LOD.m_show_target);
+    ImGui::Checkbox("Show LOD visualize", &LOD.m_draw_lod_visualize);
+    ImGui::Checkbox("Move LOD target", &LOD.m_move_target);
+    ImGui::Checkbox("LOD from target", &LOD.m_lod_from_target);
+    ImGui::SliderFloat("LOD pixel error", &LOD.pixel_error, 0.25f, 8.0f,
+                       "%.2f px", 2.0f);
+    ImGui::SliderFloat("LOD hysteresis", &LOD.hysteresis, 0.0f, 0.5f,
+                       "%.2f");
+    ImGui::Checkbox("Impostors", &LOD.m_use_impostors);
+    ImGui::SameLine();
+    if (ImGui::Button("Rebake")) LOD.bake_impostor();
+    if (LOD.get_impostor().isBaked())
+      ImGui::Text("Impostor atlas %dx%d, %.0f%% covered, baked in %.1f ms",
+                  LOD.get_impostor().getAtlasSize(),
+                  LOD.get_impostor().getAtlasSize(),
+                  LOD.get_impostor().getCoverage() * 100.0f,
+                  LOD.get_impostor().getBakeMs());
+    if (!LOD.get_switch_distances().empty())
+      ImGui::Text("%zu levels, last from %.1f units",
+                  LOD.get_lod_level_count(),
+                  LOD.get_switch_distances().back());
+    ImGui::SliderFloat("Tree spacing", &LOD.tree_spacing, 0.2f, 4.0f, "%.2f",
+                       2.0f);
+    ImGui::SliderFloat("Tree max slope", &LOD.tree_max_slope, 0.1f, 4.0f,
+                       "%.2f");
+    ImGui::InputInt("Tree seed", &LOD.tree_seed);
+    if (ImGui::Button("Scatter trees") && !m_job.isActive())
+      LOD.generate_trees(m_terrain, grassTopHeight);
+    ImGui::SameLine();
+    ImGui::Text("%lld samples in %.1f ms", LOD.get_scatter().getSamples(),
+                LOD.get_scatter().getLastMs());
+    ImGui::Text("%zu trees: %d draw calls, %d instance buffer rebuilds",
+                LOD.get_tree_count(), LOD.get_draw_calls(),
+                LOD.get_instance_rebuilds());
+    ImGui::Text("%d trees drawn, cells %d visible / %d culled",
+                LOD.get_trees_drawn(), LOD.get_cells_visible(),
+                LOD.get_cells_culled());
+    ImGui::Text("%lld tree triangles", LOD.get_triangles_drawn());
+    ImGui::Text("%d trees reclassified this frame",
+                LOD.get_trees_reclassified());
+  }
+  // finish creating window
+  ImGui::End();
+}
 
-    if (ImGui::InputFloat("Amplitude", &ui_amplitude, 0.01f, 0.0f))
-      ui_amplitude = std::clamp(ui_amplitude, 3.0f, 7.0f);
+void Application::renderTerrainEditGUI() {
+  ImGui::Spacing();
+  ImGui::Text("Base fbm2d Layer Parameters");
 
-    if (ImGui::InputFloat("Gain", &ui_gain, 0.01f, 0.0f))
-      ui_gain = std::clamp(ui_gain, 0.0f, 2.0f);
+  // shape edits show a coarse preview at once and refine over the next
+  // frames, see render()
+  if (ImGui::SliderInt("Octaves", &ui_octaves, 1, 16)) previewTerrain();
 
-    if (ImGui::InputFloat("Lacunarity", &ui_lacunarity, 0.01f, 0.0f))
-      ui_lacunarity = std::clamp(ui_lacunarity, 0.0001f, 3.0f);
+  if (ImGui::DragFloat("Frequency", &ui_frequency, 0.00002f, 0.00001f, 1.0f,
+                       "%.5f")) {
+    ui_frequency = std::clamp(ui_frequency, 0.00001f, 1.0f);
+    previewTerrain();
+  }
 
-    ImGui::Separator();
-    ImGui::Text("Extra Noise Layers");
+  // amplitude and gain only re-weight cached fields, so apply them live
+  if (ImGui::InputFloat("Amplitude", &ui_amplitude, 0.01f, 0.0f)) {
+    ui_amplitude = std::clamp(ui_amplitude, 3.0f, 7.0f);
+    applyNoiseEdit();
+  }
 
-    // Display each extra layer
-    auto& layers = m_terrain.getLayers();
-    for (size_t i = 0; i < layers.size(); ++i) {
-      auto& layer = layers[i];
-      float freq = layer.first;
-      float amp = layer.second;
+  if (ImGui::DragFloat("Gain", &ui_gain, 0.005f, 0.0f, 2.0f)) {
+    ui_gain = std::clamp(ui_gain, 0.0f, 2.0f);
+    previewTerrain();
+  }
 
-      ImGui::PushID((int)i);  // ensure unique IDs
-      ImGui::InputFloat("Freq", &freq, 0.001f, 0.0f);
-      ImGui::InputFloat("Amp", &amp, 0.01f, 0.0f);
-      if (ImGui::Button("Remove")) {
-        m_terrain.removeLayer(i);
-        regenerateTerrain();
-        ImGui::PopID();
-        break;  // break to avoid invalidating iterator
-      }
+  if (ImGui::InputFloat("Lacunarity", &ui_lacunarity, 0.01f, 0.0f))
+    ui_lacunarity = std::clamp(ui_lacunarity, 0.0001f, 3.0f);
+
+  ImGui::Separator();
+  ImGui::Text("Extra Noise Layers");
+
+  // Display each extra layer. Edits only re-evaluate the edited layer
+  // (amplitude edits just rescale its cached noise).
+  const auto& layers = m_terrain.getLayers();
+  for (size_t i = 0; i < layers.size(); ++i) {
+    float freq = layers[i].first;
+    float amp = layers[i].second;
+
+    ImGui::PushID((int)i);  // ensure unique IDs
+    bool changed = ImGui::InputFloat("Freq", &freq, 0.001f, 0.0f);
+    changed |= ImGui::InputFloat("Amp", &amp, 0.01f, 0.0f);
+    if (ImGui::Button("Remove")) {
+      m_terrain.removeLayer(i);
+      applyNoiseEdit();
       ImGui::PopID();
+      break;  // break to avoid invalidating iterator
+    }
+    ImGui::PopID();
 
-      // update layer if sliders changed
-      layer.first = freq;
-      layer.second = amp;
+    // update layer if sliders changed
+    if (changed) {
+      m_terrain.setLayer(i, freq, amp);
+      applyNoiseEdit();
     }
+  }
 
-    ImGui::Separator();
+  ImGui::Separator();
 
-    if (ImGui::Button("Regenerate Base + extra layers")) {
-      regenerateTerrain();
-    }
+  if (ImGui::Button("Regenerate Base + extra layers"))
+    startRegenerationJob();
 
-    ImGui::Text("Add New Layer");
-    static float newFreq = 0.005f;
-    static float newAmp = 0.5f;
+  ImGui::Text("Add New Layer");
+  static float newFreq = 0.005f;
+  static float newAmp = 0.5f;
 
-    ImGui::InputFloat("New Layer Freq", &newFreq, 0.001f, 0.0f);
-    ImGui::InputFloat("New Layer Amp", &newAmp, 0.01f, 0.0f);
+  ImGui::InputFloat("New Layer Freq", &newFreq, 0.001f, 0.0f);
+  ImGui::InputFloat("New Layer Amp", &newAmp, 0.01f, 0.0f);
 
-    if (ImGui::Button("Add Layer")) {
-      m_terrain.addLayer(newFreq, newAmp);
-      regenerateTerrain();
-    }
+  if (ImGui::Button("Add Layer")) {
+    m_terrain.addLayer(newFreq, newAmp);
+    applyNoiseEdit();
+  }
 
-    ImGui::SameLine();
-    if (ImGui::Button("Reset Base")) {
-      ui_octaves = HeightmapGenerator::DefaultParams::OCTAVES;
-      ui_frequency = HeightmapGenerator::DefaultParams::FREQUENCY;
-      ui_amplitude = HeightmapGenerator::DefaultParams::AMPLITUDE;
-      ui_gain = HeightmapGenerator::DefaultParams::GAIN;
-      ui_lacunarity = HeightmapGenerator::DefaultParams::LACUNARITY;
-
-      regenerateTerrain();
-    }
+  ImGui::SameLine();
+  if (ImGui::Button("Reset Base")) {
+    ui_octaves = HeightmapGenerator::DefaultParams::OCTAVES;
+    ui_frequency = HeightmapGenerator::DefaultParams::FREQUENCY;
+    ui_amplitude = HeightmapGenerator::DefaultParams::AMPLITUDE;
+    ui_gain = HeightmapGenerator::DefaultParams::GAIN;
+    ui_lacunarity = HeightmapGenerator::DefaultParams::LACUNARITY;
+
+    // the same shape parameters the sliders above preview
+    previewTerrain();
+  }
 
-    ImGui::Spacing();
-    ImGui::Text("Thermal Erosion");
-    ImGui::SliderInt("Iterations", &ui_erosionIterations, 1, 60);
-    ImGui::InputFloat("Repose Angle", &ui_reposeAngle, 0.01f, 0.0f);
-
-    if (ImGui::Button("Apply Erosion")) {
-      m_terrain.applyThermalErosionMultiNeighbor(ui_erosionIterations,
-                                                 ui_reposeAngle);
-      m_model.mesh =
-          plane_terrain(m_terrain.getWidth(), m_terrain.getDepth(), m_terrain);
-    }
+  ImGui::Spacing();
+  ImGui::Text("Thermal Erosion");
+  ImGui::SliderInt("Iterations", &ui_erosionIterations, 1, 60);
+  ImGui::InputFloat("Repose Angle", &ui_reposeAngle, 0.01f, 0.0f);
+  ImGui::Combo("Erosion mode", &ui_erosionMode,
+               "Dense\0Active cells only\0Temporal tiles\0");
+  if (ui_erosionMode == 1) {
+    if (ImGui::InputFloat("Stop below", &ui_erosionResidual, 0.0001f, 0.0f,
+                          6))
+      ui_erosionResidual = glm::max(0.0f, ui_erosionResidual);
+    ImGui::Text("Last run used %d iterations",
+                m_terrain.getThermalErosion().getLastIterations());
   }
 
-  ImGui::Separator();
+  if (ImGui::Button("Apply Erosion")) {
+    ThermalErosion::Params params;
+    params.iterations = ui_erosionIterations;
+    params.reposeAngleDeg = ui_reposeAngle;
+    params.residual = ui_erosionResidual;
+    startTerrainJob("Thermal erosion",
+                    [params, mode = ui_erosionMode](HeightmapGenerator& terrain) {
+                      if (mode == 1) {
+                        terrain.applyThermalErosionSparse(params);
+                      } else if (mode == 2) {
+                        terrain.applyThermalErosionBlocked(params);
+                      } else {
+                        terrain.applyThermalErosionMultiNeighbor(
+                            params.iterations, params.reposeAngleDeg);
+                      }
+                    },
+                    false);
+  }
 
-  // LOD Stuff
-  if (ImGui::CollapsingHeader("LOD", ImGuiTreeNodeFlags_DefaultOpen)) {
-    ImGui::Checkbox("Show Target", &LOD.m_show_target);
-    ImGui::Checkbox("Show LOD visualize", &LOD.m_draw_lod_visualize);
-    ImGui::Checkbox("Move LOD target", &LOD.m_move_target);
-    float lod_threshold = LOD.lod_thresholds.front();
-    if (ImGui::SliderFloat("LOD Threshold", &lod_threshold, 1.0f, 100.0f,
-                           "%.1f")) {
-      LOD.lod_thresholds.front() = glm::max(1.0f, lod_threshold);
-    }
+  ImGui::Spacing();
+  ImGui::Text("Hydraulic Erosion");
+  ImGui::SliderInt("Droplets (k)", &ui_droplets, 1, 2000);
+  ImGui::SliderInt("Brush radius", &ui_dropletBrush, 1, 8);
+  ImGui::InputInt("Seed", &ui_dropletSeed);
+
+  if (ImGui::Button("Apply Droplets")) {
+    HydraulicErosion::Params params;
+    params.droplets = ui_droplets * 1000;
+    params.brushRadius = ui_dropletBrush;
+    params.seed = uint32_t(ui_dropletSeed);
+    startTerrainJob("Droplet erosion",
+                    [params](HeightmapGenerator& terrain) {
+                      terrain.applyHydraulicErosion(params);
+                    },
+                    false);
   }
-  // finish creating window
-  ImGui::End();
+
+  ImGui::Spacing();
+  ImGui::Text("Water Simulation");
+  ImGui::Checkbox("Run", &m_pipeRunning);
+  ImGui::SameLine();
+  if (ImGui::Button("Drain")) m_terrain.resetPipeErosion();
+  ImGui::SliderInt("Steps per frame", &ui_pipeStepsPerFrame, 1, 20);
+  ImGui::SliderFloat("Rain", &ui_pipeRain, 0.0f, 0.05f, "%.3f");
+  const PipeErosion& pipe = m_terrain.getPipeErosion();
+  ImGui::Text("%lld steps, water %.1f", pipe.getStepsRun(),
+              pipe.totalWater());
 }
 
 void Application::cursorPosCallback(double xpos, double ypos) {
@@ -9,15 +9,26 @@
 #include "level_of_detail.h"
 #include "opengl.hpp"
 #include "cgra/cgra_mesh.hpp"
+#include "cdlod_terrain.hpp"
+#include "clipmap_terrain.hpp"
 #include "skeleton_model.hpp"
 #include "heightmap_generator.hpp"
+#include "terrain_job.hpp"
+#include "terrain_mesh.hpp"
+#include "tin_builder.hpp"
+#include "tin_job.hpp"
 
 // Basic model that holds the shader, mesh and transform for drawing.
 // Can be copied and modified for adding in extra information for drawing
 // including textures for texture mapping etc.
 struct basic_model {
 	GLuint shader = 0;
-	cgra::gl_mesh mesh;
+	TerrainMesh mesh;
+	CdlodTerrain cdlod;
+	ClipmapTerrain clipmap;
+	cgra::gl_mesh tin;
+	// 0 = vertex buffer, 1 = height texture, 2 = CDLOD, 3 = clipmap, 4 = TIN
+	int renderer = 0;
 	glm::vec3 color{ 0.38f, 0.2f, 0.1f };
 	glm::mat4 modelTransform{ 1.0 };
 	GLuint texture;
@@ -80,9 +91,35 @@ private:
 
 	int ui_erosionIterations = 60;
 	float ui_reposeAngle = 50.0f;
+	int ui_erosionMode = 1; // 0 = dense, 1 = active cells, 2 = temporal tiles
+	float ui_erosionResidual = 0.0f;
+	int ui_droplets = 200; // thousands
+	int ui_dropletBrush = 3;
+	int ui_dropletSeed = 1;
+	bool m_pipeRunning = false; // steps the water simulation every frame
+	int ui_pipeStepsPerFrame = 2;
+	float ui_pipeRain = 0.012f;
+	float ui_flySpeed = 0.0f; // world units per second over the clipmap
+	float ui_tinMaxError = 0.02f; // height units
 
 	float grassTopHeight = -2;
 
+	// performance
+	int ui_threads = 0; // 0 = every core
+	double m_lastRegenMs = 0.0;
+	double m_lastPreviewMs = 0.0;
+	TinBuilder::Result m_tin;
+	bool m_tinStale = false; // heights changed since the TIN was built
+	TinJob m_tinJob; // background TIN build, uploaded to m_model.tin when done
+	bool m_tinQueued = false; // rebuild once the running TIN build finishes
+
+	// time per frame spent refining a parameter preview
+	static constexpr double PREVIEW_BUDGET_MS = 8.0;
+
+	// background regeneration/erosion, swapped into m_terrain when done
+	TerrainJob m_job;
+	bool m_jobReplacesTrees = false;
+
 	// geometry
 	basic_model m_model;
 
@@ -97,8 +134,18 @@ public:
 	Application(const Application&) = delete;
 	Application& operator=(const Application&) = delete;
 
-	// rendering callbacks (every frame)
+	// terrain updates
 	void regenerateTerrain();
+	void previewTerrain();
+	void startRegenerationJob();
+	void applyNoiseEdit();
+	void updateTerrainMesh(int stride);
+	void buildTin();
+	void updateTerrainViews(bool replaceTrees);
+	void startTerrainJob(const std::string& name, TerrainJob::Work work, bool replaceTrees);
+	void renderTerrainEditGUI();
+
+	// rendering callbacks (every frame)
 	void render();
 	void renderGUI();
 
@@ -0,0 +1,220 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "frustum.hpp"
+#include "parallel.hpp"
+
+// Node selection for continuous distance-dependent level of detail (CDLOD,
+// Strugar 2009) over a row-major width x depth heightmap.
+//
+// The map is covered by a quadtree whose leaves are GRID x GRID cells; a
+// node at level l is GRID << l cells a side and is drawn as the same
+// GRID x GRID quad patch, so every level halves the vertex density. Each
+// level has a view distance range[l] = lodDistance * 2^l. A node is drawn
+// at its own level if it is outside the range of the level below;
+// otherwise its children are visited, and the quadrants whose children
+// fall outside that range are drawn as parts of the node itself.
+//
+// The vertex shader morphs each patch vertex onto the grid of the next
+// level as it approaches the end of its level's range, so neighbouring
+// nodes of different levels meet on identical vertices and the mesh stays
+// crack-free without skirts or stitching.
+//
+// Node bounding boxes come from a min/max height pyramid built once per
+// heightmap change; selection itself only touches the pyramid, so its cost
+// depends on the view, not on the map size.
+class CdlodQuadtree {
+ public:
+  static constexpr int GRID = 32;  // patch quads per node side
+  static constexpr int MAX_LEVELS = 16;
+
+  // Quadrant bits of Node::quadrants
+  static constexpr uint8_t TOP_LEFT = 1, TOP_RIGHT = 2, BOTTOM_LEFT = 4,
+                           BOTTOM_RIGHT = 8, ALL_QUADRANTS = 15;
+
+  struct Settings {
+    // world position of cell (x, z) is offset + (x * scaleX, h, z * scaleZ)
+    glm::vec3 offset{-10.0f, 0.0f, -10.0f};
+    float scaleX = 0.02f;
+    float scaleZ = 0.02f;
+    // world-space range of level 0; raised if needed so neighbouring nodes
+    // differ by at most one level
+    float lodDistance = 3.0f;
+    // fraction of a level's range after which its vertices start morphing
+    float morphStart = 0.7f;
+    // finest level drawn, e.g. log2 of a preview stride
+    int minLevel = 0;
+  };
+
+  struct Node {
+    int x, z;   // first cell
+    int level;  // size GRID << level cells
+    uint8_t quadrants;
+  };
+
+  // Builds the min/max pyramid for heights
+  void build(const std::vector<float>& heights, int mapWidth, int mapDepth,
+             int threads = 0) {
+    width = mapWidth;
+    depth = mapDepth;
+    const int cells = std::max(width, depth) - 1;
+    levels = 1;
+    while ((GRID << (levels - 1)) < cells && levels < MAX_LEVELS) ++levels;
+
+    pyramid.resize(levels);
+    for (int l = 0; l < levels; ++l) {
+      MinMaxLevel& level = pyramid[l];
+      const int size = GRID << l;
+      level.cols = std::max(1, (width - 1 + size - 1) / size);
+      level.rows = std::max(1, (depth - 1 + size - 1) / size);
+      level.bounds.resize(size_t(level.cols) * level.rows);
+    }
+
+    // leaves from the heights: rows of leaves are independent
+    MinMaxLevel& leaves = pyramid[0];
+    parallel::forTiles(0, leaves.rows, 1, threads, [&](int r0, int r1) {
+      for (int r = r0; r < r1; ++r) {
+        const int z0 = r * GRID, z1 = std::min(z0 + GRID, depth - 1);
+        for (int c = 0; c < leaves.cols; ++c) {
+          const int x0 = c * GRID, x1 = std::min(x0 + GRID, width - 1);
+          float lo = std::numeric_limits<float>::max();
+          float hi = std::numeric_limits<float>::lowest();
+          for (int z = z0; z <= z1; ++z) {
+            const float* row = &heights[size_t(z) * width];
+            for (int x = x0; x <= x1; ++x) {
+              lo = std::min(lo, row[x]);
+              hi = std::max(hi, row[x]);
+            }
+          }
+          leaves.bounds[size_t(r) * leaves.cols + c] = {lo, hi};
+        }
+      }
+    });
+
+    // every other level from the one below
+    for (int l = 1; l < levels; ++l) {
+      const MinMaxLevel& below = pyramid[l - 1];
+      MinMaxLevel& level = pyramid[l];
+      for (int r = 0; r < level.rows; ++r) {
+        for (int c = 0; c < level.cols; ++c) {
+          glm::vec2 range(std::numeric_limits<float>::max(),
+                          std::numeric_limits<float>::lowest());
+          for (int cr = 2 * r; cr < std::min(2 * r + 2, below.rows); ++cr) {
+            for (int cc = 2 * c; cc < std::min(2 * c + 2, below.cols); ++cc) {
+              const glm::vec2 b = below.bounds[size_t(cr) * below.cols + cc];
+              range.x = std::min(range.x, b.x);
+              range.y = std::max(range.y, b.y);
+            }
+          }
+          level.bounds[size_t(r) * level.cols + c] = range;
+        }
+      }
+    }
+  }
+
+  int getLevelCount() const { return levels; }
+  int getWidth() const { return width; }
+  int getDepth() const { return depth; }
+
+  // View distance of every level for settings, as used by select()
+  std::vector<float> ranges(const Settings& settings) const {
+    // a node's neighbours must be within one level, which holds when every
+    // range exceeds the diagonal of that level's nodes (twice, for margin)
+    const float leafDiagonal =
+        GRID * std::sqrt(settings.scaleX * settings.scaleX +
+                         settings.scaleZ * settings.scaleZ);
+    std::vector<float> result(levels);
+    float range = std::max(settings.lodDistance, 2.0f * leafDiagonal);
+    for (int l = 0; l < levels; ++l, range *= 2.0f) result[l] = range;
+    return result;
+  }
+
+  // Appends the nodes to draw for a camera at `camera` (world space) to
+  // out, skipping nodes outside frustum. Returns the number of nodes culled.
+  int select(const glm::vec3& camera, const Frustum& frustum,
+             const Settings& settings, std::vector<Node>& out) const {
+    if (levels == 0) return 0;
+    Selection selection{camera, frustum, settings, ranges(settings), out, 0};
+    const int root = levels - 1;
+    // the root is drawn however far away the camera is
+    selection.ranges[root] = std::numeric_limits<float>::infinity();
+    selection.minLevel = std::clamp(settings.minLevel, 0, root);
+    selectNode(selection, 0, 0, root);
+    return selection.culled;
+  }
+
+  Aabb nodeBounds(int x, int z, int level, const Settings& settings) const {
+    const MinMaxLevel& l = pyramid[level];
+    const int size = GRID << level;
+    const glm::vec2 h = l.bounds[size_t(z / size) * l.cols + x / size];
+    const int x1 = std::min(x + size, width - 1);
+    const int z1 = std::min(z + size, depth - 1);
+    Aabb box;
+    box.min = settings.offset +
+              glm::vec3(x * settings.scaleX, h.x, z * settings.scaleZ);
+    box.max = settings.offset +
+              glm::vec3(x1 * settings.scaleX, h.y, z1 * settings.scaleZ);
+    return box;
+  }
+
+ private:
+  struct MinMaxLevel {
+    int cols = 0, rows = 0;
+    std::vector<glm::vec2> bounds;  // min, max height per node
+  };
+
+  struct Selection {
+    const glm::vec3& camera;
+    const Frustum& frustum;
+    const Settings& settings;
+    std::vector<float> ranges;
+    std::vector<Node>& out;
+    int culled;
+    int minLevel = 0;
+  };
+
+  int width = 0, depth = 0;
+  int levels = 0;
+  std::vector<MinMaxLevel> pyramid;
+
+  static bool withinRange(const Aabb& box, const glm::vec3& p, float range) {
+    const glm::vec3 nearest = glm::clamp(p, box.min, box.max);
+    const glm::vec3 d = nearest - p;
+    return glm::dot(d, d) <= range * range;
+  }
+
+  // Returns false if the node is beyond its own level's range, in which
+  // case the parent draws that quadrant itself
+  bool selectNode(Selection& s, int x, int z, int level) const {
+    const Aabb box = nodeBounds(x, z, level, s.settings);
+    if (!withinRange(box, s.camera, s.ranges[level])) return false;
+    if (!s.frustum.intersects(box)) {
+      ++s.culled;
+      return true;
+    }
+
+    if (level == s.minLevel ||
+        !withinRange(box, s.camera, s.ranges[level - 1])) {
+      s.out.push_back({x, z, level, ALL_QUADRANTS});
+      return true;
+    }
+
+    const int half = (GRID << level) / 2;
+    uint8_t own = 0;
+    const uint8_t bits[4] = {TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT};
+    for (int q = 0; q < 4; ++q) {
+      const int cx = x + (q & 1) * half, cz = z + (q >> 1) * half;
+      // children past the map edge have nothing to draw
+      if (cx >= width - 1 || cz >= depth - 1) continue;
+      if (!selectNode(s, cx, cz, level - 1)) own |= bits[q];
+    }
+    if (own) s.out.push_back({x, z, level, own});
+    return true;
+  }
+};
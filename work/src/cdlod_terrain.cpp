@@ -0,0 +1,202 @@
+// std
+#include <chrono>
+#include <cmath>
+
+// glm
+#include <glm/gtc/type_ptr.hpp>
+
+// project
+#include "cdlod_terrain.hpp"
+
+using namespace std;
+using namespace glm;
+
+namespace {
+
+double msSince(chrono::steady_clock::time_point start) {
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start)
+      .count();
+}
+
+}  // namespace
+
+void CdlodTerrain::update(const HeightmapGenerator& terrain, int stride) {
+  const int width = terrain.getWidth(), depth = terrain.getDepth();
+  if (width < 2 || depth < 2) return;
+
+  // nodes of level l have vertices every 2^l cells, which are all preview
+  // samples once 2^l >= stride (strides are powers of two)
+  settings.minLevel = 0;
+  while ((1 << settings.minLevel) < stride) ++settings.minLevel;
+
+  auto start = chrono::steady_clock::now();
+  quadtree.build(terrain.getHeights(), width, depth,
+                 terrain.getThreadCount());
+  lastBuildMs = msSince(start);
+
+  start = chrono::steady_clock::now();
+  if (vao == 0) createPatch();
+  if (heightTexture == 0) glGenTextures(1, &heightTexture);
+  glActiveTexture(GL_TEXTURE4);
+  glBindTexture(GL_TEXTURE_2D, heightTexture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  if (width != textureWidth || depth != textureDepth) {
+    // linear, so morphing vertices slide smoothly between samples
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, depth, 0, GL_RED, GL_FLOAT,
+                 terrain.getHeights().data());
+    textureWidth = width;
+    textureDepth = depth;
+  } else {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, depth, GL_RED, GL_FLOAT,
+                    terrain.getHeights().data());
+  }
+  glActiveTexture(GL_TEXTURE0);
+  lastUploadMs = msSince(start);
+}
+
+void CdlodTerrain::draw(GLuint shader, const mat4& view, const mat4& proj,
+                        const mat4& model) {
+  if (vao == 0 || quadtree.getLevelCount() == 0) return;
+
+  // select in the terrain's own space
+  auto start = chrono::steady_clock::now();
+  const mat4 modelView = view * model;
+  const vec3 camera = vec3(inverse(modelView)[3]);
+  nodes.clear();
+  nodesCulled =
+      quadtree.select(camera, Frustum(proj * modelView), settings, nodes);
+  nodesDrawn = int(nodes.size());
+
+  // instances grouped by quadrant
+  int quadrantStart[5] = {0, 0, 0, 0, 0};
+  instances.clear();
+  for (int q = 0; q < 4; ++q) {
+    quadrantStart[q] = int(instances.size());
+    for (const CdlodQuadtree::Node& node : nodes) {
+      if (node.quadrants & (1 << q)) {
+        instances.emplace_back(node.x, node.z,
+                               float(CdlodQuadtree::GRID << node.level),
+                               node.level);
+      }
+    }
+  }
+  quadrantStart[4] = int(instances.size());
+  trianglesDrawn =
+      (long long)instances.size() * QUADRANT_QUADS * QUADRANT_QUADS * 2;
+  lastSelectMs = msSince(start);
+  if (instances.empty()) return;
+
+  // level l morphs onto level l + 1 over the last part of its range; the
+  // root has nothing coarser to morph to
+  const vector<float> ranges = quadtree.ranges(settings);
+  vector<vec2> morph(CdlodQuadtree::MAX_LEVELS, vec2(1e30f, 2e30f));
+  for (int l = 0; l + 1 < quadtree.getLevelCount(); ++l) {
+    const float previous = l > 0 ? ranges[l - 1] : 0.0f;
+    morph[l].x = previous + (ranges[l] - previous) * settings.morphStart;
+    morph[l].y = ranges[l];
+  }
+
+  glUniform2i(glGetUniformLocation(shader, "uTerrainSize"), textureWidth,
+              textureDepth);
+  glUniform3fv(glGetUniformLocation(shader, "uTerrainOffset"), 1,
+               value_ptr(settings.offset));
+  glUniform2f(glGetUniformLocation(shader, "uTerrainScale"), settings.scaleX,
+              settings.scaleZ);
+  glUniform3fv(glGetUniformLocation(shader, "uCameraPos"), 1,
+               value_ptr(camera));
+  glUniform2fv(glGetUniformLocation(shader, "uMorph"), GLsizei(morph.size()),
+               value_ptr(morph[0]));
+  glUniform1f(glGetUniformLocation(shader, "uGrid"),
+              float(CdlodQuadtree::GRID));
+
+  // units 0-3 hold the surface textures
+  glActiveTexture(GL_TEXTURE4);
+  glBindTexture(GL_TEXTURE_2D, heightTexture);
+  glUniform1i(glGetUniformLocation(shader, "uHeightMap"), 4);
+  glActiveTexture(GL_TEXTURE0);
+
+  // stream the instances, orphaning last frame's storage
+  const size_t bytes = instances.size() * sizeof(vec4);
+  glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+  if (bytes > instanceBytes) instanceBytes = std::max(bytes, 2 * instanceBytes);
+  glBufferData(GL_ARRAY_BUFFER, instanceBytes, nullptr, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, instances.data());
+
+  // GL 3.3 has no base instance, so the attribute is re-pointed per draw
+  glBindVertexArray(vao);
+  for (int q = 0; q < 4; ++q) {
+    const int count = quadrantStart[q + 1] - quadrantStart[q];
+    if (count == 0) continue;
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(vec4),
+                          (void*)(size_t(quadrantStart[q]) * sizeof(vec4)));
+    glDrawElementsInstanced(
+        GL_TRIANGLES, QUADRANT_INDICES, GL_UNSIGNED_INT,
+        (void*)(size_t(q) * QUADRANT_INDICES * sizeof(unsigned int)), count);
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void CdlodTerrain::destroy() {
+  glDeleteBuffers(1, &gridVbo);
+  glDeleteBuffers(1, &ibo);
+  glDeleteBuffers(1, &instanceVbo);
+  glDeleteVertexArrays(1, &vao);
+  glDeleteTextures(1, &heightTexture);
+  vao = gridVbo = ibo = instanceVbo = heightTexture = 0;
+  instanceBytes = 0;
+  textureWidth = textureDepth = 0;
+}
+
+// The GRID x GRID patch: vertex grid coordinates, and indices ordered
+// top-left, top-right, bottom-left then bottom-right quadrant
+void CdlodTerrain::createPatch() {
+  const int n = CdlodQuadtree::GRID + 1;
+  vector<vec2> grid;
+  grid.reserve(size_t(n) * n);
+  for (int z = 0; z < n; ++z)
+    for (int x = 0; x < n; ++x) grid.emplace_back(x, z);
+
+  vector<unsigned int> indices;
+  indices.reserve(4 * QUADRANT_INDICES);
+  for (int q = 0; q < 4; ++q) {
+    const int x0 = (q & 1) * QUADRANT_QUADS, z0 = (q >> 1) * QUADRANT_QUADS;
+    for (int z = z0; z < z0 + QUADRANT_QUADS; ++z) {
+      for (int x = x0; x < x0 + QUADRANT_QUADS; ++x) {
+        const unsigned int topLeft = z * n + x;
+        const unsigned int topRight = topLeft + 1;
+        const unsigned int bottomLeft = (z + 1) * n + x;
+        const unsigned int bottomRight = bottomLeft + 1;
+        indices.insert(indices.end(), {topLeft, bottomLeft, topRight, topRight,
+                                       bottomLeft, bottomRight});
+      }
+    }
+  }
+
+  glGenVertexArrays(1, &vao);
+  glGenBuffers(1, &gridVbo);
+  glGenBuffers(1, &ibo);
+  glGenBuffers(1, &instanceVbo);
+  glBindVertexArray(vao);
+
+  glBindBuffer(GL_ARRAY_BUFFER, gridVbo);
+  glBufferData(GL_ARRAY_BUFFER, grid.size() * sizeof(vec2), grid.data(),
+               GL_STATIC_DRAW);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(vec2), (void*)0);
+
+  glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(vec4), (void*)0);
+  glVertexAttribDivisor(1, 1);
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
+               indices.data(), GL_STATIC_DRAW);
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "cdlod_quadtree.hpp"
+#include "heightmap_generator.hpp"
+#include "opengl.hpp"
+
+// Draws the terrain with CDLOD level of detail (see CdlodQuadtree).
+//
+// The heights live in an R32F texture and the geometry is one GRID x GRID
+// patch whose indices are grouped by quadrant. Every frame the quadtree
+// selects the visible nodes and their per-node data (first cell, size,
+// level) is streamed into an instance buffer, grouped by quadrant, so the
+// whole terrain takes four instanced draws. cdlod_vert.glsl places,
+// displaces and morphs the patch vertices.
+//
+// The triangle count depends on the view and the LOD distance, not on the
+// map size, so 8k x 8k maps draw with about the same budget as 1k ones.
+//
+// Like cgra::gl_mesh, GL objects are released by destroy(), not by the
+// destructor, as the context may already be gone by then.
+class CdlodTerrain {
+ public:
+  explicit CdlodTerrain(glm::vec3 offset = {-10, 0, -10}, float scaleX = 0.02f,
+                        float scaleZ = 0.02f) {
+    settings.offset = offset;
+    settings.scaleX = scaleX;
+    settings.scaleZ = scaleZ;
+  }
+
+  CdlodTerrain(const CdlodTerrain&) = delete;
+  CdlodTerrain& operator=(const CdlodTerrain&) = delete;
+
+  // Rebuilds the min/max pyramid and uploads the heights. While a preview
+  // only has every stride-th sample, nodes finer than the stride are not
+  // drawn.
+  void update(const HeightmapGenerator& terrain, int stride = 1);
+
+  // Selects and draws the nodes visible from view with `shader`, which
+  // must be built from cdlod_vert.glsl
+  void draw(GLuint shader, const glm::mat4& view, const glm::mat4& proj,
+            const glm::mat4& model);
+
+  // Deletes every GL object
+  void destroy();
+
+  void setLodDistance(float distance) { settings.lodDistance = distance; }
+  float getLodDistance() const { return settings.lodDistance; }
+
+  // Statistics for the last update() and draw()
+  double getLastBuildMs() const { return lastBuildMs; }
+  double getLastUploadMs() const { return lastUploadMs; }
+  double getLastSelectMs() const { return lastSelectMs; }
+  int getNodesDrawn() const { return nodesDrawn; }
+  int getNodesCulled() const { return nodesCulled; }
+  long long getTrianglesDrawn() const { return trianglesDrawn; }
+  int getLevelCount() const { return quadtree.getLevelCount(); }
+  size_t getTextureBytes() const {
+    return size_t(textureWidth) * textureDepth * sizeof(float);
+  }
+
+ private:
+  static constexpr int QUADRANT_QUADS = CdlodQuadtree::GRID / 2;
+  static constexpr int QUADRANT_INDICES = QUADRANT_QUADS * QUADRANT_QUADS * 6;
+
+  CdlodQuadtree quadtree;
+  CdlodQuadtree::Settings settings;
+
+  GLuint vao = 0;
+  GLuint gridVbo = 0, ibo = 0;
+  GLuint instanceVbo = 0;
+  size_t instanceBytes = 0;  // size of the instance buffer storage
+  GLuint heightTexture = 0;
+  int textureWidth = 0, textureDepth = 0;
+
+  // per frame, reused
+  std::vector<CdlodQuadtree::Node> nodes;
+  std::vector<glm::vec4> instances;
+
+  double lastBuildMs = 0.0;
+  double lastUploadMs = 0.0;
+  double lastSelectMs = 0.0;
+  int nodesDrawn = 0, nodesCulled = 0;
+  long long trianglesDrawn = 0;
+
+  void createPatch();
+};
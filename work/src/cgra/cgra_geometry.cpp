@@ -45,31 +45,40 @@ namespace cgra {
 		}
 	}
 
-	gl_mesh plane_terrain(int width, int depth, HeightmapGenerator& terrain, glm::vec3 offset, float scaleX, float scaleZ) {
+	gl_mesh plane_terrain(int width, int depth, HeightmapGenerator& terrain, glm::vec3 offset, float scaleX, float scaleZ, int stride) {
 		using namespace glm;
 		using namespace cgra;
 
 		std::vector<mesh_vertex> vertices;
 		std::vector<unsigned int> indices;
 
+		// Sample lattice (every sample at stride 1)
+		stride = std::max(1, stride);
+		const int cols = HeightmapGenerator::latticeCount(width, stride);
+		const int rows = HeightmapGenerator::latticeCount(depth, stride);
+
 		// Precompute vertex positions
-		std::vector<vec3> positions(width * depth);
-		for (int z = 0; z < depth; ++z) {
-			for (int x = 0; x < width; ++x) {
+		std::vector<vec3> positions(cols * rows);
+		for (int r = 0; r < rows; ++r) {
+			int z = HeightmapGenerator::latticeIndex(depth, stride, r);
+			for (int c = 0; c < cols; ++c) {
+				int x = HeightmapGenerator::latticeIndex(width, stride, c);
 				float h = terrain.getHeight(x, z);
-				positions[z * width + x] = vec3(x * scaleX, h, z * scaleZ) + offset;
+				positions[r * cols + c] = vec3(x * scaleX, h, z * scaleZ) + offset;
 			}
 		}
 
-		// Build vertices with initial zero normals
-		for (int z = 0; z < depth; ++z) {
-			for (int x = 0; x < width; ++x) {
+		// Build vertices, with normals from the generator's gradients
+		for (int r = 0; r < rows; ++r) {
+			int z = HeightmapGenerator::latticeIndex(depth, stride, r);
+			for (int c = 0; c < cols; ++c) {
+			int x = HeightmapGenerator::latticeIndex(width, stride, c);
 			vec2 uv = vec2(float(x) / (width - 1), float(z) / (depth - 1));
-            vec3 p = positions[z * width + x];
+            vec3 p = positions[r * cols + c];
             float h = p.y; // world-space height (including offset.y)
             mesh_vertex v;
             v.pos = p;
-            v.norm = vec3(0.0f); // accumulate later
+            v.norm = terrain.getNormal(x, z, scaleX, scaleZ);
             v.uv = uv;
             v.height = h;
             vertices.push_back(v);
@@ -77,11 +86,11 @@ namespace cgra {
 		}
 
 		// Build indices
-		for (int z = 0; z < depth - 1; ++z) {
-			for (int x = 0; x < width - 1; ++x) {
-				int topLeft = z * width + x;
+		for (int z = 0; z < rows - 1; ++z) {
+			for (int x = 0; x < cols - 1; ++x) {
+				int topLeft = z * cols + x;
 				int topRight = topLeft + 1;
-				int bottomLeft = (z + 1) * width + x;
+				int bottomLeft = (z + 1) * cols + x;
 				int bottomRight = bottomLeft + 1;
 
 				// First triangle
@@ -96,31 +105,36 @@ namespace cgra {
 			}
 		}
 
-		// Compute normals per triangle and accumulate to vertices
-		for (size_t i = 0; i < indices.size(); i += 3) {
-			unsigned int i0 = indices[i];
-			unsigned int i1 = indices[i + 1];
-			unsigned int i2 = indices[i + 2];
+		mesh_builder builder;
+		builder.vertices = std::move(vertices);
+		builder.indices = std::move(indices);
+		return builder.build();
+	}
 
-			vec3 v0 = vertices[i0].pos;
-			vec3 v1 = vertices[i1].pos;
-			vec3 v2 = vertices[i2].pos;
+	gl_mesh tin_terrain(const TinBuilder::Result& tin, const HeightmapGenerator& terrain, glm::vec3 offset, float scaleX, float scaleZ) {
+		using namespace glm;
+		using namespace cgra;
 
-			vec3 normal = normalize(cross(v1 - v0, v2 - v0));
+		const int width = terrain.getWidth();
+		const int depth = terrain.getDepth();
 
-			vertices[i0].norm += normal;
-			vertices[i1].norm += normal;
-			vertices[i2].norm += normal;
+		mesh_builder builder;
+		builder.vertices.reserve(tin.vertices.size());
+		for (const ivec2& p : tin.vertices) {
+			mesh_vertex v;
+			v.pos = vec3(p.x * scaleX, terrain.getHeight(p.x, p.y), p.y * scaleZ) + offset;
+			v.uv = vec2(float(p.x) / (width - 1), float(p.y) / (depth - 1));
+			v.height = v.pos.y;
+			v.norm = terrain.getNormal(p.x, p.y, scaleX, scaleZ);
+			builder.vertices.push_back(v);
 		}
 
-		// Normalize accumulated normals
-		for (auto& v : vertices) {
-			v.norm = normalize(v.norm);
+		builder.indices.reserve(tin.triangles.size() * 3);
+		for (const ivec3& t : tin.triangles) {
+			builder.indices.push_back(t.x);
+			builder.indices.push_back(t.y);
+			builder.indices.push_back(t.z);
 		}
-
-		mesh_builder builder;
-		builder.vertices = std::move(vertices);
-		builder.indices = std::move(indices);
 		return builder.build();
 	}
 
@@ -3,6 +3,7 @@
 
 #include "cgra_mesh.hpp"
 #include <heightmap_generator.hpp>
+#include <tin_builder.hpp>
  
 namespace cgra {
 	
@@ -10,7 +11,15 @@ namespace cgra {
 	// immediately draws the sphere mesh, assuming the shader is set up
 	void drawSphere();
 
-	gl_mesh plane_terrain(int width, int depth, HeightmapGenerator& terrain, glm::vec3 offset = { -10,0,-10 }, float scaleX = 0.02f, float scaleZ = 0.02f);
+	// Grid mesh over terrain's heights. With stride > 1 only every stride-th
+	// sample (plus the last row and column) becomes a vertex, see
+	// HeightmapGenerator::beginPreview.
+	gl_mesh plane_terrain(int width, int depth, HeightmapGenerator& terrain, glm::vec3 offset = { -10,0,-10 }, float scaleX = 0.02f, float scaleZ = 0.02f, int stride = 1);
+
+	// Mesh over a TinBuilder triangulation of terrain's heights, placed like
+	// plane_terrain(). Normals come from the generator's gradients, so
+	// lighting keeps detail the triangles dropped.
+	gl_mesh tin_terrain(const TinBuilder::Result& tin, const HeightmapGenerator& terrain, glm::vec3 offset = { -10,0,-10 }, float scaleX = 0.02f, float scaleZ = 0.02f);
 
 	// creates a mesh for a unit cylinder (radius and hieght of 1) along the z-axis
 	// immediately draws the sphere mesh, assuming the shader is set up
@@ -0,0 +1,200 @@
+// std
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+
+// glm
+#include <glm/gtc/type_ptr.hpp>
+
+// project
+#include "clipmap_terrain.hpp"
+#include "parallel.hpp"
+
+using namespace std;
+using namespace glm;
+
+namespace {
+
+double msSince(chrono::steady_clock::time_point start) {
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start)
+      .count();
+}
+
+int wrap(int s, int n) { return ((s % n) + n) % n; }
+
+}  // namespace
+
+void ClipmapTerrain::draw(GLuint shader, const mat4& view,
+                          const mat4& model) {
+  if (!source) return;
+  if (vao == 0) create();
+
+  const mat4 modelView = view * model;
+  const vec3 camera =
+      vec3(inverse(modelView)[3]) + vec3(flyOffset.x, 0.0f, flyOffset.y);
+
+  auto start = chrono::steady_clock::now();
+  updateLevels(camera);
+  lastUpdateMs = msSince(start);
+
+  glUniform1i(glGetUniformLocation(shader, "uN"), N);
+  glUniform1i(glGetUniformLocation(shader, "uTransition"), TRANSITION);
+  glUniform3fv(glGetUniformLocation(shader, "uTerrainOffset"), 1,
+               value_ptr(offset));
+  glUniform2f(glGetUniformLocation(shader, "uTerrainScale"), scaleX, scaleZ);
+  glUniform2fv(glGetUniformLocation(shader, "uFlyOffset"), 1,
+               value_ptr(flyOffset));
+  glUniform2i(glGetUniformLocation(shader, "uTerrainSize"),
+              source->getWidth(), source->getDepth());
+
+  // units 0-3 hold the surface textures
+  glActiveTexture(GL_TEXTURE4);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, heightTexture);
+  glUniform1i(glGetUniformLocation(shader, "uHeightMaps"), 4);
+  glActiveTexture(GL_TEXTURE0);
+
+  glBindVertexArray(vao);
+  for (int l = 0; l < LEVELS; ++l) {
+    glUniform1i(glGetUniformLocation(shader, "uLevel"), l);
+    glUniform2iv(glGetUniformLocation(shader, "uOrigin"), 1,
+                 value_ptr(levels[l].origin));
+    glUniform1i(glGetUniformLocation(shader, "uBlend"), l < LEVELS - 1);
+
+    if (l == 0) {
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, fullGrid);
+      glDrawElements(GL_TRIANGLES, fullCount, GL_UNSIGNED_INT, 0);
+    } else {
+      // the finer level covers HALF quads starting HALF / 2 or one more in
+      const ivec2 hole = levels[l - 1].origin / 2 - levels[l].origin;
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
+                   holeGrids[hole.y - HALF / 2][hole.x - HALF / 2]);
+      glDrawElements(GL_TRIANGLES, holeCount, GL_UNSIGNED_INT, 0);
+    }
+  }
+  glBindVertexArray(0);
+}
+
+void ClipmapTerrain::destroy() {
+  glDeleteVertexArrays(1, &vao);
+  glDeleteTextures(1, &heightTexture);
+  glDeleteBuffers(1, &fullGrid);
+  glDeleteBuffers(4, &holeGrids[0][0]);
+  vao = heightTexture = fullGrid = 0;
+  for (auto& row : holeGrids) row[0] = row[1] = 0;
+  levelsValid = false;
+}
+
+void ClipmapTerrain::create() {
+  // vertices come from gl_VertexID, but core profiles need a VAO bound
+  glGenVertexArrays(1, &vao);
+
+  glGenTextures(1, &heightTexture);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, heightTexture);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32F, N, N, LEVELS, 0, GL_RED,
+               GL_FLOAT, nullptr);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  glBindVertexArray(0);
+  fullGrid = buildIndices(-1, -1, fullCount);
+  for (int z = 0; z < 2; ++z)
+    for (int x = 0; x < 2; ++x)
+      holeGrids[z][x] = buildIndices(HALF / 2 + x, HALF / 2 + z, holeCount);
+  levelsValid = false;
+}
+
+// Indices of the N x N grid, leaving out the HALF x HALF quads from
+// (holeX, holeZ) unless holeX is negative
+GLuint ClipmapTerrain::buildIndices(int holeX, int holeZ, int& count) const {
+  vector<unsigned int> indices;
+  indices.reserve(size_t(N - 1) * (N - 1) * 6);
+  for (int z = 0; z < N - 1; ++z) {
+    for (int x = 0; x < N - 1; ++x) {
+      if (holeX >= 0 && x >= holeX && x < holeX + HALF && z >= holeZ &&
+          z < holeZ + HALF)
+        continue;
+      const unsigned int topLeft = z * N + x;
+      const unsigned int topRight = topLeft + 1;
+      const unsigned int bottomLeft = (z + 1) * N + x;
+      const unsigned int bottomRight = bottomLeft + 1;
+      indices.insert(indices.end(), {topLeft, bottomLeft, topRight, topRight,
+                                     bottomLeft, bottomRight});
+    }
+  }
+  count = int(indices.size());
+
+  GLuint ibo = 0;
+  glGenBuffers(1, &ibo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
+               indices.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  return ibo;
+}
+
+// Moves every level's window to the camera and fills in what it exposed
+void ClipmapTerrain::updateLevels(const vec3& camera) {
+  samplesUpdated = 0;
+  const vec2 cell((camera.x - offset.x) / scaleX,
+                  (camera.z - offset.z) / scaleZ);
+
+  for (int l = 0; l < LEVELS; ++l) {
+    // even origins, so level l's vertices are every other one of level l+1
+    const vec2 sample = cell / float(1 << l);
+    const ivec2 origin =
+        2 * ivec2(int(std::floor(sample.x / 2)), int(std::floor(sample.y / 2))) -
+        ivec2(HALF);
+    const ivec2 old = levels[l].origin;
+    const ivec2 moved = origin - old;
+    levels[l].origin = origin;
+
+    if (!levelsValid || std::abs(moved.x) >= N || std::abs(moved.y) >= N) {
+      fillRect(l, origin.x, origin.y, N, N);
+      continue;
+    }
+    // the L-shaped strip: new columns, then new rows
+    if (moved.x > 0) fillRect(l, old.x + N, origin.y, moved.x, N);
+    if (moved.x < 0) fillRect(l, origin.x, origin.y, -moved.x, N);
+    if (moved.y > 0) fillRect(l, origin.x, old.y + N, N, moved.y);
+    if (moved.y < 0) fillRect(l, origin.x, origin.y, N, -moved.y);
+  }
+  levelsValid = true;
+}
+
+// Evaluates level samples [x0, x0 + w) x [z0, z0 + h) and uploads them to
+// their toroidal texels, in up to four pieces where they wrap
+void ClipmapTerrain::fillRect(int level, int x0, int z0, int w, int h) {
+  const int step = 1 << level;
+  staging.resize(size_t(w) * h);
+  parallel::forTiles(0, h, 8, source->getThreadCount(), [&](int r0, int r1) {
+    for (int r = r0; r < r1; ++r)
+      source->sampleRow(x0 * step, step, (z0 + r) * step, w,
+                        &staging[size_t(r) * w]);
+  });
+  samplesUpdated += (long long)w * h;
+
+  glBindTexture(GL_TEXTURE_2D_ARRAY, heightTexture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, w);
+  const int tx = wrap(x0, N), tz = wrap(z0, N);
+  const int wFirst = std::min(w, N - tx), hFirst = std::min(h, N - tz);
+  const int xs[2][3] = {{0, tx, wFirst}, {wFirst, 0, w - wFirst}};
+  const int zs[2][3] = {{0, tz, hFirst}, {hFirst, 0, h - hFirst}};
+  for (const auto& zp : zs) {
+    if (zp[2] <= 0) continue;
+    for (const auto& xp : xs) {
+      if (xp[2] <= 0) continue;
+      glPixelStorei(GL_UNPACK_SKIP_PIXELS, xp[0]);
+      glPixelStorei(GL_UNPACK_SKIP_ROWS, zp[0]);
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, xp[1], zp[1], level, xp[2],
+                      zp[2], 1, GL_RED, GL_FLOAT, staging.data());
+    }
+  }
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+  glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "heightmap_generator.hpp"
+#include "opengl.hpp"
+
+// Geometry clipmap (Losasso & Hoppe 2004) over a HeightmapGenerator's noise
+// function, for flying over terrain far larger than the generated map.
+//
+// LEVELS nested square grids of N x N samples are centred on the camera;
+// level l samples every 2^l cells. Each level keeps its heights in one
+// layer of an R32F texture array, addressed toroidally (sample s lives in
+// texel s mod N), so when the camera moves only the newly exposed L-shaped
+// strips of rows and columns are evaluated and uploaded. Memory and the
+// per-frame cost therefore depend on N and the camera speed, not on the
+// size of the world.
+//
+// Level 0 is drawn as a full grid and every coarser level as a grid with a
+// hole where the finer level sits. Level origins are kept even, so a finer
+// level's vertices land on every other coarser vertex and the hole is one
+// of four index buffers. clipmap_vert.glsl blends each level's outer band
+// towards the next level's surface, reaching it exactly on the border, so
+// the rings meet without cracks.
+//
+// Heights come from HeightmapGenerator::sampleRow(), so erosion, which only
+// exists on the finite map, is not shown.
+//
+// Like cgra::gl_mesh, GL objects are released by destroy(), not by the
+// destructor, as the context may already be gone by then.
+class ClipmapTerrain {
+ public:
+  static constexpr int N = 129;  // samples per level side, 2^k + 1
+  static constexpr int LEVELS = 8;
+  // width of the band, in samples, blended towards the coarser level
+  static constexpr int TRANSITION = N / 10;
+
+  explicit ClipmapTerrain(glm::vec3 offset = {-10, 0, -10},
+                          float scaleX = 0.02f, float scaleZ = 0.02f)
+      : offset(offset), scaleX(scaleX), scaleZ(scaleZ) {}
+
+  ClipmapTerrain(const ClipmapTerrain&) = delete;
+  ClipmapTerrain& operator=(const ClipmapTerrain&) = delete;
+
+  // The generator whose noise function is shown; it must outlive the
+  // clipmap
+  void setSource(const HeightmapGenerator* generator) { source = generator; }
+
+  // Re-evaluates every level at the next draw, e.g. after the source's
+  // parameters changed
+  void invalidate() { levelsValid = false; }
+
+  // Moves the terrain under the camera: terrain-space point p is drawn at
+  // p - (offset.x, 0, offset.y)
+  void setFlyOffset(glm::vec2 fly) { flyOffset = fly; }
+  glm::vec2 getFlyOffset() const { return flyOffset; }
+
+  // Re-centres the levels on the camera, uploads the exposed strips and
+  // draws with `shader`, which must be built from clipmap_vert.glsl
+  void draw(GLuint shader, const glm::mat4& view, const glm::mat4& model);
+
+  // Deletes every GL object
+  void destroy();
+
+  // Statistics for the last draw()
+  long long getSamplesUpdated() const { return samplesUpdated; }
+  double getLastUpdateMs() const { return lastUpdateMs; }
+  size_t getTextureBytes() const {
+    return size_t(N) * N * LEVELS * sizeof(float);
+  }
+
+ private:
+  static constexpr int HALF = (N - 1) / 2;
+
+  struct Level {
+    glm::ivec2 origin{0};  // first sample of the window, in level samples
+  };
+
+  glm::vec3 offset;
+  float scaleX, scaleZ;
+  glm::vec2 flyOffset{0.0f};
+  const HeightmapGenerator* source = nullptr;
+
+  Level levels[LEVELS];
+  bool levelsValid = false;
+
+  GLuint vao = 0;
+  GLuint heightTexture = 0;  // GL_TEXTURE_2D_ARRAY, one layer per level
+  GLuint fullGrid = 0;
+  GLuint holeGrids[2][2] = {{0, 0}, {0, 0}};  // by hole offset - HALF / 2
+  int fullCount = 0, holeCount = 0;
+
+  std::vector<float> staging;
+  long long samplesUpdated = 0;
+  double lastUpdateMs = 0.0;
+
+  void create();
+  GLuint buildIndices(int holeX, int holeZ, int& count) const;
+  void updateLevels(const glm::vec3& camera);
+  void fillRect(int level, int x0, int z0, int w, int h);
+};
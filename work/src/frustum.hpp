@@ -0,0 +1,48 @@
+#pragma once
+#include <glm/glm.hpp>
+
+// Axis-aligned bounding box in world space
+struct Aabb {
+  glm::vec3 min{0.0f};
+  glm::vec3 max{0.0f};
+};
+
+// The six clip planes of a view-projection matrix, for CPU culling.
+class Frustum {
+ public:
+  // Extracts the planes from the rows of viewProj (Gribb & Hartmann); each
+  // plane's normal points into the frustum
+  explicit Frustum(const glm::mat4& viewProj) {
+    auto row = [&](int i) {
+      return glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i],
+                       viewProj[3][i]);
+    };
+    for (int i = 0; i < 3; ++i) {
+      planes[2 * i] = row(3) + row(i);
+      planes[2 * i + 1] = row(3) - row(i);
+    }
+  }
+
+  // False only if box is entirely outside one of the planes. Boxes near a
+  // frustum corner may pass without being visible, which is safe for
+  // culling.
+  bool intersects(const Aabb& box) const {
+    for (const glm::vec4& p : planes) {
+      // the box corner furthest along the plane normal
+      const glm::vec3 corner(p.x >= 0.0f ? box.max.x : box.min.x,
+                             p.y >= 0.0f ? box.max.y : box.min.y,
+                             p.z >= 0.0f ? box.max.z : box.min.z);
+      if (glm::dot(glm::vec3(p), corner) + p.w < 0.0f) return false;
+    }
+    return true;
+  }
+
+  bool contains(const glm::vec3& point) const {
+    for (const glm::vec4& p : planes)
+      if (glm::dot(glm::vec3(p), point) + p.w < 0.0f) return false;
+    return true;
+  }
+
+ private:
+  glm::vec4 planes[6];
+};
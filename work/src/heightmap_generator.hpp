@@ -1,10 +1,18 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <glm/glm.hpp>
+#include <limits>
 #include <iostream>
 #include <utility>
 #include <vector>
 
+#include "parallel.hpp"
 #include "perlin.hpp"
+#include "hydraulic_erosion.hpp"
+#include "pipe_erosion.hpp"
+#include "thermal_erosion.hpp"
 
 class HeightmapGenerator {
  public:
@@ -22,11 +30,13 @@ class HeightmapGenerator {
                   DefaultParams::LACUNARITY);
 
     heights.resize(width * depth, 0.0f);
-    slopes.resize(width * depth, 0.0f);
+    gradX.resize(width * depth, 0.0f);
+    gradZ.resize(width * depth, 0.0f);
   }
 
-  // Set parameters
+  // Set parameters (abandons a preview in progress)
   void setParameters(int oct, float freq, float amp, float g, float lac) {
+    previewLevel = 0;
     octaves = oct;
     frequency = freq;
     amplitude = amp;
@@ -34,41 +44,281 @@ class HeightmapGenerator {
     lacunarity = lac;
   }
 
-  // Regenerate base heightmap + persistent layers
+  // Worker threads used by regenerate/computeGradients/computeMinMax.
+  // 0 (the default) uses every core; 1 runs the original serial path.
+  void setThreadCount(int threads) { threadCount = std::max(0, threads); }
+  int getThreadCount() const { return threadCount; }
+
+  // Lets another thread follow and cancel regenerate() and the erosion
+  // stages while they run on this generator (nullptr to detach). A
+  // cancelled call returns early and leaves the heights incomplete.
+  void setProgress(parallel::Progress* observer) { progress = observer; }
+
+  // Fused evaluation computes base + layers and their gradients for a block
+  // of rows in a single sweep while the rows are cache resident (on by
+  // default). The multi-pass path is kept for comparison; both give
+  // identical results.
+  void setFusedEvaluation(bool fused) { fusedEvaluation = fused; }
+  bool getFusedEvaluation() const { return fusedEvaluation; }
+
+  // Layer caching keeps the unit-amplitude base fBm and each extra layer's
+  // noise field, so regenerate() only re-evaluates the parts whose shape
+  // parameters changed and amplitude edits just recombine the cached
+  // fields. Each field keeps its value and gradient, three floats per cell
+  // for the base and for every layer. On by default; turning it off
+  // releases the caches.
+  void setLayerCaching(bool enabled) {
+    previewLevel = 0;
+    layerCaching = enabled;
+    if (!enabled) {
+      baseCache = Field();
+      baseCacheValid = false;
+      for (auto& cache : layerCaches) cache = LayerCache();
+      releaseOctaveCache();
+    }
+  }
+  bool getLayerCaching() const { return layerCaching; }
+
+  // Octave caching (on top of layer caching) also keeps every octave of the
+  // base fBm. For a fixed frequency and lacunarity the octaves do not depend
+  // on gain, so gain edits become a weighted sum of the cached octaves and
+  // adding octaves only evaluates the new ones. The stack needs three floats
+  // (value and gradient) per cell per octave; when that exceeds the budget
+  // the stack is dropped and the base fBm is evaluated in full as before.
+  // Background jobs take the caches over rather than copying them (see
+  // takeCaches), so the budget bounds what is actually held.
+  static constexpr size_t DEFAULT_OCTAVE_CACHE_BUDGET = size_t(256) << 20;
+
+  void setOctaveCaching(bool enabled, size_t budgetBytes =
+                                          DEFAULT_OCTAVE_CACHE_BUDGET) {
+    octaveCaching = enabled;
+    octaveCacheBudget = budgetBytes;
+    if (!enabled) releaseOctaveCache();
+  }
+  bool getOctaveCaching() const { return octaveCaching; }
+
+  // Whether the current octave count fits in the octave cache budget
+  bool octaveCacheFits() const {
+    return size_t(octaves) * width * depth * Field::FLOATS * sizeof(float) <=
+           octaveCacheBudget;
+  }
+
+  // Bytes currently held by the base/layer/octave caches
+  size_t cacheBytes() const {
+    size_t bytes = baseCache.bytes();
+    for (const auto& cache : layerCaches) bytes += cache.noise.bytes();
+    for (const auto& octave : octaveCache) bytes += octave.bytes();
+    return bytes;
+  }
+
+  // The base/layer/octave caches on their own. takeCaches() moves them out
+  // and leaves this generator with empty, invalid caches; restoreCaches()
+  // moves them into a generator with the same layers. TerrainJob uses this
+  // to hand the caches to its back buffer instead of holding them twice.
+  struct Caches;
+  Caches takeCaches();
+  void restoreCaches(Caches&& caches);
+
+  // True when regenerate() has to re-evaluate the base fBm / a layer
+  bool isBaseDirty() const {
+    return !baseCacheValid || !(baseCacheKey == currentBaseKey());
+  }
+  bool isLayerDirty(size_t index) const {
+    return index < layerCaches.size() &&
+           (!layerCaches[index].valid ||
+            layerCaches[index].frequency != extraNoiseLayers[index].first);
+  }
+
+  // Regenerate base heightmap + persistent layers, with the analytic
+  // gradient of every sample (see getGradient).
+  // Rows are split into tiles that run in parallel and each row goes through
+  // the perlin batch kernels, which match perlin::fbm2d/noise bit for bit, so
+  // the result is identical whatever the thread count.
   void regenerate() {
-    // base layer
-    for (int z = 0; z < depth; ++z) {
-      for (int x = 0; x < width; ++x) {
-        float nx = x * frequency;
-        float nz = z * frequency;
-        float h = perlin::fbm2d(nx, nz, octaves, lacunarity, gain) * amplitude;
-        heights[z * width + x] = h;
-      }
+    previewLevel = 0;
+    // the multi-pass path below sweeps the rows once per layer as well
+    const bool multiPass = !layerCaching && !fusedEvaluation;
+    if (progress)
+      progress->begin(multiPass ? depth * (1 + extraNoiseLayers.size())
+                                : depth);
+    if (layerCaching) {
+      regenerateCached();
+      return;
+    }
+    if (fusedEvaluation) {
+      evaluateFused([&](int z, float* row, float* rowDx, float* rowDz,
+                        float* scratch) {
+        evaluateRow(z, row, rowDx, rowDz, scratch);
+      });
+      return;
     }
 
-    // apply all extra persistent layers
+    // base layer
+    parallel::forTiles(0, depth, ROW_TILE, threadCount, [&](int z0, int z1) {
+      if (cancelled()) return;
+      for (int z = z0; z < z1; ++z) {
+        const size_t at = size_t(z) * width;
+        float* row = &heights[at];
+        float* rowDx = &gradX[at];
+        float* rowDz = &gradZ[at];
+        perlin::fbm2d_grad_row(0.0f, frequency, z * frequency, width, row,
+                               rowDx, rowDz, octaves, lacunarity, gain);
+        setScaled(width, amplitude, frequency, row, rowDx, rowDz, row, rowDx,
+                  rowDz);
+      }
+      if (progress) progress->advance(z1 - z0);
+    });
+
+    // apply all extra persistent layers, one pass each. Workers take row
+    // tiles in turn and keep one field buffer for all of them.
+    const int tiles = (depth + ROW_TILE - 1) / ROW_TILE;
+    const int workers = std::min(parallel::resolveThreads(threadCount), tiles);
+    std::vector<std::vector<float>> fields(workers);
     for (const auto& layer : extraNoiseLayers) {
       float layerFreq = layer.first;
       float layerAmp = layer.second;
-      for (int z = 0; z < depth; ++z) {
-        for (int x = 0; x < width; ++x) {
-          float nx = x * layerFreq;
-          float nz = z * layerFreq;
-          float h = perlin::noise(nx, nz) * layerAmp;
-          heights[z * width + x] += h;
+      std::atomic<int> nextTile{0};
+      parallel::forTiles(0, workers, 1, workers, [&](int w0, int w1) {
+        for (int w = w0; w < w1; ++w) {
+          std::vector<float>& field = fields[w];
+          field.resize(size_t(width) * 3);
+          float* fieldDx = &field[width];
+          float* fieldDz = &field[2 * width];
+          for (int t = nextTile++; t < tiles; t = nextTile++) {
+            if (cancelled()) return;
+            const int z0 = t * ROW_TILE, z1 = std::min(depth, z0 + ROW_TILE);
+            for (int z = z0; z < z1; ++z) {
+              const size_t at = size_t(z) * width;
+              perlin::noise_grad_row(0.0f, layerFreq, z * layerFreq, width,
+                                     field.data(), fieldDx, fieldDz);
+              addScaled(width, layerAmp, layerFreq, field.data(), fieldDx,
+                        fieldDz, &heights[at], &gradX[at], &gradZ[at]);
+            }
+            if (progress) progress->advance(z1 - z0);
+          }
         }
+      });
+    }
+  }
+
+  // Progressive preview for interactive parameter edits. beginPreview()
+  // evaluates the current parameters straight away on a coarse lattice of
+  // every PREVIEW_STRIDE-th sample (plus the last row and column), and
+  // refinePreview() then fills in the 1/4, 1/2 and full resolution
+  // lattices, evaluating only the samples the coarser lattices lack. All
+  // samples go through the same cached fields and arithmetic as
+  // regenerate(), so the finished heights, gradients and caches are
+  // identical to a regenerate() with the same parameters. Until then only
+  // the lattice samples are current. Any other edit abandons the preview.
+  static constexpr int PREVIEW_STRIDE = 8;
+
+  void beginPreview() {
+    previewBaseDirty = isBaseDirty();
+    previewLayerDirty.assign(extraNoiseLayers.size(), 0);
+    for (size_t i = 0; i < extraNoiseLayers.size(); ++i)
+      previewLayerDirty[i] = isLayerDirty(i);
+
+    // fields are stored as they fill in, so stale caches must not look
+    // valid if the parameters go back to what they were
+    if (layerCaching) {
+      const size_t cells = size_t(width) * depth;
+      if (previewBaseDirty) {
+        baseCache.resize(cells);
+        baseCacheValid = false;
+      }
+      for (size_t i = 0; i < layerCaches.size(); ++i) {
+        if (!previewLayerDirty[i]) continue;
+        layerCaches[i].noise.resize(cells);
+        layerCaches[i].valid = false;
       }
     }
+    // the complete octave stack is faster than re-evaluating the fBm
+    previewOctaves = previewBaseDirty && layerCaching && octaveCaching &&
+                     octaveCacheCount >= octaves &&
+                     octaveCacheFrequency == frequency &&
+                     octaveCacheLacunarity == lacunarity;
+
+    previewLevel = PREVIEW_STRIDE;
+    previewRow = 0;
+    refinePreview(std::numeric_limits<double>::infinity());
+  }
 
-    computeSlopes();
+  // Evaluates preview rows for about budgetMs (at least one batch) and
+  // returns the stride of the finest complete lattice: PREVIEW_STRIDE down
+  // to 2, or 1 once the map is finished.
+  int refinePreview(double budgetMs) {
+    const auto start = std::chrono::steady_clock::now();
+    const int batch = ROW_TILE * parallel::resolveThreads(threadCount);
+    while (previewLevel > 0) {
+      const int s = previewLevel;
+      const int rows = latticeCount(depth, s);
+      const int end = std::min(rows, previewRow + batch);
+      parallel::forTiles(previewRow, end, ROW_TILE, threadCount,
+                         [&](int k0, int k1) {
+                           std::vector<float> scratch(size_t(width) * 9);
+                           for (int k = k0; k < k1; ++k)
+                             previewRowAt(latticeIndex(depth, s, k), s,
+                                          scratch.data());
+                         });
+      previewRow = end;
+
+      if (previewRow == rows) {
+        previewRow = 0;
+        previewLevel = s / 2;
+        if (s == 1 && layerCaching) markCachesValid();
+        return s;  // one level per call, so callers can show each one
+      }
+      const double elapsed = std::chrono::duration<double, std::milli>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+      if (elapsed >= budgetMs) break;
+    }
+    return getPreviewStride();
+  }
+
+  bool isPreviewing() const { return previewLevel > 0; }
+
+  // Runs a preview in progress to completion
+  void finishPreview() {
+    while (isPreviewing())
+      refinePreview(std::numeric_limits<double>::infinity());
+  }
+
+  // Stride of the finest lattice whose heights are current (1 when not
+  // previewing)
+  int getPreviewStride() const {
+    return previewLevel > 0 ? previewLevel * 2 : 1;
+  }
+
+  // Number of lattice samples along an axis of `size` at `stride`: the
+  // multiples of stride, plus the last index if it is not one of them
+  static int latticeCount(int size, int stride) {
+    return (size - 1) / stride + 1 + ((size - 1) % stride != 0 ? 1 : 0);
+  }
+  // Index of the k-th lattice sample along that axis
+  static int latticeIndex(int size, int stride, int k) {
+    return std::min(k * stride, size - 1);
   }
 
   std::pair<float, float> computeMinMax() const {
     if (heights.empty()) return {0.0f, 0.0f};
+
+    // per-tile extremes, reduced afterwards (min/max are order independent)
+    const int tiles = (depth + ROW_TILE - 1) / ROW_TILE;
+    std::vector<std::pair<float, float>> tileMinMax(
+        tiles, {heights[0], heights[0]});
+    parallel::forTiles(0, depth, ROW_TILE, threadCount, [&](int z0, int z1) {
+      auto& mm = tileMinMax[z0 / ROW_TILE];
+      for (int i = z0 * width; i < z1 * width; ++i) {
+        mm.first = std::min(mm.first, heights[i]);
+        mm.second = std::max(mm.second, heights[i]);
+      }
+    });
+
     float minH = heights[0], maxH = heights[0];
-    for (float h : heights) {
-      minH = std::min(minH, h);
-      maxH = std::max(maxH, h);
+    for (const auto& mm : tileMinMax) {
+      minH = std::min(minH, mm.first);
+      maxH = std::max(maxH, mm.second);
     }
     return {minH, maxH};
   }
@@ -79,98 +329,104 @@ class HeightmapGenerator {
     return heights[z * width + x];
   }
 
+  // Thermal erosion, see ThermalErosion. Runs on the generator's threads
+  // and reuses its scratch buffer between calls.
   void applyThermalErosionMultiNeighbor(int iterations = 6,
                                         float reposeAngleDeg = 30.0f,
                                         float talusFactor = 0.15f,
                                         float cellSizeX = 0.02f,
                                         float cellSizeZ = 0.02f) {
-    const float reposeRad =
-        glm::radians(glm::clamp(reposeAngleDeg, 0.0f, 89.0f));
-
-    talusFactor = glm::clamp(talusFactor, 0.0f, 1.0f);
-
-    for (int iter = 0; iter < iterations; ++iter) {
-      std::vector<float> deltaH(width * depth, 0.0f);
-
-      for (int z = 0; z < depth; ++z) {
-        for (int x = 0; x < width; ++x) {
-          const int idx = z * width + x;
-          const float hC = heights[idx];
-
-          float totalExcess = 0.0f;
-          float excessPerNeighbor[8];
-          int neighborXCord[8], neighborYCord[8];
-          int count = 0;
-
-          // loop all neighbors
-          for (int dz = -1; dz <= 1; ++dz) {
-            for (int dx = -1; dx <= 1; ++dx) {
-              if (dx == 0 && dz == 0) continue;
-              int nx = x + dx;
-              int nz = z + dz;
-              if (nx < 0 || nx >= width || nz < 0 || nz >= depth)
-                continue;  // skip outside map
-
-              float hN = heights[nz * width + nx];
-
-              // horizontal distance to neighbor (handles diagonal)
-              float horizDist = glm::distance(
-                  glm::vec2(0.0f), glm::vec2(dx * cellSizeX, dz * cellSizeZ));
-
-              // allowed vertical difference for this neighbor given repose
-              // angle
-              float allowedDiff = std::tan(reposeRad) * horizDist;
-
-              float diff = hC - hN;
-              // if center is steeper than allowed relative to neighbor, there's
-              // excess to move
-              if (diff > allowedDiff) {
-                float ex = diff - allowedDiff;
-                excessPerNeighbor[count] = ex;
-                neighborXCord[count] = nx;
-                neighborYCord[count] = nz;
-                totalExcess += ex;
-                ++count;
-              }
-            }
-          }
+    ThermalErosion::Params params;
+    params.iterations = iterations;
+    params.reposeAngleDeg = reposeAngleDeg;
+    params.talusFactor = talusFactor;
+    params.cellSizeX = cellSizeX;
+    params.cellSizeZ = cellSizeZ;
+
+    finishPreview();
+    thermalErosion.setThreadCount(threadCount);
+    thermalErosion.setProgress(progress);
+    thermalErosion.run(heights, width, depth, params);
+
+    // the noise's gradient no longer describes the eroded heights
+    computeGradients();
+  }
 
-          // nothing to do for this cell
-          if (count == 0 || totalExcess <= 0.0f) continue;
+  // Worklist variant of the above (see ThermalErosion::runSparse). Gives the
+  // same heights but only visits cells whose neighbourhood is still moving
+  // and stops early once the largest change is <= params.residual.
+  // Returns the number of iterations actually used.
+  int applyThermalErosionSparse(const ThermalErosion::Params& params) {
+    finishPreview();
+    thermalErosion.setThreadCount(threadCount);
+    thermalErosion.setProgress(progress);
+    int used = thermalErosion.runSparse(heights, width, depth, params);
+    computeGradients();
+    return used;
+  }
 
-          // only move a fraction of the total excess this iteration
-          float moveOut = totalExcess * talusFactor;
+  // Temporally blocked variant (see ThermalErosion::runBlocked): same
+  // heights as the dense version with far less memory traffic
+  void applyThermalErosionBlocked(const ThermalErosion::Params& params) {
+    finishPreview();
+    thermalErosion.setThreadCount(threadCount);
+    thermalErosion.setProgress(progress);
+    thermalErosion.runBlocked(heights, width, depth, params);
+    computeGradients();
+  }
 
-          // distribute moveOut proportionally to each neighbor's excess
-          for (int i = 0; i < count; ++i) {
-            float share = excessPerNeighbor[i] / totalExcess;
-            float transfer = moveOut * share;
-            deltaH[idx] -= transfer;  // center loses
-            deltaH[neighborYCord[i] * width + neighborXCord[i]] +=
-                transfer;  // neighbor gains
-          }
-        }
-      }
+  const ThermalErosion& getThermalErosion() const { return thermalErosion; }
 
-      // commit changes
-      for (size_t i = 0; i < heights.size(); ++i) heights[i] += deltaH[i];
-    }
+  // Droplet hydraulic erosion, see HydraulicErosion. Reproducible for a
+  // given seed and batch size on any number of threads.
+  void applyHydraulicErosion(const HydraulicErosion::Params& params) {
+    finishPreview();
+    hydraulicErosion.setThreadCount(threadCount);
+    hydraulicErosion.setProgress(progress);
+    hydraulicErosion.run(heights, width, depth, params);
+    computeGradients();
+  }
 
-    // update any slope caches for the rest of the system
-    computeSlopes();
+  // Advances the shallow-water (pipe model) simulation by `steps` steps.
+  // Water and sediment persist between calls, so this can be called a few
+  // steps per frame; resetPipeErosion() drains the map.
+  void stepPipeErosion(const PipeErosion::Params& params, int steps = 1) {
+    finishPreview();
+    pipeErosion.setThreadCount(threadCount);
+    pipeErosion.step(heights, width, depth, params, steps);
+    computeGradients();
   }
 
-  // Persistent layer management
+  void resetPipeErosion() { pipeErosion.reset(); }
+
+  const PipeErosion& getPipeErosion() const { return pipeErosion; }
+
+  // Persistent layer management. Caches follow their layer, so removing or
+  // rescaling a layer never re-evaluates the others.
   void addLayer(float freq, float amp) {
+    previewLevel = 0;
     extraNoiseLayers.emplace_back(freq, amp);
+    layerCaches.emplace_back();
+  }
+
+  void setLayer(size_t index, float freq, float amp) {
+    previewLevel = 0;
+    if (index < extraNoiseLayers.size()) extraNoiseLayers[index] = {freq, amp};
   }
 
   void removeLayer(size_t index) {
-    if (index < extraNoiseLayers.size())
+    previewLevel = 0;
+    if (index < extraNoiseLayers.size()) {
       extraNoiseLayers.erase(extraNoiseLayers.begin() + index);
+      layerCaches.erase(layerCaches.begin() + index);
+    }
   }
 
-  void clearLayers() { extraNoiseLayers.clear(); }
+  void clearLayers() {
+    previewLevel = 0;
+    extraNoiseLayers.clear();
+    layerCaches.clear();
+  }
 
   // Query
   float getHeight(int x, int z) const {
@@ -178,41 +434,491 @@ class HeightmapGenerator {
     return heights[z * width + x];
   }
 
-  float getSlope(int x, int z) const {
-    if (x < 0 || x >= width || z < 0 || z >= depth) return 0.0f;
-    return slopes[z * width + x];
+  // Height change per cell along x and z. Analytic for generated heights;
+  // central differences once erosion has changed them.
+  glm::vec2 getGradient(int x, int z) const {
+    if (x < 0 || x >= width || z < 0 || z >= depth) return glm::vec2(0.0f);
+    return {gradX[z * width + x], gradZ[z * width + x]};
+  }
+
+  float getSlope(int x, int z) const { return glm::length(getGradient(x, z)); }
+
+  // Height and gradient at a fractional cell position, interpolated
+  // bilinearly between the four surrounding samples. Positions off the map
+  // are clamped to its edge.
+  float getHeightBilinear(float x, float z) const {
+    return bilinear(heights, x, z);
+  }
+  glm::vec2 getGradientBilinear(float x, float z) const {
+    return {bilinear(gradX, x, z), bilinear(gradZ, x, z)};
+  }
+
+  // Unit surface normal for cells scaleX x scaleZ world units in size
+  glm::vec3 getNormal(int x, int z, float scaleX, float scaleZ) const {
+    const glm::vec2 g = getGradient(x, z);
+    return glm::normalize(glm::vec3(-g.x / scaleX, 1.0f, -g.y / scaleZ));
+  }
+
+  // The generator's noise function (base fBm plus extra layers, without
+  // erosion) at cells first + i * stride of row z, for i in [0, count).
+  // The cells need not lie on the map, so this extends the terrain without
+  // bounds; on the map the samples are bit-identical to regenerate()'s.
+  void sampleRow(int first, int stride, int z, int count, float* out) const {
+    perlin::fbm2d_row_strided(0.0f, frequency, first, stride, z * frequency,
+                              count, out, octaves, lacunarity, gain);
+    for (int i = 0; i < count; ++i) out[i] *= amplitude;
+    for (const auto& layer : extraNoiseLayers)
+      perlin::noise_row_add_strided(0.0f, layer.first, first, stride,
+                                    z * layer.first, count, layer.second, out);
   }
 
   int getWidth() const { return width; }
   int getDepth() const { return depth; }
 
   const std::vector<float>& getHeights() const { return heights; }
-  std::vector<std::pair<float, float>>& getLayers() { return extraNoiseLayers; }
+  const std::vector<float>& getGradientX() const { return gradX; }
+  const std::vector<float>& getGradientZ() const { return gradZ; }
+  const std::vector<std::pair<float, float>>& getLayers() const {
+    return extraNoiseLayers;
+  }
 
  private:
+  // rows per work item handed to a thread
+  static constexpr int ROW_TILE = 16;
+
   int width, depth;
   int octaves;
   float frequency, amplitude, gain, lacunarity;
+  int threadCount = 0;
+  parallel::Progress* progress = nullptr;
+
+  // progressive preview state: the stride being filled in (0 = none), the
+  // next lattice row and which fields the new parameters invalidated
+  int previewLevel = 0;
+  int previewRow = 0;
+  bool previewBaseDirty = false;
+  bool previewOctaves = false;
+  std::vector<char> previewLayerDirty;
+  bool fusedEvaluation = true;
+  bool layerCaching = true;
+  bool octaveCaching = true;
+  size_t octaveCacheBudget = DEFAULT_OCTAVE_CACHE_BUDGET;
 
   std::vector<float> heights;
-  std::vector<float> slopes;
+  std::vector<float> gradX, gradZ;  // see getGradient
+
+  float bilinear(const std::vector<float>& values, float x, float z) const {
+    if (values.empty()) return 0.0f;
+    x = glm::clamp(x, 0.0f, float(width - 1));
+    z = glm::clamp(z, 0.0f, float(depth - 1));
+    // the cell's top-left sample, one short of the last row and column so
+    // the right and bottom neighbours exist
+    const int x0 = std::min(int(x), std::max(0, width - 2));
+    const int z0 = std::min(int(z), std::max(0, depth - 2));
+    const int x1 = std::min(x0 + 1, width - 1);
+    const int z1 = std::min(z0 + 1, depth - 1);
+    const float fx = x - x0, fz = z - z0;
+    const float* r0 = &values[size_t(z0) * width];
+    const float* r1 = &values[size_t(z1) * width];
+    const float top = r0[x0] + (r0[x1] - r0[x0]) * fx;
+    const float bottom = r1[x0] + (r1[x1] - r1[x0]) * fx;
+    return top + (bottom - top) * fz;
+  }
+
+  ThermalErosion thermalErosion;
+  HydraulicErosion hydraulicErosion;
+  PipeErosion pipeErosion;
 
   // persistent layers (frequency, amplitude)
   std::vector<std::pair<float, float>> extraNoiseLayers;
 
-  void computeSlopes() {
-    for (int z = 0; z < depth; ++z) {
-      for (int x = 0; x < width; ++x) {
-        float hL = getHeight(x - 1, z);
-        float hR = getHeight(x + 1, z);
-        float hD = getHeight(x, z - 1);
-        float hU = getHeight(x, z + 1);
+  // parameters that change the shape of the base fBm (amplitude does not)
+  struct BaseKey {
+    int octaves;
+    float frequency, gain, lacunarity;
+    bool operator==(const BaseKey& o) const {
+      return octaves == o.octaves && frequency == o.frequency &&
+             gain == o.gain && lacunarity == o.lacunarity;
+    }
+  };
+  BaseKey currentBaseKey() const {
+    return {octaves, frequency, gain, lacunarity};
+  }
+
+  // A noise field and its gradient (in the field's own coordinates), one
+  // float each per cell
+  struct Field {
+    static constexpr int FLOATS = 3;
+    std::vector<float> value, dx, dz;
+
+    void resize(size_t cells) {
+      value.resize(cells);
+      dx.resize(cells);
+      dz.resize(cells);
+    }
+    size_t bytes() const {
+      return (value.capacity() + dx.capacity() + dz.capacity()) *
+             sizeof(float);
+    }
+  };
+
+  // unit-amplitude base fBm and the parameters it was evaluated with
+  Field baseCache;
+  BaseKey baseCacheKey{};
+  bool baseCacheValid = false;
+
+  // unit-amplitude noise of one extra layer, parallel to extraNoiseLayers
+  struct LayerCache {
+    Field noise;
+    float frequency = 0.0f;
+    bool valid = false;
+  };
+  std::vector<LayerCache> layerCaches;
+
+  // unit octaves of the base fBm; the first octaveCacheCount are valid for
+  // octaveCacheFrequency/octaveCacheLacunarity. Their gradients are taken at
+  // the octave's own argument, like perlin::fbm2d_octave_grad_row's.
+  std::vector<Field> octaveCache;
+  int octaveCacheCount = 0;
+  float octaveCacheFrequency = 0.0f, octaveCacheLacunarity = 0.0f;
+
+  void releaseOctaveCache() {
+    std::vector<Field>().swap(octaveCache);
+    octaveCacheCount = 0;
+  }
+
+  // row = field * amp for n samples, and the field's gradient scaled to
+  // height per cell: the field is sampled at cell * freq, so its gradient
+  // is scaled by amp * freq. out may alias the field.
+  static void setScaled(int n, float amp, float freq, const float* value,
+                        const float* dx, const float* dz, float* row,
+                        float* rowDx, float* rowDz) {
+    const float gradScale = amp * freq;
+    for (int i = 0; i < n; ++i) {
+      row[i] = value[i] * amp;
+      rowDx[i] = dx[i] * gradScale;
+      rowDz[i] = dz[i] * gradScale;
+    }
+  }
+
+  // row += field * amp, likewise
+  static void addScaled(int n, float amp, float freq, const float* value,
+                        const float* dx, const float* dz, float* row,
+                        float* rowDx, float* rowDz) {
+    const float gradScale = amp * freq;
+    for (int i = 0; i < n; ++i) {
+      row[i] += value[i] * amp;
+      rowDx[i] += dx[i] * gradScale;
+      rowDz[i] += dz[i] * gradScale;
+    }
+  }
+
+  // base fBm + every extra layer for one row, in the multi-pass order.
+  // scratch holds three rows.
+  void evaluateRow(int z, float* row, float* rowDx, float* rowDz,
+                   float* scratch) const {
+    perlin::fbm2d_grad_row(0.0f, frequency, z * frequency, width, row, rowDx,
+                           rowDz, octaves, lacunarity, gain);
+    setScaled(width, amplitude, frequency, row, rowDx, rowDz, row, rowDx,
+              rowDz);
+    float* fieldDx = scratch + width;
+    float* fieldDz = scratch + 2 * width;
+    for (const auto& layer : extraNoiseLayers) {
+      perlin::noise_grad_row(0.0f, layer.first, z * layer.first, width,
+                             scratch, fieldDx, fieldDz);
+      addScaled(width, layer.second, layer.first, scratch, fieldDx, fieldDz,
+                row, rowDx, rowDz);
+    }
+  }
+
+  // Re-evaluates only the dirty cached fields and recombines them with the
+  // current amplitudes, in the same fused sweep as the uncached path and
+  // with the same arithmetic, so the heights are identical to it.
+  void regenerateCached() {
+    const size_t cells = size_t(width) * depth;
+    const bool baseDirty = isBaseDirty();
+    std::vector<char> layerDirty(extraNoiseLayers.size());
+    for (size_t i = 0; i < extraNoiseLayers.size(); ++i) {
+      layerDirty[i] = isLayerDirty(i);
+      if (layerDirty[i]) layerCaches[i].noise.resize(cells);
+    }
+    if (baseDirty) baseCache.resize(cells);
+
+    // octave stack for the base, if it is enabled and fits the budget
+    const bool useOctaves = baseDirty && octaveCaching && octaveCacheFits();
+    int firstNewOctave = 0;
+    if (useOctaves) {
+      if (octaveCacheFrequency != frequency ||
+          octaveCacheLacunarity != lacunarity)
+        octaveCacheCount = 0;
+      firstNewOctave = std::min(octaveCacheCount, octaves);
+      if (int(octaveCache.size()) < octaves) octaveCache.resize(octaves);
+      for (int i = firstNewOctave; i < octaves; ++i)
+        octaveCache[i].resize(cells);
+    } else if (baseDirty && !octaveCacheFits()) {
+      releaseOctaveCache();
+    }
+
+    evaluateFused([&](int z, float* row, float* rowDx, float* rowDz,
+                      float*) {
+      const size_t at = size_t(z) * width;
+      float* base = &baseCache.value[at];
+      float* baseDx = &baseCache.dx[at];
+      float* baseDz = &baseCache.dz[at];
+      if (useOctaves) {
+        // same accumulation as perlin::fbm2d_grad_row, from cached octaves
+        float octaveFreq = 1.0f, octaveAmp = 1.0f;
+        std::fill(base, base + width, 0.0f);
+        std::fill(baseDx, baseDx + width, 0.0f);
+        std::fill(baseDz, baseDz + width, 0.0f);
+        for (int i = 0; i < octaves; ++i) {
+          float* octave = &octaveCache[i].value[at];
+          float* octaveDx = &octaveCache[i].dx[at];
+          float* octaveDz = &octaveCache[i].dz[at];
+          if (i >= firstNewOctave)
+            perlin::fbm2d_octave_grad_row(0.0f, frequency, z * frequency,
+                                          octaveFreq, width, octave,
+                                          octaveDx, octaveDz);
+          const float gradWeight = octaveAmp * octaveFreq;
+          for (int x = 0; x < width; ++x) {
+            base[x] += octave[x] * octaveAmp;
+            baseDx[x] += octaveDx[x] * gradWeight;
+            baseDz[x] += octaveDz[x] * gradWeight;
+          }
+          octaveAmp *= gain;
+          octaveFreq *= lacunarity;
+        }
+      } else if (baseDirty) {
+        perlin::fbm2d_grad_row(0.0f, frequency, z * frequency, width, base,
+                               baseDx, baseDz, octaves, lacunarity, gain);
+      }
+      setScaled(width, amplitude, frequency, base, baseDx, baseDz, row, rowDx,
+                rowDz);
+
+      for (size_t i = 0; i < extraNoiseLayers.size(); ++i) {
+        const float layerFreq = extraNoiseLayers[i].first;
+        const float layerAmp = extraNoiseLayers[i].second;
+        Field& cache = layerCaches[i].noise;
+        float* layer = &cache.value[at];
+        float* layerDx = &cache.dx[at];
+        float* layerDz = &cache.dz[at];
+        if (layerDirty[i])
+          perlin::noise_grad_row(0.0f, layerFreq, z * layerFreq, width, layer,
+                                 layerDx, layerDz);
+        addScaled(width, layerAmp, layerFreq, layer, layerDx, layerDz, row,
+                  rowDx, rowDz);
+      }
+    });
+    // a cancelled sweep left the caches half written
+    if (cancelled()) {
+      baseCacheValid = false;
+      for (auto& cache : layerCaches) cache.valid = false;
+      return;
+    }
 
-        float dx = (hR - hL) * 0.5f;
-        float dz = (hU - hD) * 0.5f;
+    markCachesValid();
+    if (useOctaves) {
+      octaveCacheCount = std::max(octaveCacheCount, octaves);
+      octaveCacheFrequency = frequency;
+      octaveCacheLacunarity = lacunarity;
+    }
+  }
 
-        slopes[z * width + x] = glm::length(glm::vec2(dx, dz));
+  // records that baseCache and layerCaches hold the current parameters
+  void markCachesValid() {
+    baseCacheKey = currentBaseKey();
+    baseCacheValid = true;
+    for (size_t i = 0; i < extraNoiseLayers.size(); ++i) {
+      layerCaches[i].frequency = extraNoiseLayers[i].first;
+      layerCaches[i].valid = true;
+    }
+  }
+
+  // Evaluates the samples of lattice row z that are new at stride s: the
+  // whole lattice row if z was not on the 2s lattice (or s is the coarsest
+  // stride), otherwise only its odd multiples of s
+  void previewRowAt(int z, int s, float* scratch) {
+    const bool onCoarser =
+        s < PREVIEW_STRIDE && (z % (2 * s) == 0 || z == depth - 1);
+    if (onCoarser) {
+      if (width - 1 >= s)
+        previewSamples(z, s, 2 * s, (width - 1 - s) / (2 * s) + 1, scratch);
+      return;
+    }
+    previewSamples(z, 0, s, (width - 1) / s + 1, scratch);
+    if ((width - 1) % s != 0) previewSamples(z, width - 1, 1, 1, scratch);
+  }
+
+  // heights and gradients at x = first + i * stride of row z, through the
+  // same cached fields and arithmetic as regenerateCached(). scratch holds
+  // nine rows.
+  void previewSamples(int z, int first, int stride, int count,
+                      float* scratch) {
+    float* base = scratch;
+    float* baseDx = scratch + width;
+    float* baseDz = scratch + 2 * width;
+    float* field = scratch + 3 * width;
+    float* fieldDx = scratch + 4 * width;
+    float* fieldDz = scratch + 5 * width;
+    float* value = scratch + 6 * width;
+    float* valueDx = scratch + 7 * width;
+    float* valueDz = scratch + 8 * width;
+    const size_t rowStart = size_t(z) * width;
+    auto at = [&](int i) { return rowStart + first + size_t(i) * stride; };
+    // copies between the packed scratch rows and a field's cells
+    auto gather = [&](const Field& from, float* v, float* dx, float* dz) {
+      for (int i = 0; i < count; ++i) {
+        v[i] = from.value[at(i)];
+        dx[i] = from.dx[at(i)];
+        dz[i] = from.dz[at(i)];
+      }
+    };
+    auto scatter = [&](const float* v, const float* dx, const float* dz,
+                       Field& to) {
+      for (int i = 0; i < count; ++i) {
+        to.value[at(i)] = v[i];
+        to.dx[at(i)] = dx[i];
+        to.dz[at(i)] = dz[i];
+      }
+    };
+
+    if (!previewBaseDirty) {
+      gather(baseCache, base, baseDx, baseDz);
+    } else if (previewOctaves) {
+      std::fill(base, base + count, 0.0f);
+      std::fill(baseDx, baseDx + count, 0.0f);
+      std::fill(baseDz, baseDz + count, 0.0f);
+      float octaveAmp = 1.0f, octaveFreq = 1.0f;
+      for (int o = 0; o < octaves; ++o) {
+        const Field& octave = octaveCache[o];
+        const float gradWeight = octaveAmp * octaveFreq;
+        for (int i = 0; i < count; ++i) {
+          base[i] += octave.value[at(i)] * octaveAmp;
+          baseDx[i] += octave.dx[at(i)] * gradWeight;
+          baseDz[i] += octave.dz[at(i)] * gradWeight;
+        }
+        octaveAmp *= gain;
+        octaveFreq *= lacunarity;
+      }
+    } else {
+      perlin::fbm2d_grad_row_strided(0.0f, frequency, first, stride,
+                                     z * frequency, count, base, baseDx,
+                                     baseDz, octaves, lacunarity, gain);
+    }
+    if (previewBaseDirty && layerCaching)
+      scatter(base, baseDx, baseDz, baseCache);
+    setScaled(count, amplitude, frequency, base, baseDx, baseDz, value,
+              valueDx, valueDz);
+
+    for (size_t l = 0; l < extraNoiseLayers.size(); ++l) {
+      const float layerFreq = extraNoiseLayers[l].first;
+      const float layerAmp = extraNoiseLayers[l].second;
+      if (previewLayerDirty[l]) {
+        perlin::noise_grad_row_strided(0.0f, layerFreq, first, stride,
+                                       z * layerFreq, count, field, fieldDx,
+                                       fieldDz);
+        if (layerCaching)
+          scatter(field, fieldDx, fieldDz, layerCaches[l].noise);
+      } else {
+        gather(layerCaches[l].noise, field, fieldDx, fieldDz);
       }
+      addScaled(count, layerAmp, layerFreq, field, fieldDx, fieldDz, value,
+                valueDx, valueDz);
+    }
+
+    for (int i = 0; i < count; ++i) {
+      heights[at(i)] = value[i];
+      gradX[at(i)] = valueDx[i];
+      gradZ[at(i)] = valueDz[i];
     }
   }
+
+  // Fills every row of heights and gradients with
+  // rowFn(z, row, rowDx, rowDz, scratch) in a single sweep, a block of rows
+  // per work item. The gradients are analytic, so no row needs its
+  // neighbours and there is no second pass. scratch holds three rows.
+  template <typename RowFn>
+  void evaluateFused(RowFn&& rowFn) {
+    const int threads = parallel::resolveThreads(threadCount);
+    const int block = glm::clamp(depth / (threads * 4), 8, 64);
+
+    parallel::forTiles(0, depth, block, threadCount, [&](int z0, int z1) {
+      if (cancelled()) return;
+      std::vector<float> scratch(size_t(width) * 3);
+      for (int z = z0; z < z1; ++z) {
+        const size_t at = size_t(z) * width;
+        rowFn(z, &heights[at], &gradX[at], &gradZ[at], scratch.data());
+      }
+      if (progress) progress->advance(z1 - z0);
+    });
+  }
+
+  bool cancelled() const { return progress && progress->isCancelled(); }
+
+  // Central-difference gradients, for heights erosion has changed so the
+  // noise's analytic gradient no longer describes them. One-sided on the
+  // border.
+  void computeGradients() {
+    parallel::forTiles(0, depth, ROW_TILE, threadCount, [&](int z0, int z1) {
+      for (int z = z0; z < z1; ++z) {
+        const int zd = std::max(z - 1, 0), zu = std::min(z + 1, depth - 1);
+        const float* row = &heights[size_t(z) * width];
+        const float* down = &heights[size_t(zd) * width];
+        const float* up = &heights[size_t(zu) * width];
+        float* rowDx = &gradX[size_t(z) * width];
+        float* rowDz = &gradZ[size_t(z) * width];
+
+        const float zStep = float(std::max(zu - zd, 1));
+        for (int x = 0; x < width; ++x) rowDz[x] = (up[x] - down[x]) / zStep;
+        if (width < 2) {
+          rowDx[0] = 0.0f;
+          continue;
+        }
+        rowDx[0] = row[1] - row[0];
+        for (int x = 1; x < width - 1; ++x)
+          rowDx[x] = (row[x + 1] - row[x - 1]) * 0.5f;
+        rowDx[width - 1] = row[width - 1] - row[width - 2];
+      }
+    });
+  }
 };
+
+struct HeightmapGenerator::Caches {
+  Field base;
+  BaseKey baseKey{};
+  bool baseValid = false;
+  std::vector<LayerCache> layers;
+  std::vector<Field> octaves;
+  int octaveCount = 0;
+  float octaveFrequency = 0.0f, octaveLacunarity = 0.0f;
+};
+
+inline HeightmapGenerator::Caches HeightmapGenerator::takeCaches() {
+  Caches caches;
+  caches.base = std::move(baseCache);
+  caches.baseKey = baseCacheKey;
+  caches.baseValid = baseCacheValid;
+  caches.layers = std::move(layerCaches);
+  caches.octaves = std::move(octaveCache);
+  caches.octaveCount = octaveCacheCount;
+  caches.octaveFrequency = octaveCacheFrequency;
+  caches.octaveLacunarity = octaveCacheLacunarity;
+
+  baseCache = Field();
+  baseCacheValid = false;
+  layerCaches.assign(extraNoiseLayers.size(), LayerCache());
+  releaseOctaveCache();
+  return caches;
+}
+
+inline void HeightmapGenerator::restoreCaches(Caches&& caches) {
+  baseCache = std::move(caches.base);
+  baseCacheKey = caches.baseKey;
+  baseCacheValid = caches.baseValid;
+  layerCaches = std::move(caches.layers);
+  layerCaches.resize(extraNoiseLayers.size());  // stays parallel to layers
+  octaveCache = std::move(caches.octaves);
+  octaveCacheCount = caches.octaveCount;
+  octaveCacheFrequency = caches.octaveFrequency;
+  octaveCacheLacunarity = caches.octaveLacunarity;
+}
@@ -0,0 +1,257 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "parallel.hpp"
+
+// Particle (droplet) hydraulic erosion over a row-major width x depth
+// heightmap, in cell units.
+//
+// Each droplet starts at a seeded random position, runs downhill with some
+// inertia, picks up sediment up to a capacity that grows with speed, water
+// and slope, erodes with a radial brush and deposits bilinearly when it
+// slows down or climbs, and evaporates as it goes.
+//
+// Droplets are simulated in batches. Every droplet in a batch reads the
+// heights as they were at the start of the batch, so droplets never wait on
+// each other; their erosion/deposition is recorded as edits and applied
+// after the batch. A brush erosion is one edit (centre, amount) that is
+// expanded when applied. Each worker takes a contiguous range of droplets
+// and buckets its edits by the row band of their centre; bands are applied
+// in three phases (band % 3) so bands applied together never touch the
+// same rows, and each band replays its edits in droplet order. The
+// summation order of every cell is therefore fixed and the result depends
+// only on the seed and the batch size, not on the thread count.
+class HydraulicErosion {
+ public:
+  struct Params {
+    int droplets = 200000;
+    int maxLifetime = 30;
+    int brushRadius = 3;
+    float inertia = 0.05f;
+    float sedimentCapacityFactor = 4.0f;
+    float minSedimentCapacity = 0.01f;
+    float erodeSpeed = 0.3f;
+    float depositSpeed = 0.3f;
+    float evaporateSpeed = 0.01f;
+    float gravity = 4.0f;
+    float initialWater = 1.0f;
+    float initialSpeed = 1.0f;
+    uint32_t seed = 1;
+    // droplets simulated against one snapshot of the heights
+    int batchSize = 8192;
+  };
+
+  void setThreadCount(int threads) { threadCount = std::max(0, threads); }
+
+  // Reports simulated droplets to `progress` and stops after the current
+  // batch if it is cancelled (nullptr to run unobserved)
+  void setProgress(parallel::Progress* observer) { progress = observer; }
+
+  void run(std::vector<float>& heights, int width, int depth,
+           const Params& params) {
+    if (width < 2 || depth < 2) return;
+    prepareBrush(params.brushRadius, width);
+
+    const int batchSize = std::max(1, params.batchSize);
+    const int threads = parallel::resolveThreads(threadCount);
+    const int bands = (depth + BAND_ROWS - 1) / BAND_ROWS;
+
+    if (progress) progress->begin(params.droplets);
+    for (int first = 0; first < params.droplets; first += batchSize) {
+      if (progress && progress->isCancelled()) break;
+      const int count = std::min(batchSize, params.droplets - first);
+      const int grain = (count + threads - 1) / threads;
+      const int chunks = (count + grain - 1) / grain;
+
+      if (int(edits.size()) < chunks) edits.resize(chunks);
+      for (int c = 0; c < chunks; ++c) {
+        edits[c].resize(bands);
+        for (auto& band : edits[c]) band.clear();
+      }
+
+      // simulate: heights are read-only here
+      parallel::forTiles(0, count, grain, threadCount, [&](int b, int e) {
+        auto& out = edits[b / grain];
+        for (int i = b; i < e; ++i)
+          simulate(heights.data(), width, depth, params, first + i, out);
+      });
+
+      // apply the edits of every band in droplet order, in three phases so
+      // a brush reaching into the neighbouring bands never races
+      for (int phase = 0; phase < 3; ++phase) {
+        const int phaseBands = (bands - phase + 2) / 3;
+        parallel::forTiles(0, phaseBands, 1, threadCount, [&](int b0, int b1) {
+          for (int i = b0; i < b1; ++i)
+            for (int c = 0; c < chunks; ++c)
+              apply(heights.data(), width, depth, edits[c][phase + 3 * i]);
+        });
+      }
+      if (progress) progress->advance(count);
+    }
+  }
+
+ private:
+  static constexpr int BAND_ROWS = 64;
+
+  // index >= 0: add delta to that cell; index < 0: erode `delta` with the
+  // brush centred on cell ~index
+  struct Edit {
+    int index;
+    float delta;
+  };
+  // [chunk][band] edit lists, reused between batches
+  std::vector<std::vector<std::vector<Edit>>> edits;
+
+  int threadCount = 0;
+  parallel::Progress* progress = nullptr;
+  int brushRadius = -1;
+  int brushWidth = -1;  // map width brushOffset was built for
+  std::vector<int> brushDX, brushDZ, brushOffset;
+  std::vector<float> brushWeight;
+
+  void prepareBrush(int radius, int width) {
+    // a brush may only reach into the neighbouring bands
+    radius = std::max(1, std::min(radius, BAND_ROWS));
+    if (radius == brushRadius && width == brushWidth) return;
+    brushRadius = radius;
+    brushWidth = width;
+    brushDX.clear();
+    brushDZ.clear();
+    brushOffset.clear();
+    brushWeight.clear();
+    float sum = 0.0f;
+    for (int dz = -radius; dz <= radius; ++dz) {
+      for (int dx = -radius; dx <= radius; ++dx) {
+        float w = float(radius) - std::sqrt(float(dx * dx + dz * dz));
+        if (w <= 0.0f) continue;
+        brushDX.push_back(dx);
+        brushDZ.push_back(dz);
+        brushOffset.push_back(dz * width + dx);
+        brushWeight.push_back(w);
+        sum += w;
+      }
+    }
+    for (float& w : brushWeight) w /= sum;
+  }
+
+  void apply(float* h, int width, int depth,
+             const std::vector<Edit>& list) const {
+    const int r = brushRadius;
+    for (const Edit& edit : list) {
+      if (edit.index >= 0) {
+        h[edit.index] += edit.delta;
+        continue;
+      }
+      const int centre = ~edit.index;
+      const int cx = centre % width, cz = centre / width;
+      if (cx >= r && cx < width - r && cz >= r && cz < depth - r) {
+        for (size_t b = 0; b < brushWeight.size(); ++b)
+          h[centre + brushOffset[b]] -= edit.delta * brushWeight[b];
+      } else {
+        for (size_t b = 0; b < brushWeight.size(); ++b) {
+          const int bx = cx + brushDX[b], bz = cz + brushDZ[b];
+          if (bx < 0 || bx >= width || bz < 0 || bz >= depth) continue;
+          h[bz * width + bx] -= edit.delta * brushWeight[b];
+        }
+      }
+    }
+  }
+
+  // splitmix64, so every droplet has its own reproducible stream
+  static uint64_t mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+  }
+  static float unit(uint64_t bits) { return float(bits >> 40) * (1.0f / 16777216.0f); }
+
+  // height and gradient at a position inside the map, bilinearly
+  static void sample(const float* h, int width, float x, float z,
+                     float& height, float& gradX, float& gradZ) {
+    const int nx = int(x), nz = int(z);
+    const float ox = x - nx, oz = z - nz;
+    const float* p = h + nz * width + nx;
+    const float hNW = p[0], hNE = p[1], hSW = p[width], hSE = p[width + 1];
+    gradX = (hNE - hNW) * (1 - oz) + (hSE - hSW) * oz;
+    gradZ = (hSW - hNW) * (1 - ox) + (hSE - hNE) * ox;
+    height = hNW * (1 - ox) * (1 - oz) + hNE * ox * (1 - oz) +
+             hSW * (1 - ox) * oz + hSE * ox * oz;
+  }
+
+  void simulate(const float* h, int width, int depth, const Params& p,
+                int droplet, std::vector<std::vector<Edit>>& out) const {
+    const uint64_t r = mix(uint64_t(p.seed) << 32 ^ uint32_t(droplet));
+    float x = unit(r) * (width - 1);
+    float z = unit(mix(r)) * (depth - 1);
+    float dirX = 0.0f, dirZ = 0.0f;
+    float speed = p.initialSpeed, water = p.initialWater, sediment = 0.0f;
+
+    // edits are bucketed by the band of the cell they are centred on
+    auto emit = [&](int cell, int index, float delta) {
+      out[cell / width / BAND_ROWS].push_back({index, delta});
+    };
+
+    for (int life = 0; life < p.maxLifetime; ++life) {
+      const int nx = int(x), nz = int(z);
+      const float ox = x - nx, oz = z - nz;
+
+      float height, gradX, gradZ;
+      sample(h, width, x, z, height, gradX, gradZ);
+
+      // steer downhill, keeping some momentum
+      dirX = dirX * p.inertia - gradX * (1 - p.inertia);
+      dirZ = dirZ * p.inertia - gradZ * (1 - p.inertia);
+      const float len = std::sqrt(dirX * dirX + dirZ * dirZ);
+      if (len <= 0.0f) break;
+      dirX /= len;
+      dirZ /= len;
+      x += dirX;
+      z += dirZ;
+      if (x < 0 || x >= width - 1 || z < 0 || z >= depth - 1) break;
+
+      float newHeight, unusedX, unusedZ;
+      sample(h, width, x, z, newHeight, unusedX, unusedZ);
+      const float deltaHeight = newHeight - height;
+
+      const float capacity =
+          std::max(-deltaHeight * speed * water * p.sedimentCapacityFactor,
+                   p.minSedimentCapacity);
+
+      const int node = nz * width + nx;
+      if (sediment > capacity || deltaHeight > 0) {
+        // fill the pit when climbing, otherwise drop part of the surplus
+        const float amount = deltaHeight > 0
+                                 ? std::min(deltaHeight, sediment)
+                                 : (sediment - capacity) * p.depositSpeed;
+        sediment -= amount;
+        emit(node, node, amount * (1 - ox) * (1 - oz));
+        emit(node, node + 1, amount * ox * (1 - oz));
+        emit(node, node + width, amount * (1 - ox) * oz);
+        emit(node, node + width + 1, amount * ox * oz);
+      } else {
+        // erode with the brush, never digging deeper than the drop
+        const float amount =
+            std::min((capacity - sediment) * p.erodeSpeed, -deltaHeight);
+        emit(node, ~node, amount);
+        const int r = brushRadius;
+        if (nx >= r && nx < width - r && nz >= r && nz < depth - r) {
+          sediment += amount;
+        } else {
+          // only what the clipped brush actually removes
+          for (size_t b = 0; b < brushWeight.size(); ++b) {
+            const int bx = nx + brushDX[b], bz = nz + brushDZ[b];
+            if (bx < 0 || bx >= width || bz < 0 || bz >= depth) continue;
+            sediment += amount * brushWeight[b];
+          }
+        }
+      }
+
+      speed = std::sqrt(std::max(0.0f, speed * speed - deltaHeight * p.gravity));
+      water *= (1 - p.evaporateSpeed);
+    }
+  }
+};
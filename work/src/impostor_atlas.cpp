@@ -0,0 +1,199 @@
+// std
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+// glm
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// project
+#include "impostor_atlas.hpp"
+
+using namespace std;
+using namespace glm;
+
+namespace {
+
+double msSince(chrono::steady_clock::time_point start) {
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start)
+      .count();
+}
+
+// Fills the transparent texels of each frame with the colour of an opaque
+// neighbour, `passes` texels deep, keeping their alpha at 0. Frames are
+// size x size blocks of an rgba atlas `width` texels wide.
+void bleedColors(vector<unsigned char>& rgba, int width, int size,
+                 int passes) {
+  vector<unsigned char> filled(rgba.size() / 4);
+  for (size_t i = 0; i < filled.size(); ++i) filled[i] = rgba[i * 4 + 3] > 0;
+  vector<unsigned char> next;
+  for (int pass = 0; pass < passes; ++pass) {
+    next = filled;
+    for (int y = 0; y < width; ++y) {
+      for (int x = 0; x < width; ++x) {
+        const size_t i = size_t(y) * width + x;
+        if (filled[i]) continue;
+        // neighbours in the same frame only
+        const int fx = x / size * size, fy = y / size * size;
+        int sum[3] = {0, 0, 0}, count = 0;
+        for (int dy = -1; dy <= 1; ++dy) {
+          for (int dx = -1; dx <= 1; ++dx) {
+            const int nx = x + dx, ny = y + dy;
+            if (nx < fx || ny < fy || nx >= fx + size || ny >= fy + size)
+              continue;
+            const size_t n = size_t(ny) * width + nx;
+            if (!filled[n]) continue;
+            for (int c = 0; c < 3; ++c) sum[c] += rgba[n * 4 + c];
+            ++count;
+          }
+        }
+        if (count == 0) continue;
+        for (int c = 0; c < 3; ++c) rgba[i * 4 + c] = sum[c] / count;
+        next[i] = 1;
+      }
+    }
+    filled.swap(next);
+  }
+}
+
+}  // namespace
+
+vec2 ImpostorAtlas::encode(vec3 dir) {
+  dir.y = glm::max(dir.y, 0.0f);
+  const vec2 p = vec2(dir.x, dir.z) / (abs(dir.x) + dir.y + abs(dir.z));
+  return vec2(p.x + p.y, p.x - p.y);
+}
+
+vec3 ImpostorAtlas::decode(vec2 p) {
+  const vec2 q = vec2(p.x + p.y, p.x - p.y) * 0.5f;
+  return normalize(vec3(q.x, 1.0f - abs(q.x) - abs(q.y), q.y));
+}
+
+vec3 ImpostorAtlas::frameDirection(int x, int z) {
+  return decode((vec2(x, z) + 0.5f) / float(FRAMES) * 2.0f - 1.0f);
+}
+
+void ImpostorAtlas::frameAxes(vec3 dir, vec3& right, vec3& up) {
+  right = normalize(cross(vec3(0.0f, 1.0f, 0.0f), dir));
+  up = cross(dir, right);
+}
+
+bool ImpostorAtlas::bake(const vector<Part>& parts, const Aabb& bounds,
+                         GLuint shader, int frameSize) {
+  const auto start = chrono::steady_clock::now();
+  destroy();
+  center = (bounds.min + bounds.max) * 0.5f;
+  radius = glm::max(length(bounds.max - bounds.min) * 0.5f, 1e-4f);
+  atlasSize = FRAMES * frameSize;
+
+  // state to restore
+  GLint previousFbo = 0, viewport[4], polygonMode[2];
+  GLfloat clearColor[4];
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFbo);
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  glGetIntegerv(GL_POLYGON_MODE, polygonMode);
+  glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+  const GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+
+  glGenTextures(1, &texture);
+  glActiveTexture(GL_TEXTURE5);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, atlasSize, atlasSize, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  GLuint fbo = 0, depth = 0;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         texture, 0);
+  glGenRenderbuffers(1, &depth);
+  glBindRenderbuffer(GL_RENDERBUFFER, depth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, atlasSize,
+                        atlasSize);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            GL_RENDERBUFFER, depth);
+  const bool complete =
+      glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+  if (complete) {
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_DEPTH_TEST);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glUseProgram(shader);
+    const mat4 proj = ortho(-radius, radius, -radius, radius, radius,
+                            3.0f * radius);
+    glUniformMatrix4fv(glGetUniformLocation(shader, "uProjectionMatrix"), 1,
+                       GL_FALSE, value_ptr(proj));
+    const GLint viewLocation = glGetUniformLocation(shader, "uModelViewMatrix");
+    const GLint colorLocation = glGetUniformLocation(shader, "uColor");
+    for (int z = 0; z < FRAMES; ++z) {
+      for (int x = 0; x < FRAMES; ++x) {
+        const vec3 dir = frameDirection(x, z);
+        vec3 right, up;
+        frameAxes(dir, right, up);
+        const mat4 view = lookAt(center + dir * (2.0f * radius), center, up);
+        glViewport(x * frameSize, z * frameSize, frameSize, frameSize);
+        glUniformMatrix4fv(viewLocation, 1, GL_FALSE, value_ptr(view));
+        for (const Part& part : parts) {
+          glUniform3fv(colorLocation, 1, value_ptr(part.color));
+          glBindVertexArray(part.mesh->vao);
+          glDrawElements(part.mesh->mode, part.mesh->index_count,
+                         GL_UNSIGNED_INT, nullptr);
+        }
+      }
+    }
+    glBindVertexArray(0);
+
+    // bleed colour into the empty texels, then build the mipmaps
+    vector<unsigned char> rgba(size_t(atlasSize) * atlasSize * 4);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, atlasSize, atlasSize, GL_RGBA, GL_UNSIGNED_BYTE,
+                 rgba.data());
+    size_t covered = 0;
+    for (size_t i = 3; i < rgba.size(); i += 4) covered += rgba[i] > 0;
+    coverage = float(covered) / float(size_t(atlasSize) * atlasSize);
+    bleedColors(rgba, atlasSize, frameSize, 8);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, atlasSize, atlasSize, GL_RGBA,
+                    GL_UNSIGNED_BYTE, rgba.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glGenerateMipmap(GL_TEXTURE_2D);
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, previousFbo);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+  glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+  glPolygonMode(GL_FRONT_AND_BACK, polygonMode[0]);
+  if (!depthTest) glDisable(GL_DEPTH_TEST);
+  glDeleteRenderbuffers(1, &depth);
+  glDeleteFramebuffers(1, &fbo);
+  glActiveTexture(GL_TEXTURE0);
+
+  if (!complete) {
+    cerr << "Error: Impostor framebuffer is incomplete" << endl;
+    destroy();
+    return false;
+  }
+  bakeMs = msSince(start);
+  return true;
+}
+
+void ImpostorAtlas::bindTexture(int unit) const {
+  glActiveTexture(GL_TEXTURE0 + unit);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void ImpostorAtlas::destroy() {
+  if (texture) glDeleteTextures(1, &texture);
+  texture = 0;
+  atlasSize = 0;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "cgra/cgra_mesh.hpp"
+#include "frustum.hpp"
+#include "opengl.hpp"
+
+// Octahedral impostor of a mesh: pictures of it from many directions,
+// baked into one texture atlas, so a distant copy can be drawn as a single
+// textured quad.
+//
+// The directions cover the upper hemisphere through a hemi-octahedral
+// mapping, which unfolds the hemisphere onto a square with little
+// distortion. The square is split into FRAMES x FRAMES frames, and each
+// frame holds an orthographic picture of the mesh's bounding sphere, seen
+// along the direction through that frame's centre. impostor_vert.glsl maps
+// the view direction of each instance back to the nearest frame and spans
+// its quad with that frame's camera axes, so the picture lines up with the
+// mesh it stands in for.
+//
+// bake() renders into an offscreen framebuffer and reads the atlas back to
+// bleed colour into the empty texels (so mipmaps have no dark fringes), so
+// it needs only a current OpenGL 3.3 context, not a window: it works on a
+// headless context under Mesa's llvmpipe. The previous framebuffer,
+// viewport and clear colour are restored.
+//
+// Like cgra::gl_mesh, GL objects are released by destroy(), not by the
+// destructor, as the context may already be gone by then.
+class ImpostorAtlas {
+ public:
+  // Frames per side; even, so no frame looks straight down, where the
+  // frame camera's up axis is undefined
+  static constexpr int FRAMES = 8;
+
+  ImpostorAtlas() = default;
+  ImpostorAtlas(const ImpostorAtlas&) = delete;
+  ImpostorAtlas& operator=(const ImpostorAtlas&) = delete;
+
+  // A mesh to draw into the impostor and its colour
+  struct Part {
+    const cgra::gl_mesh* mesh;
+    glm::vec3 color;
+  };
+
+  // Renders parts, which fit in bounds, from every frame direction into an
+  // atlas of FRAMES * frameSize texels a side with `shader`, which must be
+  // built from lod_vert.glsl and lod_frag.glsl. Returns false, leaving no
+  // atlas, if the framebuffer is not supported.
+  bool bake(const std::vector<Part>& parts, const Aabb& bounds, GLuint shader,
+            int frameSize = 128);
+
+  // Binds the atlas to texture unit `unit`
+  void bindTexture(int unit) const;
+
+  // Deletes every GL object
+  void destroy();
+
+  bool isBaked() const { return texture != 0; }
+  GLuint getTexture() const { return texture; }
+  int getAtlasSize() const { return atlasSize; }
+  // Bounding sphere the frames picture, in the parts' space
+  glm::vec3 getCenter() const { return center; }
+  float getRadius() const { return radius; }
+  // Statistics for the last bake(): its time and the share of frame texels
+  // the parts cover
+  double getBakeMs() const { return bakeMs; }
+  float getCoverage() const { return coverage; }
+
+  // Hemi-octahedral mapping between directions with y >= 0 and [-1, 1]^2,
+  // as in impostor_vert.glsl
+  static glm::vec2 encode(glm::vec3 dir);
+  static glm::vec3 decode(glm::vec2 p);
+  // Direction of frame (x, z), through its centre
+  static glm::vec3 frameDirection(int x, int z);
+  // The frame camera's right and up axes for a direction
+  static void frameAxes(glm::vec3 dir, glm::vec3& right, glm::vec3& up);
+
+ private:
+  GLuint texture = 0;
+  int atlasSize = 0;
+  glm::vec3 center{0.0f};
+  float radius = 1.0f;
+  double bakeMs = 0.0;
+  float coverage = 0.0f;
+};
@@ -4,6 +4,11 @@
 
 #include "level_of_detail.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <utility>
+
 #include <glm/glm.hpp>
 #include <GLFW/glfw3.h>
 
@@ -14,80 +19,350 @@ using namespace glm;
 
 namespace lod {
     /**
-     * Updates and draws all the models using the lod system
+     * Loads the tree LOD chain, finest level first. A level's error should
+     * grow with its simplification; they set the distances the levels take
+     * over at (see LodSelector).
+     */
+    std::vector<level_of_detail::lod_mesh> level_of_detail::load_lod_chain() {
+        struct lod_files {
+            const char* trunk;
+            const char* leaves;
+            float error;
+        };
+        const lod_files files[] = {
+            {"a.obj", "al.obj", 0.0f},
+            {"b.obj", "bl.obj", 0.015f},
+        };
+        std::vector<lod_mesh> chain;
+        for (const lod_files& f : files) {
+            const cgra::mesh_builder trunk = cgra::load_wavefront_data(CGRA_SRCDIR "/res/assets/" + std::string(f.trunk));
+            const cgra::mesh_builder leaves = cgra::load_wavefront_data(CGRA_SRCDIR "/res/assets/" + std::string(f.leaves));
+            Aabb bounds{vec3(std::numeric_limits<float>::max()), vec3(std::numeric_limits<float>::lowest())};
+            for (const cgra::mesh_builder* part : {&trunk, &leaves}) {
+                for (const cgra::mesh_vertex& v : part->vertices) {
+                    bounds.min = min(bounds.min, v.pos);
+                    bounds.max = max(bounds.max, v.pos);
+                }
+            }
+            chain.push_back({trunk.build(), leaves.build(), f.error, bounds});
+        }
+        return chain;
+    }
+
+    /**
+     * Number of LOD levels in use: the chain, and the impostor level if it is
+     * baked and enabled
+     */
+    int level_of_detail::level_total() const {
+        return static_cast<int>(lod_chain.size()) + (m_use_impostors && impostor.isBaked() ? 1 : 0);
+    }
+
+    /**
+     * Bakes the impostor atlas from the first level of the chain, with frames
+     * of frame_size texels a side. Needs shader (lod_vert/lod_frag) and a
+     * current context, which may be headless.
+     * @return false if the atlas could not be baked
+     */
+    bool level_of_detail::bake_impostor(int frame_size) {
+        if (lod_chain.empty() || shader == 0) return false;
+        const bool baked = impostor.bake({{&lod_chain[0].trunk, trunk_color}, {&lod_chain[0].leaves, leaves_color}},
+                                         lod_chain[0].bounds, shader, frame_size);
+
+        if (quad_vao == 0) {
+            const vec2 corners[] = {{-1, -1}, {1, -1}, {-1, 1}, {1, 1}};
+            glGenVertexArrays(1, &quad_vao);
+            glGenBuffers(1, &quad_vbo);
+            glBindVertexArray(quad_vao);
+            glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(vec2), nullptr);
+            glBindVertexArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+        return baked;
+    }
+
+    /**
+     * Updates and draws all the models using the lod system. Each tree's
+     * level is the coarsest whose geometric error projects to at most
+     * pixel_error pixels from the camera (or from the target with
+     * m_lod_from_target), with hysteresis against flicker. Grid cells outside
+     * the view frustum are culled, and only visible cells are reclassified.
+     * Trees are drawn instanced from an instance buffer that is only rebuilt
+     * when their levels change, each level's visible cells as a few
+     * contiguous instance ranges, one draw call per range and mesh part.
+     * Past the chain's last level, trees are impostor quads.
      * @param view
      * @param proj
+     * @param viewport_height in pixels
      */
-    void level_of_detail::update_lod(const mat4 &view, mat4 &proj) {
-        glUseProgram(shader);
-        glUniformMatrix4fv(glGetUniformLocation(shader, "uProjectionMatrix"), 1, false, value_ptr(proj));
+    void level_of_detail::update_lod(const mat4 &view, mat4 &proj, float viewport_height) {
+        draw_calls = 0;
+        trees_drawn = 0;
+        triangles_drawn = 0;
+        ++lod_frame;
 
-        for (size_t i = 0; i < tree_positions.size(); ++i) {
-            const auto& pos = tree_positions[i];
-            float rotation = tree_rotations[i];
-            const int lod = get_lod_level(pos);
-            mat4 model = translate(mat4(1.0f), pos);
+        if (selector.getLevelCount() != level_total()) {
+            std::vector<float> errors;
+            for (const lod_mesh& level : lod_chain) errors.push_back(level.error);
+            if (level_total() > static_cast<int>(lod_chain.size())) errors.push_back(impostor_error);
+            selector.setErrors(errors);
+        }
+        selector.setTolerance(pixel_error);
+        selector.setHysteresis(hysteresis);
+        if (m_lod_from_target) {
+            selector.setCamera(m_target_position, proj, viewport_height);
+        } else {
+            selector.setCamera(view, proj, viewport_height);
+        }
 
-            model = rotate(model, rotation, vec3(0.f,1.f,0.f));
+        query_cells.clear();
+        tree_grid.queryFrustum(Frustum(proj * view), query_cells);
+        cells_visible = static_cast<int>(query_cells.size());
+        cells_culled = tree_grid.getNonEmptyCount() - cells_visible;
 
-            model = scale(model, vec3(0.1,0.1,0.1));
+        assign_lods();
+        if (instances_dirty) rebuild_instances();
+        if (sorted_instances.empty()) return;
 
-            glUniformMatrix4fv(glGetUniformLocation(shader, "uModelViewMatrix"), 1, GL_FALSE, glm::value_ptr(view * model));
+        glUseProgram(instanced_shader);
+        glUniformMatrix4fv(glGetUniformLocation(instanced_shader, "uProjectionMatrix"), 1, false, value_ptr(proj));
+        glUniformMatrix4fv(glGetUniformLocation(instanced_shader, "uModelViewMatrix"), 1, GL_FALSE, value_ptr(view));
+        const GLint color_location = glGetUniformLocation(instanced_shader, "uColor");
+
+        const size_t cells = tree_grid.getCells().size();
+        for (size_t level = 0; level < level_count.size(); ++level) {
+            if (level_count[level] == 0) continue;
+
+            // Cells are laid out in order within a level, so neighbouring
+            // visible cells merge into one range
+            draw_runs.clear();
+            for (int c : query_cells) {
+                const int first = cell_first[level * cells + c];
+                const int count = cell_count[level * cells + c];
+                if (count == 0) continue;
+                if (!draw_runs.empty() && draw_runs.back().x + draw_runs.back().y == first) {
+                    draw_runs.back().y += count;
+                } else {
+                    draw_runs.emplace_back(first, count);
+                }
+                trees_drawn += count;
+            }
+            if (draw_runs.empty()) continue;
+
+            if (level == lod_chain.size()) {
+                draw_impostor_runs(view, proj);
+                continue;
+            }
+            glUniform3fv(color_location, 1, value_ptr(trunk_color));
+            draw_runs_of(lod_chain[level].trunk);
+            glUniform3fv(color_location, 1, value_ptr(leaves_color));
+            draw_runs_of(lod_chain[level].leaves);
+        }
+        glBindVertexArray(0);
+    }
+
+    /**
+     * Draws mesh instanced once for every range in draw_runs
+     */
+    void level_of_detail::draw_runs_of(const cgra::gl_mesh& mesh) {
+        for (const ivec2& run : draw_runs) {
+            bind_instances(mesh.vao, run.x);
+            glDrawElementsInstanced(mesh.mode, mesh.index_count, GL_UNSIGNED_INT, 0, run.y);
+            ++draw_calls;
+            triangles_drawn += static_cast<long long>(mesh.index_count / 3) * run.y;
+        }
+    }
+
+    /**
+     * Draws one impostor quad for every instance in draw_runs. Must come
+     * after the other levels, as it switches to impostor_shader.
+     */
+    void level_of_detail::draw_impostor_runs(const mat4 &view, const mat4 &proj) {
+        glUseProgram(impostor_shader);
+        glUniformMatrix4fv(glGetUniformLocation(impostor_shader, "uProjectionMatrix"), 1, false, value_ptr(proj));
+        glUniformMatrix4fv(glGetUniformLocation(impostor_shader, "uModelViewMatrix"), 1, GL_FALSE, value_ptr(view));
+        glUniform3fv(glGetUniformLocation(impostor_shader, "uCenter"), 1, value_ptr(impostor.getCenter()));
+        glUniform1f(glGetUniformLocation(impostor_shader, "uRadius"), impostor.getRadius());
+        glUniform1i(glGetUniformLocation(impostor_shader, "uFrames"), ImpostorAtlas::FRAMES);
+        impostor.bindTexture(5);
+        glUniform1i(glGetUniformLocation(impostor_shader, "uAtlas"), 5);
+        for (const ivec2& run : draw_runs) {
+            bind_instances(quad_vao, run.x);
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, run.y);
+            ++draw_calls;
+            triangles_drawn += 2LL * run.y;
+        }
+    }
+
+    /**
+     * Brings the LOD levels of the trees in the visible cells (query_cells)
+     * up to date with the selector, and marks the instance buffer for a
+     * rebuild if any level changed. New trees are all classified. After
+     * that, a visible cell is only reclassified, in one SIMD batch, if it was
+     * out of view last frame or the grid reports its trees may have crossed
+     * a band edge since then.
+     */
+    void level_of_detail::assign_lods() {
+        const std::vector<float>& edges = selector.getBandEdges();
+        const vec3 eye = selector.getEye();
+        const auto& grid_cells = tree_grid.getCells();
+        trees_reclassified = 0;
+
+        int changed = 0;
+        if (tree_lods.size() != tree_positions.size() || assigned_edges.size() != edges.size()) {
+            tree_lods.assign(tree_positions.size(), -1);
+            changed += selector.selectBatch(tree_positions.data(), static_cast<int>(tree_positions.size()),
+                                            tree_lods.data());
+            trees_reclassified = static_cast<int>(tree_positions.size());
+            cell_frame.assign(grid_cells.size(), lod_frame);
+        } else {
+            changed_cells.clear();
+            if (assigned_eye != eye || assigned_edges != edges) {
+                tree_grid.queryChanged(assigned_eye, assigned_edges, eye, edges, changed_cells);
+            }
+            // both lists are ascending
+            size_t next_changed = 0;
+            for (int c : query_cells) {
+                while (next_changed < changed_cells.size() && changed_cells[next_changed] < c) ++next_changed;
+                const bool moved = next_changed < changed_cells.size() && changed_cells[next_changed] == c;
+                if (moved || cell_frame[c] != lod_frame - 1) {
+                    const int first = grid_cells[c].first;
+                    changed += selector.selectBatch(&tree_positions[first], grid_cells[c].count, &tree_lods[first]);
+                    trees_reclassified += grid_cells[c].count;
+                }
+                cell_frame[c] = lod_frame;
+            }
+        }
+        if (changed > 0) instances_dirty = true;
+        assigned_eye = eye;
+        assigned_edges = edges;
+    }
+
+    /**
+     * Sorts the trees' instances by LOD level and then grid cell (a counting
+     * sort over the trees, which are already in cell order) and uploads them
+     */
+    void level_of_detail::rebuild_instances() {
+        const size_t levels = level_total();
+        const size_t cells = tree_grid.getCells().size();
+        const auto& grid_cells = tree_grid.getCells();
+
+        cell_count.assign(levels * cells, 0);
+        for (size_t c = 0; c < cells; ++c) {
+            for (int i = grid_cells[c].first; i < grid_cells[c].first + grid_cells[c].count; ++i) {
+                ++cell_count[tree_lods[i] * cells + c];
+            }
+        }
+        cell_first.assign(levels * cells, 0);
+        for (size_t r = 1; r < levels * cells; ++r) cell_first[r] = cell_first[r - 1] + cell_count[r - 1];
+        level_first.assign(levels, 0);
+        level_count.assign(levels, 0);
+        for (size_t l = 0; l < levels; ++l) {
+            level_first[l] = cell_first[l * cells];
+            for (size_t c = 0; c < cells; ++c) level_count[l] += cell_count[l * cells + c];
+        }
 
-            if (lod == 0) {
-                glUniform3fv(glGetUniformLocation(shader, "uColor"), 1, value_ptr(vec3(0.55f, 0.27f, 0.07f)));
-                tree1.draw();
-                glUniform3fv(glGetUniformLocation(shader, "uColor"), 1, value_ptr(vec3(0.0f, 0.5f, 0.0f)));
-                leaves1.draw();
-            } else {
-                glUniform3fv(glGetUniformLocation(shader, "uColor"), 1, value_ptr(vec3(0.55f, 0.27f, 0.07f)));
-                tree2.draw();
-                glUniform3fv(glGetUniformLocation(shader, "uColor"), 1, value_ptr(vec3(0.0f, 0.5f, 0.0f)));
-                leaves2.draw();
+        sorted_instances.resize(tree_instances.size());
+        std::vector<int> next = cell_first;
+        for (size_t c = 0; c < cells; ++c) {
+            for (int i = grid_cells[c].first; i < grid_cells[c].first + grid_cells[c].count; ++i) {
+                sorted_instances[next[tree_lods[i] * cells + c]++] = tree_instances[i];
             }
         }
+
+        if (instance_vbo == 0) glGenBuffers(1, &instance_vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+        glBufferData(GL_ARRAY_BUFFER, sorted_instances.size() * sizeof(tree_instance), sorted_instances.data(),
+                     GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        instances_dirty = false;
+        ++instance_rebuilds;
+    }
+
+    /**
+     * Points the per-instance attributes of vertex array vao (locations 4-8,
+     * after cgra::mesh_builder's 0-3) at the instance buffer from instance
+     * `first`. OpenGL 3.3 has no base instance, so each range re-points them.
+     */
+    void level_of_detail::bind_instances(GLuint vao, int first) {
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+        const size_t base = size_t(first) * sizeof(tree_instance);
+        for (int column = 0; column < 4; ++column) {
+            glEnableVertexAttribArray(4 + column);
+            glVertexAttribPointer(4 + column, 4, GL_FLOAT, GL_FALSE, sizeof(tree_instance),
+                                  (void *)(base + offsetof(tree_instance, model) + column * sizeof(vec4)));
+            glVertexAttribDivisor(4 + column, 1);
+        }
+        glEnableVertexAttribArray(8);
+        glVertexAttribPointer(8, 3, GL_FLOAT, GL_FALSE, sizeof(tree_instance),
+                              (void *)(base + offsetof(tree_instance, tint)));
+        glVertexAttribDivisor(8, 1);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
 
     /**
-     * Returns the lod level the model should be rendered at with lower number being a higher lod
+     * Returns the lod level the model should be rendered at with lower number being a higher lod,
+     * from the last update_lod's camera and without hysteresis
      * @param model_position
      * @return
      */
     int level_of_detail::get_lod_level(const vec3 model_position) const {
-        float dist = distance(m_target_position, model_position);
-        for (size_t i = 0; i < lod_thresholds.size(); ++i) {
-            if (dist < lod_thresholds[i]) {
-                return static_cast<int>(i);
-            }
-        }
-        return static_cast<int>(lod_thresholds.size());
+        return selector.select(distance(selector.getEye(), model_position));
     }
 
-    void level_of_detail::create_tree(const vec3& pos, float rotation) {
+    void level_of_detail::create_tree(const vec3& pos, float rotation, float tint) {
         tree_positions.push_back(pos);
         tree_rotations.push_back(rotation);
+
+        mat4 model = translate(mat4(1.0f), pos);
+        model = rotate(model, rotation, vec3(0.f,1.f,0.f));
+        model = scale(model, vec3(0.1,0.1,0.1));
+        tree_instances.push_back({model, vec3(tint)});
     }
 
     void level_of_detail::generate_trees(const HeightmapGenerator& m_terrain, float grassTopHeight) {
         tree_positions.clear();
         tree_rotations.clear();
-        std::mt19937 rng(std::random_device{}());
-        std::uniform_real_distribution<float> angle_dist(0.0f, glm::two_pi<float>());
-        for (float x = 0; x<20; x+=1.f) {
-            for (float y = 0; y<20; y+=1.f) {
-                std::uniform_real_distribution<float> dist_x(-0.3f, 0.3f);
-                std::uniform_real_distribution<float> dist_y(-0.3f, 0.3f);
-                x +=  dist_x(rng);
-                y +=  dist_y(rng);
-                float rotation = angle_dist(rng);
-                clamp(x, 0.f, 20.f);
-                clamp(y, 0.f, 20.f);
-                float height = m_terrain.getHeight(x*50.f,y*50.f);
-                if (height < grassTopHeight) {
-                    create_tree(vec3(x - 10,height ,y - 10), rotation);
-                }
-            }
+        tree_instances.clear();
+        tree_lods.clear(); // forces a new assignment and instance buffer
+        instances_dirty = true;
+        // Poisson-disk samples tree_spacing apart, thinning out towards the
+        // top of the grass band and on steep ground
+        const float low = m_terrain.computeMinMax().first;
+        const float fade = 0.1f * std::max(grassTopHeight - low, 0.0f);
+        VegetationScatter::Params params;
+        params.minDistance = tree_spacing;
+        params.seed = uint32_t(tree_seed);
+        params.maxHeight = grassTopHeight - fade;
+        params.heightFade = fade;
+        params.maxSlope = tree_max_slope;
+        params.slopeFade = 0.3f * tree_max_slope;
+        std::vector<VegetationScatter::Instance> placed;
+        scatter.run(m_terrain, params, placed);
+        tree_positions.reserve(placed.size());
+        tree_rotations.reserve(placed.size());
+        tree_instances.reserve(placed.size());
+        for (const VegetationScatter::Instance& tree : placed)
+            create_tree(tree.position, tree.rotation, tree.tint);
+
+        const int side = SpatialGrid::cellsPerSide(tree_positions.size());
+        tree_grid.build(tree_positions, side, side, tree_reach);
+
+        // Store the trees in the grid's order, so each cell's trees are one
+        // range of the tree arrays
+        const std::vector<int>& order = tree_grid.getOrder();
+        std::vector<float> rotations(order.size());
+        std::vector<tree_instance> instances(order.size());
+        for (size_t k = 0; k < order.size(); ++k) {
+            rotations[k] = tree_rotations[order[k]];
+            instances[k] = tree_instances[order[k]];
         }
+        tree_positions = tree_grid.getPoints();
+        tree_rotations = std::move(rotations);
+        tree_instances = std::move(instances);
     }
 
     void level_of_detail::draw_lod_target(const glm::mat4 &view, const glm::mat4 &proj) {
@@ -116,10 +391,10 @@ namespace lod {
         glUniformMatrix4fv(glGetUniformLocation(shader, "uModelViewMatrix"), 1, GL_FALSE, glm::value_ptr(view * model));
         m_target.draw();
 
-        // Draw outer sphere to visual lod
-        if (m_draw_lod_visualize) {
+        // Draw outer sphere to visual lod, the first switch distance around the target
+        if (m_draw_lod_visualize && !selector.getSwitchDistances().empty()) {
             model = translate(mat4(1.0f), m_target_position);
-            model = scale(model, vec3(lod_thresholds.front()));
+            model = scale(model, vec3(selector.getSwitchDistances().front()));
             glUniformMatrix4fv(glGetUniformLocation(shader, "uModelViewMatrix"), 1, GL_FALSE, glm::value_ptr(view * model));
             glPolygonMode(GL_FRONT_AND_BACK, (true) ? GL_LINE : GL_FILL);
             m_target.draw();
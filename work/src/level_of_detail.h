@@ -8,6 +8,10 @@
 #include <vector>
 
 #include "heightmap_generator.hpp"
+#include "impostor_atlas.hpp"
+#include "lod_selector.hpp"
+#include "spatial_grid.hpp"
+#include "vegetation_scatter.hpp"
 #include "cgra/cgra_mesh.hpp"
 #include "cgra/cgra_wavefront.hpp"
 
@@ -15,38 +19,131 @@ namespace lod {
 
 class level_of_detail {
 private:
-    const std::string TREE_FILE = CGRA_SRCDIR "/res/assets/a.obj";
-    cgra::gl_mesh tree1 = cgra::load_wavefront_data(TREE_FILE).build();
-    const std::string LEAVES_FILE = CGRA_SRCDIR "/res/assets/al.obj";
-    cgra::gl_mesh leaves1 = cgra::load_wavefront_data(LEAVES_FILE).build();
+    // One level of the tree LOD chain: the tree's parts at that level and
+    // its geometric error, how far (world units) it strays from the
+    // full-detail tree
+    struct lod_mesh {
+        cgra::gl_mesh trunk;
+        cgra::gl_mesh leaves;
+        float error;
+        Aabb bounds; // of both parts, in mesh space
+    };
+    static std::vector<lod_mesh> load_lod_chain();
+    std::vector<lod_mesh> lod_chain = load_lod_chain(); // finest level first
 
-    const std::string TREE_FILE2 = CGRA_SRCDIR "/res/assets/b.obj";
-    cgra::gl_mesh tree2 = cgra::load_wavefront_data(TREE_FILE2).build();
-    const std::string LEAVES_FILE2 = CGRA_SRCDIR "/res/assets/bl.obj";
-    cgra::gl_mesh leaves2 = cgra::load_wavefront_data(LEAVES_FILE2).build();
+    const glm::vec3 trunk_color = {0.55f, 0.27f, 0.07f};
+    const glm::vec3 leaves_color = {0.0f, 0.5f, 0.0f};
+
+    // Beyond the chain, trees are drawn as impostors of its first level:
+    // one quad each, drawn from quad_vao with impostor_shader
+    ImpostorAtlas impostor;
+    GLuint quad_vao = 0, quad_vbo = 0;
+    int level_total() const;
+
+    // Picks each tree's level from its projected error, see update_lod
+    LodSelector selector;
 
     const std::string LOD_TARGET_FILE = CGRA_SRCDIR "/res/assets/sphere.obj";
     cgra::gl_mesh m_target = cgra::load_wavefront_data(LOD_TARGET_FILE).build();
     glm::vec3 m_target_position = {0.f,0.f,0.f};
 
+    // Places the trees for generate_trees
+    VegetationScatter scatter;
+
     std::vector<glm::vec3> tree_positions;
     std::vector<float> tree_rotations; // Store rotation for each tree
-    void create_tree(const glm::vec3& pos, float rotation); // Accept rotation
+    void create_tree(const glm::vec3& pos, float rotation, float tint); // Accept rotation
+
+    // Per-instance data for instanced drawing, read by lod_instanced_vert.glsl
+    struct tree_instance {
+        glm::mat4 model;
+        glm::vec3 tint; // multiplies the part colour
+    };
+    std::vector<tree_instance> tree_instances; // one per tree, in tree order
+    std::vector<int> tree_lods;                // level each tree was last assigned
+
+    // Grid over tree_positions, built by generate_trees, which then stores
+    // the trees in the grid's order: cell c's trees are the indices
+    // [first, first + count) of its SpatialGrid::Cell. Cell bounds are
+    // padded by tree_reach, how far a tree's mesh extends from its base.
+    SpatialGrid tree_grid;
+    const glm::vec3 tree_reach = {0.5f, 1.5f, 0.5f};
 
+    // The instance buffer holds the trees sorted by LOD level, then by grid
+    // cell. Level l is the range [level_first[l], level_first[l] + level_count[l]),
+    // and its trees in cell c are the range starting at cell_first[l * cells + c]
+    // of cell_count[l * cells + c] instances.
+    std::vector<tree_instance> sorted_instances;
+    std::vector<int> level_first, level_count;
+    std::vector<int> cell_first, cell_count;
+    GLuint instance_vbo = 0;
+    bool instances_dirty = true;
 
+    // What the current assignments were computed from. Cells are brought up
+    // to date only while visible: cell_frame[c] is the last frame cell c's
+    // levels were current.
+    glm::vec3 assigned_eye = {0.f,0.f,0.f};
+    std::vector<float> assigned_edges;
+    std::vector<int> cell_frame;
+    int lod_frame = 0;
+
+    // scratch for the per-frame grid queries
+    std::vector<int> query_cells;
+    std::vector<int> changed_cells;
+    std::vector<glm::ivec2> draw_runs; // (first instance, count)
+
+    int draw_calls = 0;
+    int instance_rebuilds = 0;
+    int cells_visible = 0, cells_culled = 0;
+    int trees_drawn = 0;
+    long long triangles_drawn = 0;
+    int trees_reclassified = 0;
+
+    void assign_lods();
+    void rebuild_instances();
+    void bind_instances(GLuint vao, int first);
+    void draw_runs_of(const cgra::gl_mesh& mesh);
+    void draw_impostor_runs(const glm::mat4 &view, const glm::mat4 &proj);
 
 public:
-    void update_lod(const glm::mat4 &view, glm::mat4 &proj);
+    void update_lod(const glm::mat4 &view, glm::mat4 &proj, float viewport_height);
     int get_lod_level(glm::vec3 model_position) const;
     void generate_trees(const HeightmapGenerator& m_terrain, float grassTopHeight);
     void draw_lod_target(const glm::mat4 &view, const glm::mat4 &proj);
+    bool bake_impostor(int frame_size = 128);
 
-    std::vector<float> lod_thresholds; // Vector of thresholds that determine the distance lod level will change
+    float pixel_error = 1.0f;  // largest geometric error allowed on screen, in pixels
+    float hysteresis = 0.1f;   // half-width of the switching bands, fraction of the switch distance
+    bool m_lod_from_target = false; // measure distances from the target instead of the camera
     GLuint shader = 0;
+    GLuint instanced_shader = 0; // lod_instanced_vert.glsl, draws the trees
+    GLuint impostor_shader = 0;  // impostor_vert.glsl, draws the impostor level
+    bool m_use_impostors = true;
+    float impostor_error = 0.03f; // geometric error of the impostor level
+    float tree_spacing = 0.8f;    // least distance between two trees
+    int tree_seed = 1;            // same seed and terrain, same trees
+    float tree_max_slope = 1.5f;  // steepest ground (rise over run) with full tree density
     float max_height = 0;
     bool m_draw_lod_visualize = false;
     bool m_move_target = false;
     bool m_show_target = true;
+
+    size_t get_tree_count() const { return tree_positions.size(); }
+    int get_draw_calls() const { return draw_calls; }
+    int get_instance_rebuilds() const { return instance_rebuilds; }
+    // Statistics for the last update_lod()
+    int get_cells_visible() const { return cells_visible; }
+    int get_cells_culled() const { return cells_culled; }
+    int get_trees_drawn() const { return trees_drawn; }
+    long long get_triangles_drawn() const { return triangles_drawn; }
+    // Trees whose level was recomputed by the last update_lod()
+    int get_trees_reclassified() const { return trees_reclassified; }
+    size_t get_lod_level_count() const { return level_total(); }
+    const ImpostorAtlas& get_impostor() const { return impostor; }
+    // Statistics for the last generate_trees()
+    const VegetationScatter& get_scatter() const { return scatter; }
+    // Distance at which each level after the first takes over
+    const std::vector<float>& get_switch_distances() const { return selector.getSwitchDistances(); }
 };
 
 } // lod
@@ -0,0 +1,192 @@
+#pragma once
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LOD_SELECTOR_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Screen-space-error level selection for a chain of LOD meshes.
+//
+// Level l of the chain has a geometric error: how far (in world units) its
+// surface strays from the full-detail mesh, ascending along the chain with
+// level 0 at 0. Seen from distance d that error covers
+//
+//   error * projScale / d pixels, projScale = proj[1][1] * viewportHeight / 2
+//
+// so level l is good enough once d >= errors[l] * projScale / tolerance,
+// its switch distance. An object is drawn at the coarsest level whose switch
+// distance it is past.
+//
+// Hysteresis widens every switch distance into a band [D (1 - h), D (1 + h)):
+// an object only goes coarser once it is past the top of a band and only
+// finer once it is back below the bottom, so one hovering around a switch
+// distance keeps its level instead of flickering between two.
+//
+// select() and the SSE2 selectBatch() compare squared distances with the
+// same operations, so they give the same levels.
+class LodSelector {
+ public:
+  // errors[l] for each level, ascending, errors[0] = 0
+  void setErrors(std::vector<float> levelErrors) {
+    errors = std::move(levelErrors);
+    update();
+  }
+  // Largest error allowed on screen, in pixels
+  void setTolerance(float pixels) {
+    tolerance = std::max(pixels, 1e-3f);
+    update();
+  }
+  // Half-width of the hysteresis bands as a fraction of the switch distance
+  void setHysteresis(float fraction) {
+    hysteresis = std::clamp(fraction, 0.0f, 0.9f);
+    update();
+  }
+  // Takes the projection scale from proj and, unless eye is given, the eye
+  // position from view
+  void setCamera(const glm::mat4& view, const glm::mat4& proj,
+                 float viewportHeight) {
+    setCamera(glm::vec3(glm::inverse(view)[3]), proj, viewportHeight);
+  }
+  void setCamera(glm::vec3 eyePosition, const glm::mat4& proj,
+                 float viewportHeight) {
+    eye = eyePosition;
+    projScale = proj[1][1] * viewportHeight * 0.5f;
+    update();
+  }
+
+  int getLevelCount() const { return int(errors.size()); }
+  glm::vec3 getEye() const { return eye; }
+  float getTolerance() const { return tolerance; }
+  float getHysteresis() const { return hysteresis; }
+  // Switch distance of each level after the first
+  const std::vector<float>& getSwitchDistances() const { return switches; }
+  // Every band edge, ascending. Objects whose distance stays between the
+  // same two edges keep their level, which makes these the thresholds for
+  // SpatialGrid::queryChanged.
+  const std::vector<float>& getBandEdges() const { return edges; }
+
+  // Level without hysteresis
+  int select(float distance) const {
+    int level = 0;
+    for (float d : switches) level += distance >= d;
+    return level;
+  }
+
+  // Level of an object at `position` that currently has level `current`
+  // (-1 for none yet)
+  int select(glm::vec3 position, int current) const {
+    const float d2 = distance2(position);
+    int finest = 0, coarsest = 0;
+    for (size_t l = 0; l < upper2.size(); ++l) {
+      finest += d2 >= upper2[l];
+      coarsest += d2 >= lower2[l];
+    }
+    return std::clamp(current, finest, coarsest);
+  }
+
+  // select() for count objects, updating levels in place. Returns how many
+  // levels changed.
+  int selectBatch(const glm::vec3* positions, int count, int* levels) const {
+    int changed = 0, i = 0;
+#ifdef LOD_SELECTOR_SSE2
+    static_assert(sizeof(glm::vec3) == 3 * sizeof(float),
+                  "positions are read as packed floats");
+    const __m128 ex = _mm_set1_ps(eye.x), ey = _mm_set1_ps(eye.y),
+                 ez = _mm_set1_ps(eye.z);
+    __m128i vchanged = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4) {
+      // four packed vec3s, x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3,
+      // transposed into x, y and z
+      const float* f = &positions[i].x;
+      const __m128 a = _mm_loadu_ps(f), b = _mm_loadu_ps(f + 4),
+                   c = _mm_loadu_ps(f + 8);
+      const __m128 x = _mm_shuffle_ps(
+          a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(0, 1, 0, 2)),
+          _MM_SHUFFLE(2, 0, 3, 0));
+      const __m128 y = _mm_shuffle_ps(
+          _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 0, 1)),
+          _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)),
+          _MM_SHUFFLE(2, 0, 2, 0));
+      const __m128 z = _mm_shuffle_ps(
+          _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)),
+          _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)),
+          _MM_SHUFFLE(2, 0, 2, 0));
+      const __m128 dx = _mm_sub_ps(x, ex), dy = _mm_sub_ps(y, ey),
+                   dz = _mm_sub_ps(z, ez);
+      const __m128 d2 = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+          _mm_mul_ps(dz, dz));
+      // the comparison masks are -1 where true
+      __m128i finest = _mm_setzero_si128(), coarsest = _mm_setzero_si128();
+      for (size_t l = 0; l < upper2.size(); ++l) {
+        finest = _mm_sub_epi32(finest, _mm_castps_si128(_mm_cmpge_ps(
+                                           d2, _mm_set1_ps(upper2[l]))));
+        coarsest = _mm_sub_epi32(coarsest, _mm_castps_si128(_mm_cmpge_ps(
+                                               d2, _mm_set1_ps(lower2[l]))));
+      }
+      __m128i* out = reinterpret_cast<__m128i*>(levels + i);
+      const __m128i current = _mm_loadu_si128(out);
+      __m128i level = blend(_mm_cmpgt_epi32(finest, current), finest, current);
+      level = blend(_mm_cmpgt_epi32(level, coarsest), coarsest, level);
+      vchanged = _mm_sub_epi32(vchanged, _mm_xor_si128(
+                                             _mm_cmpeq_epi32(level, current),
+                                             _mm_set1_epi32(-1)));
+      _mm_storeu_si128(out, level);
+    }
+    alignas(16) int lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes), vchanged);
+    changed = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; i < count; ++i) {
+      const int level = select(positions[i], levels[i]);
+      changed += level != levels[i];
+      levels[i] = level;
+    }
+    return changed;
+  }
+
+ private:
+  std::vector<float> errors{0.0f};
+  float tolerance = 1.0f;
+  float hysteresis = 0.0f;
+  glm::vec3 eye{0.0f};
+  float projScale = 1.0f;
+
+  std::vector<float> switches, edges;
+  std::vector<float> upper2, lower2;  // squared band edges per switch
+
+  void update() {
+    switches.clear();
+    edges.clear();
+    upper2.clear();
+    lower2.clear();
+    for (size_t l = 1; l < errors.size(); ++l) {
+      const float d = errors[l] * projScale / tolerance;
+      const float lower = d * (1.0f - hysteresis);
+      const float upper = d * (1.0f + hysteresis);
+      switches.push_back(d);
+      edges.push_back(lower);
+      edges.push_back(upper);
+      lower2.push_back(lower * lower);
+      upper2.push_back(upper * upper);
+    }
+    std::sort(edges.begin(), edges.end());
+  }
+
+  float distance2(glm::vec3 p) const {
+    const float dx = p.x - eye.x, dy = p.y - eye.y, dz = p.z - eye.z;
+    return (dx * dx + dy * dy) + dz * dz;
+  }
+
+#ifdef LOD_SELECTOR_SSE2
+  // a where mask is set, b elsewhere
+  static __m128i blend(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+  }
+#endif
+};
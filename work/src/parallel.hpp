@@ -0,0 +1,99 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#ifdef CGRA_HAVE_OPENMP
+#include <omp.h>
+#endif
+
+// Small helpers for splitting grid work across cores. Uses OpenMP when the
+// build found it (CGRA_HAVE_OPENMP) and falls back to plain std::threads.
+namespace parallel {
+
+// Number of worker threads the machine can run concurrently (at least 1)
+inline int hardwareThreads() {
+#ifdef CGRA_HAVE_OPENMP
+  return std::max(1, omp_get_num_procs());
+#else
+  return std::max(1u, std::thread::hardware_concurrency());
+#endif
+}
+
+// Resolves a requested thread count, where <= 0 means "use every core"
+inline int resolveThreads(int threads) {
+  return threads > 0 ? threads : hardwareThreads();
+}
+
+// Splits [begin, end) into tiles of `grain` items and calls fn(tileBegin,
+// tileEnd) for every tile on up to `threads` workers. Tiles are handed out
+// dynamically so uneven rows do not stall the other workers. fn must only
+// write to data owned by its own tile.
+template <typename Fn>
+void forTiles(int begin, int end, int grain, int threads, Fn&& fn) {
+  if (end <= begin) return;
+  grain = std::max(1, grain);
+  const int tiles = (end - begin + grain - 1) / grain;
+  threads = std::min(resolveThreads(threads), tiles);
+
+  if (threads <= 1) {
+    for (int t = 0; t < tiles; ++t) {
+      const int b = begin + t * grain;
+      fn(b, std::min(end, b + grain));
+    }
+    return;
+  }
+
+#ifdef CGRA_HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic, 1) num_threads(threads)
+  for (int t = 0; t < tiles; ++t) {
+    const int b = begin + t * grain;
+    fn(b, std::min(end, b + grain));
+  }
+#else
+  std::atomic<int> next{0};
+  auto worker = [&]() {
+    for (int t = next++; t < tiles; t = next++) {
+      const int b = begin + t * grain;
+      fn(b, std::min(end, b + grain));
+    }
+  };
+  std::vector<std::thread> pool;
+  pool.reserve(threads - 1);
+  for (int i = 1; i < threads; ++i) pool.emplace_back(worker);
+  worker();
+  for (auto& th : pool) th.join();
+#endif
+}
+
+// Progress and cancellation shared between a long-running operation and
+// the thread watching it. The operation calls begin() with the number of
+// work units in its current stage and advance() as units finish, and polls
+// isCancelled() between units; any thread may read fraction() or cancel().
+class Progress {
+ public:
+  void begin(long long totalUnits) {
+    total = std::max(1LL, totalUnits);
+    done = 0;
+  }
+  void advance(long long units = 1) { done += units; }
+  float fraction() const {
+    return std::min(1.0f, float(done.load()) / float(total.load()));
+  }
+
+  void cancel() { cancelled = true; }
+  bool isCancelled() const { return cancelled; }
+
+  // Clears the counters and any pending cancel, for reuse by a new job
+  void reset() {
+    begin(1);
+    cancelled = false;
+  }
+
+ private:
+  std::atomic<long long> done{0}, total{1};
+  std::atomic<bool> cancelled{false};
+};
+
+}  // namespace parallel
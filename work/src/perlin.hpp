@@ -3,8 +3,18 @@
 #include <cmath>
 #include <numeric>
 #include <random>
+#include <utility>
 #include <vector>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PERLIN_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define PERLIN_AVX2 1
+#include <immintrin.h>
+#endif
+
 namespace perlin {
 
 	inline float fade(float t) {
@@ -12,26 +22,36 @@ namespace perlin {
 		return t * t * t * (t * (t * 6 - 15) + 10);
 	}
 
+	// Derivative of fade(): 30t^4 - 60t^3 + 30t^2
+	inline float fade_deriv(float t) {
+		return 30 * t * t * (t * (t - 2) + 1);
+	}
+
 	inline float lerp(float a, float b, float t) { return a + t * (b - a); }
 
-	// Pseudorandom gradient at integer coordinates
-	inline std::pair<float, float> gradient(int ix, int iz) {
-		static std::vector<std::pair<float, float>> grad2 = {
-			{1, 0},  {-1, 0}, {0, 1},  {0, -1}, {1, 1},
-			{-1, 1}, {1, -1}, {-1, -1}
+	// Lattice hash shared by the scalar and batch paths
+	inline unsigned int hash(int ix, int iz) {
+		unsigned int h = unsigned(ix) * 374761393u + unsigned(iz) * 668265263u;  // some primes
 
-		};
-		unsigned int h = ix * 374761393 + iz * 668265263;  // some primes
-
-		h = (h ^ (h >> 13)) * 1274126177;
+		h = (h ^ (h >> 13)) * 1274126177u;
 		h = h ^ (h >> 16);
-		return grad2[h % grad2.size()];
+		return h;
+	}
+
+	// Gradient table, indexed by the low 3 bits of the hash
+	constexpr float GRAD_X[8] = { 1, -1, 0,  0, 1, -1,  1, -1 };
+	constexpr float GRAD_Z[8] = { 0,  0, 1, -1, 1,  1, -1, -1 };
+
+	// Pseudorandom gradient at integer coordinates
+	inline std::pair<float, float> gradient(int ix, int iz) {
+		unsigned int i = hash(ix, iz) & 7u;
+		return { GRAD_X[i], GRAD_Z[i] };
 	}
 
 	// 2D Perlin noise for a single point
 	inline float noise(float x, float z) {
-		int x0 = static_cast<int>(floor(x));
-		int z0 = static_cast<int>(floor(z));
+		int x0 = static_cast<int>(std::floor(x));
+		int z0 = static_cast<int>(std::floor(z));
 		int x1 = x0 + 1;
 		int z1 = z0 + 1;
 
@@ -59,6 +79,44 @@ namespace perlin {
 		return nxy;
 	}
 
+	// noise(x, z) together with its analytic gradient (d/dx, d/dz). The value
+	// is computed exactly as noise() computes it.
+	inline float noise(float x, float z, float& ddx, float& ddz) {
+		int x0 = static_cast<int>(std::floor(x));
+		int z0 = static_cast<int>(std::floor(z));
+		int x1 = x0 + 1;
+		int z1 = z0 + 1;
+
+		float sx = x - (float)x0;
+		float sz = z - (float)z0;
+
+		auto g00 = gradient(x0, z0);
+		auto g10 = gradient(x1, z0);
+		auto g01 = gradient(x0, z1);
+		auto g11 = gradient(x1, z1);
+
+		float dot00 = g00.first * (x - x0) + g00.second * (z - z0);
+		float dot10 = g10.first * (x - x1) + g10.second * (z - z0);
+		float dot01 = g01.first * (x - x0) + g01.second * (z - z1);
+		float dot11 = g11.first * (x - x1) + g11.second * (z - z1);
+
+		float u = fade(sx), du = fade_deriv(sx);
+		float v = fade(sz), dv = fade_deriv(sz);
+
+		float nx0 = lerp(dot00, dot10, u);
+		float nx1 = lerp(dot01, dot11, u);
+
+		// d/dx of each corner's dot is its gradient's x, and of u is du
+		float ax0 = lerp(g00.first, g10.first, u) + du * (dot10 - dot00);
+		float ax1 = lerp(g01.first, g11.first, u) + du * (dot11 - dot01);
+		ddx = lerp(ax0, ax1, v);
+		float az0 = lerp(g00.second, g10.second, u);
+		float az1 = lerp(g01.second, g11.second, u);
+		ddz = lerp(az0, az1, v) + dv * (nx1 - nx0);
+
+		return lerp(nx0, nx1, v);
+	}
+
 	inline float fbm2d(float x, float z, int octaves = 4, float lacunarity = 2.0f, float decay = 0.5f) {
 		float amplitude = 1.0f;
 		float frequency = 1.0f;
@@ -75,4 +133,592 @@ namespace perlin {
 		return sum;
 	}
 
+	// fbm2d(x, z, ...) together with its analytic gradient (d/dx, d/dz)
+	inline float fbm2d(float x, float z, float& ddx, float& ddz, int octaves = 4, float lacunarity = 2.0f,
+		float decay = 0.5f) {
+		float amplitude = 1.0f;
+		float frequency = 1.0f;
+		float sum = 0.0f;
+		ddx = 0.0f;
+		ddz = 0.0f;
+
+		for (int i = 0; i < octaves; ++i) {
+			float nx, nz;
+			sum += noise(x * frequency, z * frequency, nx, nz) * amplitude;
+			// chain rule: the octave is sampled at frequency * (x, z)
+			const float gradWeight = amplitude * frequency;
+			ddx += nx * gradWeight;
+			ddz += nz * gradWeight;
+			amplitude *= decay;
+			frequency *= lacunarity;
+		}
+
+		return sum;
+	}
+
+
+	//
+	// Batch evaluation
+	//
+	// The *_row functions evaluate `count` samples along a row at
+	// x = (x0 + i * dx) * scale, z = z * scale. The SIMD kernels (4 lanes with
+	// SSE2, 8 with AVX2) perform exactly the same float operations as the
+	// scalar functions above, so results are bit-identical to them (0 ULP).
+	// Build without -ffast-math / FMA contraction to keep that guarantee.
+	//
+
+	namespace detail {
+
+		// Per-row lattice data for one z coordinate
+		struct row_z {
+			float dz0, dz1; // z - z0, z - z1
+			float v;        // fade(sz)
+			float dv;       // fade_deriv(sz)
+			unsigned int hz0, hz1; // z part of the lattice hash
+		};
+
+		inline row_z make_row_z(float z) {
+			int z0 = static_cast<int>(std::floor(z));
+			int z1 = z0 + 1;
+			row_z r;
+			r.dz0 = z - z0;
+			r.dz1 = z - z1;
+			r.v = fade(z - (float)z0);
+			r.dv = fade_deriv(z - (float)z0);
+			r.hz0 = unsigned(z0) * 668265263u;
+			r.hz1 = unsigned(z1) * 668265263u;
+			return r;
+		}
+
+		// Gradient table index from a hash missing its final mixing steps
+		inline unsigned int finish_hash(unsigned int h) {
+			h = (h ^ (h >> 13)) * 1274126177u;
+			h = h ^ (h >> 16);
+			return h & 7u;
+		}
+
+		inline float finish_hash_dot(unsigned int h, float dx, float dz) {
+			unsigned int i = finish_hash(h);
+			return GRAD_X[i] * dx + GRAD_Z[i] * dz;
+		}
+
+		inline float noise_scalar(float x, const row_z& r) {
+			int x0 = static_cast<int>(std::floor(x));
+			int x1 = x0 + 1;
+			unsigned int hx0 = unsigned(x0) * 374761393u;
+			unsigned int hx1 = unsigned(x1) * 374761393u;
+
+			float dot00 = finish_hash_dot(hx0 + r.hz0, x - x0, r.dz0);
+			float dot10 = finish_hash_dot(hx1 + r.hz0, x - x1, r.dz0);
+			float dot01 = finish_hash_dot(hx0 + r.hz1, x - x0, r.dz1);
+			float dot11 = finish_hash_dot(hx1 + r.hz1, x - x1, r.dz1);
+
+			float u = fade(x - (float)x0);
+			float nx0 = lerp(dot00, dot10, u);
+			float nx1 = lerp(dot01, dot11, u);
+			return lerp(nx0, nx1, r.v);
+		}
+
+		// noise_scalar() with the gradient, same arithmetic as perlin::noise's
+		inline float noise_grad_scalar(float x, const row_z& r, float& ddx, float& ddz) {
+			int x0 = static_cast<int>(std::floor(x));
+			int x1 = x0 + 1;
+			unsigned int hx0 = unsigned(x0) * 374761393u;
+			unsigned int hx1 = unsigned(x1) * 374761393u;
+
+			unsigned int i00 = finish_hash(hx0 + r.hz0);
+			unsigned int i10 = finish_hash(hx1 + r.hz0);
+			unsigned int i01 = finish_hash(hx0 + r.hz1);
+			unsigned int i11 = finish_hash(hx1 + r.hz1);
+
+			float dot00 = GRAD_X[i00] * (x - x0) + GRAD_Z[i00] * r.dz0;
+			float dot10 = GRAD_X[i10] * (x - x1) + GRAD_Z[i10] * r.dz0;
+			float dot01 = GRAD_X[i01] * (x - x0) + GRAD_Z[i01] * r.dz1;
+			float dot11 = GRAD_X[i11] * (x - x1) + GRAD_Z[i11] * r.dz1;
+
+			float u = fade(x - (float)x0), du = fade_deriv(x - (float)x0);
+			float nx0 = lerp(dot00, dot10, u);
+			float nx1 = lerp(dot01, dot11, u);
+
+			float ax0 = lerp(GRAD_X[i00], GRAD_X[i10], u) + du * (dot10 - dot00);
+			float ax1 = lerp(GRAD_X[i01], GRAD_X[i11], u) + du * (dot11 - dot01);
+			ddx = lerp(ax0, ax1, r.v);
+			float az0 = lerp(GRAD_Z[i00], GRAD_Z[i10], u);
+			float az1 = lerp(GRAD_Z[i01], GRAD_Z[i11], u);
+			ddz = lerp(az0, az1, r.v) + r.dv * (nx1 - nx0);
+
+			return lerp(nx0, nx1, r.v);
+		}
+
+#ifdef PERLIN_SSE2
+		// 32-bit wrapping multiply (SSE2 has no pmulld)
+		inline __m128i mullo_epi32(__m128i a, __m128i b) {
+			__m128i even = _mm_mul_epu32(a, b);
+			__m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+			return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+				_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+		}
+
+		// Finishes the hash and looks up the gradients of 4 lanes
+		inline void hash_grad4(__m128i h, __m128& gradX, __m128& gradZ) {
+			h = mullo_epi32(_mm_xor_si128(h, _mm_srli_epi32(h, 13)), _mm_set1_epi32(1274126177));
+			h = _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+			const __m128i one = _mm_set1_epi32(1);
+			const __m128i i = _mm_and_si128(h, _mm_set1_epi32(7));
+			const __m128i b0 = _mm_and_si128(i, one);
+			const __m128i b1 = _mm_and_si128(_mm_srli_epi32(i, 1), one);
+			const __m128i b2 = _mm_and_si128(_mm_srli_epi32(i, 2), one);
+			const __m128i i6 = _mm_and_si128(i, _mm_set1_epi32(6));
+			const __m128i unit = _mm_castps_si128(_mm_set1_ps(1.0f));
+
+			// GRAD_X: sign from bit 0, zero for indices 2 and 3
+			__m128i gx = _mm_or_si128(unit, _mm_slli_epi32(b0, 31));
+			gx = _mm_andnot_si128(_mm_cmpeq_epi32(i6, _mm_set1_epi32(2)), gx);
+
+			// GRAD_Z: sign from bit 0 below 4, from bit 1 above; zero for 0 and 1
+			__m128i sz = _mm_or_si128(_mm_andnot_si128(b2, b0), _mm_and_si128(b2, b1));
+			__m128i gz = _mm_or_si128(unit, _mm_slli_epi32(sz, 31));
+			gz = _mm_andnot_si128(_mm_cmpeq_epi32(i6, _mm_setzero_si128()), gz);
+
+			gradX = _mm_castsi128_ps(gx);
+			gradZ = _mm_castsi128_ps(gz);
+		}
+
+		// Finishes the hash and returns dot(gradient, (dx, dz)) for 4 lanes
+		inline __m128 hash_dot4(__m128i h, __m128 dx, __m128 dz) {
+			__m128 gx, gz;
+			hash_grad4(h, gx, gz);
+			return _mm_add_ps(_mm_mul_ps(gx, dx), _mm_mul_ps(gz, dz));
+		}
+
+		inline __m128 fade4(__m128 t) {
+			__m128 t3 = _mm_mul_ps(_mm_mul_ps(t, t), t);
+			__m128 inner = _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f));
+			inner = _mm_add_ps(_mm_mul_ps(t, inner), _mm_set1_ps(10.0f));
+			return _mm_mul_ps(t3, inner);
+		}
+
+		inline __m128 fade_deriv4(__m128 t) {
+			__m128 t2 = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(30.0f), t), t);
+			__m128 inner = _mm_mul_ps(t, _mm_sub_ps(t, _mm_set1_ps(2.0f)));
+			return _mm_mul_ps(t2, _mm_add_ps(inner, _mm_set1_ps(1.0f)));
+		}
+
+		inline __m128 lerp4(__m128 a, __m128 b, __m128 t) {
+			return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+		}
+
+		inline __m128 noise4(__m128 x, const row_z& r) {
+			// floor (valid for |x| < 2^31, same range as the scalar int cast)
+			__m128 fx = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+			fx = _mm_sub_ps(fx, _mm_and_ps(_mm_cmpgt_ps(fx, x), _mm_set1_ps(1.0f)));
+			__m128i x0 = _mm_cvttps_epi32(fx);
+			__m128i x1 = _mm_add_epi32(x0, _mm_set1_epi32(1));
+
+			__m128i hx0 = mullo_epi32(x0, _mm_set1_epi32(374761393));
+			__m128i hx1 = mullo_epi32(x1, _mm_set1_epi32(374761393));
+			__m128i hz0 = _mm_set1_epi32(int(r.hz0));
+			__m128i hz1 = _mm_set1_epi32(int(r.hz1));
+
+			__m128 dx0 = _mm_sub_ps(x, _mm_cvtepi32_ps(x0));
+			__m128 dx1 = _mm_sub_ps(x, _mm_cvtepi32_ps(x1));
+			__m128 dz0 = _mm_set1_ps(r.dz0);
+			__m128 dz1 = _mm_set1_ps(r.dz1);
+
+			__m128 dot00 = hash_dot4(_mm_add_epi32(hx0, hz0), dx0, dz0);
+			__m128 dot10 = hash_dot4(_mm_add_epi32(hx1, hz0), dx1, dz0);
+			__m128 dot01 = hash_dot4(_mm_add_epi32(hx0, hz1), dx0, dz1);
+			__m128 dot11 = hash_dot4(_mm_add_epi32(hx1, hz1), dx1, dz1);
+
+			__m128 u = fade4(dx0);
+			__m128 nx0 = lerp4(dot00, dot10, u);
+			__m128 nx1 = lerp4(dot01, dot11, u);
+			return lerp4(nx0, nx1, _mm_set1_ps(r.v));
+		}
+
+		// noise4() with the gradient, same arithmetic as noise_grad_scalar()
+		inline __m128 noise_grad4(__m128 x, const row_z& r, __m128& ddx, __m128& ddz) {
+			__m128 fx = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+			fx = _mm_sub_ps(fx, _mm_and_ps(_mm_cmpgt_ps(fx, x), _mm_set1_ps(1.0f)));
+			__m128i x0 = _mm_cvttps_epi32(fx);
+			__m128i x1 = _mm_add_epi32(x0, _mm_set1_epi32(1));
+
+			__m128i hx0 = mullo_epi32(x0, _mm_set1_epi32(374761393));
+			__m128i hx1 = mullo_epi32(x1, _mm_set1_epi32(374761393));
+			__m128i hz0 = _mm_set1_epi32(int(r.hz0));
+			__m128i hz1 = _mm_set1_epi32(int(r.hz1));
+
+			__m128 dx0 = _mm_sub_ps(x, _mm_cvtepi32_ps(x0));
+			__m128 dx1 = _mm_sub_ps(x, _mm_cvtepi32_ps(x1));
+			__m128 dz0 = _mm_set1_ps(r.dz0);
+			__m128 dz1 = _mm_set1_ps(r.dz1);
+
+			__m128 gx00, gz00, gx10, gz10, gx01, gz01, gx11, gz11;
+			hash_grad4(_mm_add_epi32(hx0, hz0), gx00, gz00);
+			hash_grad4(_mm_add_epi32(hx1, hz0), gx10, gz10);
+			hash_grad4(_mm_add_epi32(hx0, hz1), gx01, gz01);
+			hash_grad4(_mm_add_epi32(hx1, hz1), gx11, gz11);
+			__m128 dot00 = _mm_add_ps(_mm_mul_ps(gx00, dx0), _mm_mul_ps(gz00, dz0));
+			__m128 dot10 = _mm_add_ps(_mm_mul_ps(gx10, dx1), _mm_mul_ps(gz10, dz0));
+			__m128 dot01 = _mm_add_ps(_mm_mul_ps(gx01, dx0), _mm_mul_ps(gz01, dz1));
+			__m128 dot11 = _mm_add_ps(_mm_mul_ps(gx11, dx1), _mm_mul_ps(gz11, dz1));
+
+			__m128 u = fade4(dx0), du = fade_deriv4(dx0);
+			__m128 nx0 = lerp4(dot00, dot10, u);
+			__m128 nx1 = lerp4(dot01, dot11, u);
+			__m128 v = _mm_set1_ps(r.v);
+
+			__m128 ax0 = _mm_add_ps(lerp4(gx00, gx10, u), _mm_mul_ps(du, _mm_sub_ps(dot10, dot00)));
+			__m128 ax1 = _mm_add_ps(lerp4(gx01, gx11, u), _mm_mul_ps(du, _mm_sub_ps(dot11, dot01)));
+			ddx = lerp4(ax0, ax1, v);
+			__m128 az0 = lerp4(gz00, gz10, u);
+			__m128 az1 = lerp4(gz01, gz11, u);
+			ddz = _mm_add_ps(lerp4(az0, az1, v), _mm_mul_ps(_mm_set1_ps(r.dv), _mm_sub_ps(nx1, nx0)));
+
+			return lerp4(nx0, nx1, v);
+		}
+#endif
+
+#ifdef PERLIN_AVX2
+		inline void hash_grad8(__m256i h, __m256& gradX, __m256& gradZ) {
+			h = _mm256_mullo_epi32(_mm256_xor_si256(h, _mm256_srli_epi32(h, 13)), _mm256_set1_epi32(1274126177));
+			h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+			const __m256i i = _mm256_and_si256(h, _mm256_set1_epi32(7));
+			gradX = _mm256_permutevar8x32_ps(_mm256_loadu_ps(GRAD_X), i);
+			gradZ = _mm256_permutevar8x32_ps(_mm256_loadu_ps(GRAD_Z), i);
+		}
+
+		inline __m256 hash_dot8(__m256i h, __m256 dx, __m256 dz) {
+			__m256 gx, gz;
+			hash_grad8(h, gx, gz);
+			return _mm256_add_ps(_mm256_mul_ps(gx, dx), _mm256_mul_ps(gz, dz));
+		}
+
+		inline __m256 fade8(__m256 t) {
+			__m256 t3 = _mm256_mul_ps(_mm256_mul_ps(t, t), t);
+			__m256 inner = _mm256_sub_ps(_mm256_mul_ps(t, _mm256_set1_ps(6.0f)), _mm256_set1_ps(15.0f));
+			inner = _mm256_add_ps(_mm256_mul_ps(t, inner), _mm256_set1_ps(10.0f));
+			return _mm256_mul_ps(t3, inner);
+		}
+
+		inline __m256 fade_deriv8(__m256 t) {
+			__m256 t2 = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(30.0f), t), t);
+			__m256 inner = _mm256_mul_ps(t, _mm256_sub_ps(t, _mm256_set1_ps(2.0f)));
+			return _mm256_mul_ps(t2, _mm256_add_ps(inner, _mm256_set1_ps(1.0f)));
+		}
+
+		inline __m256 lerp8(__m256 a, __m256 b, __m256 t) {
+			return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+		}
+
+		inline __m256 noise8(__m256 x, const row_z& r) {
+			__m256 fx = _mm256_floor_ps(x);
+			__m256i x0 = _mm256_cvttps_epi32(fx);
+			__m256i x1 = _mm256_add_epi32(x0, _mm256_set1_epi32(1));
+
+			__m256i hx0 = _mm256_mullo_epi32(x0, _mm256_set1_epi32(374761393));
+			__m256i hx1 = _mm256_mullo_epi32(x1, _mm256_set1_epi32(374761393));
+			__m256i hz0 = _mm256_set1_epi32(int(r.hz0));
+			__m256i hz1 = _mm256_set1_epi32(int(r.hz1));
+
+			__m256 dx0 = _mm256_sub_ps(x, _mm256_cvtepi32_ps(x0));
+			__m256 dx1 = _mm256_sub_ps(x, _mm256_cvtepi32_ps(x1));
+			__m256 dz0 = _mm256_set1_ps(r.dz0);
+			__m256 dz1 = _mm256_set1_ps(r.dz1);
+
+			__m256 dot00 = hash_dot8(_mm256_add_epi32(hx0, hz0), dx0, dz0);
+			__m256 dot10 = hash_dot8(_mm256_add_epi32(hx1, hz0), dx1, dz0);
+			__m256 dot01 = hash_dot8(_mm256_add_epi32(hx0, hz1), dx0, dz1);
+			__m256 dot11 = hash_dot8(_mm256_add_epi32(hx1, hz1), dx1, dz1);
+
+			__m256 u = fade8(dx0);
+			__m256 nx0 = lerp8(dot00, dot10, u);
+			__m256 nx1 = lerp8(dot01, dot11, u);
+			return lerp8(nx0, nx1, _mm256_set1_ps(r.v));
+		}
+
+		inline __m256 noise_grad8(__m256 x, const row_z& r, __m256& ddx, __m256& ddz) {
+			__m256 fx = _mm256_floor_ps(x);
+			__m256i x0 = _mm256_cvttps_epi32(fx);
+			__m256i x1 = _mm256_add_epi32(x0, _mm256_set1_epi32(1));
+
+			__m256i hx0 = _mm256_mullo_epi32(x0, _mm256_set1_epi32(374761393));
+			__m256i hx1 = _mm256_mullo_epi32(x1, _mm256_set1_epi32(374761393));
+			__m256i hz0 = _mm256_set1_epi32(int(r.hz0));
+			__m256i hz1 = _mm256_set1_epi32(int(r.hz1));
+
+			__m256 dx0 = _mm256_sub_ps(x, _mm256_cvtepi32_ps(x0));
+			__m256 dx1 = _mm256_sub_ps(x, _mm256_cvtepi32_ps(x1));
+			__m256 dz0 = _mm256_set1_ps(r.dz0);
+			__m256 dz1 = _mm256_set1_ps(r.dz1);
+
+			__m256 gx00, gz00, gx10, gz10, gx01, gz01, gx11, gz11;
+			hash_grad8(_mm256_add_epi32(hx0, hz0), gx00, gz00);
+			hash_grad8(_mm256_add_epi32(hx1, hz0), gx10, gz10);
+			hash_grad8(_mm256_add_epi32(hx0, hz1), gx01, gz01);
+			hash_grad8(_mm256_add_epi32(hx1, hz1), gx11, gz11);
+			__m256 dot00 = _mm256_add_ps(_mm256_mul_ps(gx00, dx0), _mm256_mul_ps(gz00, dz0));
+			__m256 dot10 = _mm256_add_ps(_mm256_mul_ps(gx10, dx1), _mm256_mul_ps(gz10, dz0));
+			__m256 dot01 = _mm256_add_ps(_mm256_mul_ps(gx01, dx0), _mm256_mul_ps(gz01, dz1));
+			__m256 dot11 = _mm256_add_ps(_mm256_mul_ps(gx11, dx1), _mm256_mul_ps(gz11, dz1));
+
+			__m256 u = fade8(dx0), du = fade_deriv8(dx0);
+			__m256 nx0 = lerp8(dot00, dot10, u);
+			__m256 nx1 = lerp8(dot01, dot11, u);
+			__m256 v = _mm256_set1_ps(r.v);
+
+			__m256 ax0 = _mm256_add_ps(lerp8(gx00, gx10, u), _mm256_mul_ps(du, _mm256_sub_ps(dot10, dot00)));
+			__m256 ax1 = _mm256_add_ps(lerp8(gx01, gx11, u), _mm256_mul_ps(du, _mm256_sub_ps(dot11, dot01)));
+			ddx = lerp8(ax0, ax1, v);
+			__m256 az0 = lerp8(gz00, gz10, u);
+			__m256 az1 = lerp8(gz01, gz11, u);
+			ddz = _mm256_add_ps(lerp8(az0, az1, v), _mm256_mul_ps(_mm256_set1_ps(r.dv), _mm256_sub_ps(nx1, nx0)));
+
+			return lerp8(nx0, nx1, v);
+		}
+#endif
+
+		// out[i] (+)= noise((x0 + k * dx) * scale, z * scale) * weight with the
+		// lattice index k = first + i * stride. k is an exact integer in float,
+		// so a strided sample matches the unstrided one at the same k.
+		template <bool Accumulate>
+		inline void noise_row_impl(float x0, float dx, float scale, float z, int count, float weight, float* out,
+			int first = 0, int stride = 1) {
+			const row_z r = make_row_z(z * scale);
+			int i = 0;
+#ifdef PERLIN_AVX2
+			{
+				const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+				const __m256 vx0 = _mm256_set1_ps(x0), vdx = _mm256_set1_ps(dx);
+				const __m256 vs = _mm256_set1_ps(scale), vw = _mm256_set1_ps(weight);
+				const __m256 vfirst = _mm256_set1_ps(float(first)), vstride = _mm256_set1_ps(float(stride));
+				for (; i + 8 <= count; i += 8) {
+					__m256 fi = _mm256_add_ps(_mm256_set1_ps(float(i)), lane);
+					fi = _mm256_add_ps(vfirst, _mm256_mul_ps(fi, vstride));
+					__m256 x = _mm256_mul_ps(_mm256_add_ps(vx0, _mm256_mul_ps(fi, vdx)), vs);
+					__m256 n = _mm256_mul_ps(noise8(x, r), vw);
+					if (Accumulate) n = _mm256_add_ps(_mm256_loadu_ps(out + i), n);
+					_mm256_storeu_ps(out + i, n);
+				}
+			}
+#endif
+#ifdef PERLIN_SSE2
+			{
+				const __m128 lane = _mm_setr_ps(0, 1, 2, 3);
+				const __m128 vx0 = _mm_set1_ps(x0), vdx = _mm_set1_ps(dx);
+				const __m128 vs = _mm_set1_ps(scale), vw = _mm_set1_ps(weight);
+				const __m128 vfirst = _mm_set1_ps(float(first)), vstride = _mm_set1_ps(float(stride));
+				for (; i + 4 <= count; i += 4) {
+					__m128 fi = _mm_add_ps(_mm_set1_ps(float(i)), lane);
+					fi = _mm_add_ps(vfirst, _mm_mul_ps(fi, vstride));
+					__m128 x = _mm_mul_ps(_mm_add_ps(vx0, _mm_mul_ps(fi, vdx)), vs);
+					__m128 n = _mm_mul_ps(noise4(x, r), vw);
+					if (Accumulate) n = _mm_add_ps(_mm_loadu_ps(out + i), n);
+					_mm_storeu_ps(out + i, n);
+				}
+			}
+#endif
+			for (; i < count; ++i) {
+				float n = noise_scalar((x0 + float(first + i * stride) * dx) * scale, r) * weight;
+				out[i] = Accumulate ? out[i] + n : n;
+			}
+		}
+
+		// noise_row_impl() that also writes (or adds) the gradient times
+		// gradWeight to outDx/outDz. The gradient is taken at the noise's
+		// argument, so callers fold the chain rule factor into gradWeight.
+		template <bool Accumulate>
+		inline void noise_grad_row_impl(float x0, float dx, float scale, float z, int count, float weight,
+			float gradWeight, float* out, float* outDx, float* outDz, int first = 0, int stride = 1) {
+			const row_z r = make_row_z(z * scale);
+			int i = 0;
+#ifdef PERLIN_AVX2
+			{
+				const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+				const __m256 vx0 = _mm256_set1_ps(x0), vdx = _mm256_set1_ps(dx);
+				const __m256 vs = _mm256_set1_ps(scale), vw = _mm256_set1_ps(weight);
+				const __m256 vgw = _mm256_set1_ps(gradWeight);
+				const __m256 vfirst = _mm256_set1_ps(float(first)), vstride = _mm256_set1_ps(float(stride));
+				for (; i + 8 <= count; i += 8) {
+					__m256 fi = _mm256_add_ps(_mm256_set1_ps(float(i)), lane);
+					fi = _mm256_add_ps(vfirst, _mm256_mul_ps(fi, vstride));
+					__m256 x = _mm256_mul_ps(_mm256_add_ps(vx0, _mm256_mul_ps(fi, vdx)), vs);
+					__m256 ndx, ndz;
+					__m256 n = _mm256_mul_ps(noise_grad8(x, r, ndx, ndz), vw);
+					ndx = _mm256_mul_ps(ndx, vgw);
+					ndz = _mm256_mul_ps(ndz, vgw);
+					if (Accumulate) {
+						n = _mm256_add_ps(_mm256_loadu_ps(out + i), n);
+						ndx = _mm256_add_ps(_mm256_loadu_ps(outDx + i), ndx);
+						ndz = _mm256_add_ps(_mm256_loadu_ps(outDz + i), ndz);
+					}
+					_mm256_storeu_ps(out + i, n);
+					_mm256_storeu_ps(outDx + i, ndx);
+					_mm256_storeu_ps(outDz + i, ndz);
+				}
+			}
+#endif
+#ifdef PERLIN_SSE2
+			{
+				const __m128 lane = _mm_setr_ps(0, 1, 2, 3);
+				const __m128 vx0 = _mm_set1_ps(x0), vdx = _mm_set1_ps(dx);
+				const __m128 vs = _mm_set1_ps(scale), vw = _mm_set1_ps(weight);
+				const __m128 vgw = _mm_set1_ps(gradWeight);
+				const __m128 vfirst = _mm_set1_ps(float(first)), vstride = _mm_set1_ps(float(stride));
+				for (; i + 4 <= count; i += 4) {
+					__m128 fi = _mm_add_ps(_mm_set1_ps(float(i)), lane);
+					fi = _mm_add_ps(vfirst, _mm_mul_ps(fi, vstride));
+					__m128 x = _mm_mul_ps(_mm_add_ps(vx0, _mm_mul_ps(fi, vdx)), vs);
+					__m128 ndx, ndz;
+					__m128 n = _mm_mul_ps(noise_grad4(x, r, ndx, ndz), vw);
+					ndx = _mm_mul_ps(ndx, vgw);
+					ndz = _mm_mul_ps(ndz, vgw);
+					if (Accumulate) {
+						n = _mm_add_ps(_mm_loadu_ps(out + i), n);
+						ndx = _mm_add_ps(_mm_loadu_ps(outDx + i), ndx);
+						ndz = _mm_add_ps(_mm_loadu_ps(outDz + i), ndz);
+					}
+					_mm_storeu_ps(out + i, n);
+					_mm_storeu_ps(outDx + i, ndx);
+					_mm_storeu_ps(outDz + i, ndz);
+				}
+			}
+#endif
+			for (; i < count; ++i) {
+				float ndx, ndz;
+				float n = noise_grad_scalar((x0 + float(first + i * stride) * dx) * scale, r, ndx, ndz) * weight;
+				ndx *= gradWeight;
+				ndz *= gradWeight;
+				out[i] = Accumulate ? out[i] + n : n;
+				outDx[i] = Accumulate ? outDx[i] + ndx : ndx;
+				outDz[i] = Accumulate ? outDz[i] + ndz : ndz;
+			}
+		}
+
+		inline void fbm2d_grad_row_impl(float x0, float dx, int first, int stride, float z, int count, float* out,
+			float* outDx, float* outDz, int octaves, float lacunarity, float decay) {
+			std::fill(out, out + count, 0.0f);
+			std::fill(outDx, outDx + count, 0.0f);
+			std::fill(outDz, outDz + count, 0.0f);
+			float amplitude = 1.0f;
+			float frequency = 1.0f;
+			for (int i = 0; i < octaves; ++i) {
+				noise_grad_row_impl<true>(x0, dx, frequency, z, count, amplitude, amplitude * frequency, out, outDx,
+					outDz, first, stride);
+				amplitude *= decay;
+				frequency *= lacunarity;
+			}
+		}
+	}
+
+	// out[i] = noise(x0 + i * dx, z) for i in [0, count)
+	inline void noise_row(float x0, float dx, float z, int count, float* out) {
+		detail::noise_row_impl<false>(x0, dx, 1.0f, z, count, 1.0f, out);
+	}
+
+	// out[i] += noise(x0 + i * dx, z) * weight, the layer accumulation step
+	inline void noise_row_add(float x0, float dx, float z, int count, float weight, float* out) {
+		detail::noise_row_impl<true>(x0, dx, 1.0f, z, count, weight, out);
+	}
+
+	// One octave of fbm2d_row at the given octave frequency, unweighted:
+	// out[i] = noise((x0 + i * dx) * frequency, z * frequency)
+	inline void fbm2d_octave_row(float x0, float dx, float z, float frequency, int count, float* out) {
+		detail::noise_row_impl<false>(x0, dx, frequency, z, count, 1.0f, out);
+	}
+
+	// out[i] = fbm2d(x0 + i * dx, z, ...) for i in [0, count)
+	inline void fbm2d_row(float x0, float dx, float z, int count, float* out,
+		int octaves = 4, float lacunarity = 2.0f, float decay = 0.5f) {
+		std::fill(out, out + count, 0.0f);
+		float amplitude = 1.0f;
+		float frequency = 1.0f;
+		for (int i = 0; i < octaves; ++i) {
+			detail::noise_row_impl<true>(x0, dx, frequency, z, count, amplitude, out);
+			amplitude *= decay;
+			frequency *= lacunarity;
+		}
+	}
+
+
+	//
+	// Strided batch evaluation
+	//
+	// Same as the row functions, but sample i is taken at lattice index
+	// first + i * stride, i.e. x = x0 + (first + i * stride) * dx. Each
+	// sample is bit-identical to the unstrided row's sample at that index,
+	// so a sparse lattice can be filled in later without re-evaluating it.
+	//
+
+	// out[i] = noise(x0 + (first + i * stride) * dx, z)
+	inline void noise_row_strided(float x0, float dx, int first, int stride, float z, int count, float* out) {
+		detail::noise_row_impl<false>(x0, dx, 1.0f, z, count, 1.0f, out, first, stride);
+	}
+
+	// out[i] += noise(x0 + (first + i * stride) * dx, z) * weight
+	inline void noise_row_add_strided(float x0, float dx, int first, int stride, float z, int count, float weight,
+		float* out) {
+		detail::noise_row_impl<true>(x0, dx, 1.0f, z, count, weight, out, first, stride);
+	}
+
+	// out[i] = noise((x0 + (first + i * stride) * dx) * frequency, z * frequency)
+	inline void fbm2d_octave_row_strided(float x0, float dx, int first, int stride, float z, float frequency,
+		int count, float* out) {
+		detail::noise_row_impl<false>(x0, dx, frequency, z, count, 1.0f, out, first, stride);
+	}
+
+	// out[i] = fbm2d(x0 + (first + i * stride) * dx, z, ...)
+	inline void fbm2d_row_strided(float x0, float dx, int first, int stride, float z, int count, float* out,
+		int octaves = 4, float lacunarity = 2.0f, float decay = 0.5f) {
+		std::fill(out, out + count, 0.0f);
+		float amplitude = 1.0f;
+		float frequency = 1.0f;
+		for (int i = 0; i < octaves; ++i) {
+			detail::noise_row_impl<true>(x0, dx, frequency, z, count, amplitude, out, first, stride);
+			amplitude *= decay;
+			frequency *= lacunarity;
+		}
+	}
+
+
+	//
+	// Batch evaluation with gradients
+	//
+	// Same samples as the functions above, plus the analytic gradient
+	// (d/dx, d/dz) of each in outDx/outDz, matching noise(x, z, ddx, ddz) and
+	// fbm2d(x, z, ddx, ddz, ...). Values are bit-identical to the plain row
+	// functions, so the gradient comes at no cost in consistency.
+	//
+
+	// out[i] = noise(x0 + i * dx, z) and its gradient
+	inline void noise_grad_row(float x0, float dx, float z, int count, float* out, float* outDx, float* outDz) {
+		detail::noise_grad_row_impl<false>(x0, dx, 1.0f, z, count, 1.0f, 1.0f, out, outDx, outDz);
+	}
+
+	// One octave of fbm2d_grad_row, unweighted. The gradient is taken at the
+	// octave's argument ((x0 + i * dx) * frequency, z * frequency), so the
+	// octave contributes outDx[i] * amplitude * frequency to the fBm's.
+	inline void fbm2d_octave_grad_row(float x0, float dx, float z, float frequency, int count, float* out,
+		float* outDx, float* outDz) {
+		detail::noise_grad_row_impl<false>(x0, dx, frequency, z, count, 1.0f, 1.0f, out, outDx, outDz);
+	}
+
+	// out[i] = fbm2d(x0 + i * dx, z, ...) and its gradient
+	inline void fbm2d_grad_row(float x0, float dx, float z, int count, float* out, float* outDx, float* outDz,
+		int octaves = 4, float lacunarity = 2.0f, float decay = 0.5f) {
+		detail::fbm2d_grad_row_impl(x0, dx, 0, 1, z, count, out, outDx, outDz, octaves, lacunarity, decay);
+	}
+
+	// out[i] = noise(x0 + (first + i * stride) * dx, z) and its gradient
+	inline void noise_grad_row_strided(float x0, float dx, int first, int stride, float z, int count, float* out,
+		float* outDx, float* outDz) {
+		detail::noise_grad_row_impl<false>(x0, dx, 1.0f, z, count, 1.0f, 1.0f, out, outDx, outDz, first, stride);
+	}
+
+	// out[i] = fbm2d(x0 + (first + i * stride) * dx, z, ...) and its gradient
+	inline void fbm2d_grad_row_strided(float x0, float dx, int first, int stride, float z, int count, float* out,
+		float* outDx, float* outDz, int octaves = 4, float lacunarity = 2.0f, float decay = 0.5f) {
+		detail::fbm2d_grad_row_impl(x0, dx, first, stride, z, count, out, outDx, outDz, octaves, lacunarity, decay);
+	}
+
 }
@@ -0,0 +1,224 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <utility>
+#include <vector>
+
+#include "parallel.hpp"
+
+// Grid-based shallow-water hydraulic erosion (the "virtual pipes" model)
+// layered over a row-major width x depth heightmap, in cell units.
+//
+// Every cell holds a water column connected to its four neighbours by
+// pipes. A step rains on every cell, accelerates the outflow through each
+// pipe by the difference in water surface height, moves the water, derives
+// a velocity field from the flux, dissolves or deposits sediment depending
+// on how much the local flow can carry, advects the sediment with the flow
+// and evaporates some water.
+//
+// State is kept as separate arrays (structure of arrays) and every pass
+// only writes its own cell from values of the previous pass, so each pass
+// runs over rows on any number of threads with identical results. Water,
+// sediment and terrain are double-buffered; the flux is updated in place as
+// a cell only ever reads its own flux while updating it.
+//
+// The state persists between calls to step(), so the simulation can be
+// advanced a few steps per frame.
+class PipeErosion {
+ public:
+  struct Params {
+    float timeStep = 0.02f;
+    float rainRate = 0.012f;  // water per cell per unit time
+    float gravity = 9.81f;
+    float pipeArea = 1.0f;  // pipe cross section over its length
+    float capacity = 0.05f;  // sediment carried per unit speed and tilt
+    float dissolveRate = 0.5f;
+    float depositRate = 1.0f;
+    float evaporationRate = 0.015f;
+    // keeps flat ground from having no capacity at all
+    float minTilt = 0.05f;
+    // capacity ramps up linearly to this water depth, so films of water
+    // with a huge apparent velocity do not carve the terrain
+    float erosionDepth = 0.01f;
+  };
+
+  void setThreadCount(int threads) { threadCount = std::max(0, threads); }
+
+  // Drops all water and sediment
+  void reset() {
+    width = depth = 0;
+    water.clear();
+    sediment.clear();
+  }
+
+  // Advances the simulation `steps` steps, eroding heights in place. The
+  // state is reset if the map size changed since the last call.
+  void step(std::vector<float>& heights, int mapWidth, int mapDepth,
+            const Params& params, int steps = 1) {
+    if (mapWidth < 2 || mapDepth < 2) return;
+    if (mapWidth != width || mapDepth != depth || water.empty())
+      allocate(mapWidth, mapDepth);
+
+    for (int s = 0; s < steps; ++s) {
+      forRows([&](int z) { updateFlux(heights.data(), z, params); });
+      forRows([&](int z) { updateWater(z, params); });
+      std::swap(water, waterNext);
+
+      terrainNext.resize(heights.size());
+      forRows([&](int z) { erode(heights.data(), z, params); });
+      std::swap(heights, terrainNext);
+
+      forRows([&](int z) { advect(z, params); });
+    }
+    stepsRun += steps;
+  }
+
+  const std::vector<float>& getWater() const { return water; }
+  const std::vector<float>& getSediment() const { return sediment; }
+  long long getStepsRun() const { return stepsRun; }
+
+  double totalWater() const {
+    double sum = 0.0;
+    for (float w : water) sum += w;
+    return sum;
+  }
+
+ private:
+  int threadCount = 0;
+  int width = 0, depth = 0;
+  long long stepsRun = 0;
+
+  // water height, double-buffered
+  std::vector<float> water, waterNext;
+  // outflow through the left (-x), right (+x), top (-z) and bottom (+z) pipe
+  std::vector<float> fluxL, fluxR, fluxT, fluxB;
+  std::vector<float> velX, velZ;
+  // suspended sediment, double-buffered through advection
+  std::vector<float> sediment, sedimentNext;
+  std::vector<float> terrainNext;
+
+  void allocate(int w, int d) {
+    width = w;
+    depth = d;
+    stepsRun = 0;
+    const size_t n = size_t(w) * d;
+    for (auto* field : {&water, &waterNext, &fluxL, &fluxR, &fluxT, &fluxB,
+                        &velX, &velZ, &sediment, &sedimentNext})
+      field->assign(n, 0.0f);
+  }
+
+  template <typename Fn>
+  void forRows(Fn&& fn) {
+    parallel::forTiles(0, depth, 16, threadCount, [&](int z0, int z1) {
+      for (int z = z0; z < z1; ++z) fn(z);
+    });
+  }
+
+  // Rain, then accelerate each pipe by the surface height difference and
+  // scale the outflow down so a cell never loses more water than it holds.
+  // Pipes leaving the map never carry water.
+  void updateFlux(const float* b, int z, const Params& p) {
+    const float rain = p.rainRate * p.timeStep;
+    const float accel = p.timeStep * p.pipeArea * p.gravity;
+    for (int x = 0; x < width; ++x) {
+      const int i = z * width + x;
+      const float d = water[i] + rain;
+      // neighbours see the same rain, so it cancels out of the difference
+      const float surface = b[i] + water[i];
+      auto drop = [&](int j) { return surface - (b[j] + water[j]); };
+
+      float l = x > 0 ? std::max(0.0f, fluxL[i] + accel * drop(i - 1)) : 0.0f;
+      float r = x < width - 1 ? std::max(0.0f, fluxR[i] + accel * drop(i + 1))
+                              : 0.0f;
+      float t = z > 0 ? std::max(0.0f, fluxT[i] + accel * drop(i - width))
+                      : 0.0f;
+      float bo = z < depth - 1
+                     ? std::max(0.0f, fluxB[i] + accel * drop(i + width))
+                     : 0.0f;
+
+      const float out = (l + r + t + bo) * p.timeStep;
+      const float k = out > d ? d / out : 1.0f;
+      fluxL[i] = l * k;
+      fluxR[i] = r * k;
+      fluxT[i] = t * k;
+      fluxB[i] = bo * k;
+    }
+  }
+
+  // Moves the water along the pipes and derives the velocity field
+  void updateWater(int z, const Params& p) {
+    const float rain = p.rainRate * p.timeStep;
+    for (int x = 0; x < width; ++x) {
+      const int i = z * width + x;
+      const float inL = x > 0 ? fluxR[i - 1] : 0.0f;
+      const float inR = x < width - 1 ? fluxL[i + 1] : 0.0f;
+      const float inT = z > 0 ? fluxB[i - width] : 0.0f;
+      const float inB = z < depth - 1 ? fluxT[i + width] : 0.0f;
+      const float out = fluxL[i] + fluxR[i] + fluxT[i] + fluxB[i];
+
+      const float before = water[i] + rain;
+      const float after =
+          std::max(0.0f, before + p.timeStep * (inL + inR + inT + inB - out));
+      waterNext[i] = after;
+
+      // average flow through the cell over the mean water height
+      const float mean = 0.5f * (before + after);
+      if (mean > 1e-6f) {
+        velX[i] = 0.5f * (inL - fluxL[i] + fluxR[i] - inR) / mean;
+        velZ[i] = 0.5f * (inT - fluxT[i] + fluxB[i] - inB) / mean;
+      } else {
+        velX[i] = velZ[i] = 0.0f;
+      }
+    }
+  }
+
+  // Dissolves terrain into sediment where the flow could carry more, and
+  // deposits where it carries too much
+  void erode(const float* b, int z, const Params& p) {
+    const int zUp = std::max(z - 1, 0), zDown = std::min(z + 1, depth - 1);
+    for (int x = 0; x < width; ++x) {
+      const int i = z * width + x;
+      const int xL = std::max(x - 1, 0), xR = std::min(x + 1, width - 1);
+      const float gx =
+          (b[z * width + xR] - b[z * width + xL]) / float(std::max(1, xR - xL));
+      const float gz = (b[zDown * width + x] - b[zUp * width + x]) /
+                       float(std::max(1, zDown - zUp));
+      const float slope2 = gx * gx + gz * gz;
+      const float sinTilt =
+          std::max(p.minTilt, std::sqrt(slope2 / (1.0f + slope2)));
+      const float speed = std::sqrt(velX[i] * velX[i] + velZ[i] * velZ[i]);
+      const float depthScale = std::min(1.0f, water[i] / p.erosionDepth);
+      const float capacity = p.capacity * sinTilt * speed * depthScale;
+
+      const float s = sediment[i];
+      if (capacity > s) {
+        const float amount = p.dissolveRate * p.timeStep * (capacity - s);
+        terrainNext[i] = b[i] - amount;
+        sedimentNext[i] = s + amount;
+      } else {
+        const float amount = p.depositRate * p.timeStep * (s - capacity);
+        terrainNext[i] = b[i] + amount;
+        sedimentNext[i] = s - amount;
+      }
+    }
+  }
+
+  // Carries sediment along the velocity field by sampling where it came
+  // from (semi-Lagrangian), then evaporates
+  void advect(int z, const Params& p) {
+    const float keep = std::max(0.0f, 1.0f - p.evaporationRate * p.timeStep);
+    for (int x = 0; x < width; ++x) {
+      const int i = z * width + x;
+      const float sx = glm::clamp(x - velX[i] * p.timeStep, 0.0f, width - 1.0f);
+      const float sz = glm::clamp(z - velZ[i] * p.timeStep, 0.0f, depth - 1.0f);
+      const int x0 = std::min(int(sx), width - 2);
+      const int z0 = std::min(int(sz), depth - 2);
+      const float fx = sx - x0, fz = sz - z0;
+      const float* s = &sedimentNext[size_t(z0) * width + x0];
+      sediment[i] = (s[0] * (1 - fx) + s[1] * fx) * (1 - fz) +
+                    (s[width] * (1 - fx) + s[width + 1] * fx) * fz;
+      water[i] *= keep;
+    }
+  }
+};
@@ -0,0 +1,198 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "frustum.hpp"
+
+// Uniform grid over a set of points in the xz plane, for the per-frame
+// queries on large instance sets such as the LOD trees.
+//
+// build() buckets the points with a counting sort, so every cell's points
+// are one contiguous range of getOrder() and getPoints(), and a query hands
+// out whole cells at a time. Callers that keep per-point data in the same
+// order (see lod::level_of_detail) walk a cell's points without
+// indirection. Each cell keeps two boxes: the extent of its points, for
+// distance tests, and that extent padded by the instances' size, for
+// culling. Queries skip empty cells and only look at individual points in
+// cells a query boundary passes through.
+class SpatialGrid {
+ public:
+  struct Cell {
+    int first = 0, count = 0;  // range of getOrder() and getPoints()
+    Aabb extent;               // the points themselves
+    Aabb bounds;               // extent grown by the build padding
+  };
+
+  // Buckets points into cellsX x cellsZ cells over their xz extent.
+  // padding is how far an instance reaches from its point (x, y and z up,
+  // with x and z also reaching down).
+  void build(const std::vector<glm::vec3>& points, int cellsX, int cellsZ,
+             glm::vec3 padding = glm::vec3(0.0f)) {
+    countX = std::max(1, cellsX);
+    countZ = std::max(1, cellsZ);
+    cells.assign(size_t(countX) * countZ, Cell());
+    order.resize(points.size());
+    sorted.resize(points.size());
+    nonEmpty.clear();
+
+    origin = glm::vec2(0.0f);
+    glm::vec2 far(0.0f);
+    if (!points.empty()) {
+      origin = glm::vec2(std::numeric_limits<float>::max());
+      far = glm::vec2(std::numeric_limits<float>::lowest());
+      for (const glm::vec3& p : points) {
+        origin = glm::min(origin, glm::vec2(p.x, p.z));
+        far = glm::max(far, glm::vec2(p.x, p.z));
+      }
+    }
+    // cells slightly larger than the extent / count, so the far edge
+    // still falls in the last cell
+    cellSize = glm::max((far - origin) / glm::vec2(countX, countZ) * 1.0001f,
+                        glm::vec2(1e-6f));
+
+    std::vector<int> cellIndex(points.size());
+    for (size_t i = 0; i < points.size(); ++i) {
+      cellIndex[i] = cellOf(points[i]);
+      ++cells[cellIndex[i]].count;
+    }
+    int first = 0;
+    for (Cell& cell : cells) {
+      cell.first = first;
+      first += cell.count;
+      cell.count = 0;
+      cell.extent.min = glm::vec3(std::numeric_limits<float>::max());
+      cell.extent.max = glm::vec3(std::numeric_limits<float>::lowest());
+    }
+    for (size_t i = 0; i < points.size(); ++i) {
+      Cell& cell = cells[cellIndex[i]];
+      sorted[cell.first + cell.count] = points[i];
+      order[cell.first + cell.count++] = int(i);
+      cell.extent.min = glm::min(cell.extent.min, points[i]);
+      cell.extent.max = glm::max(cell.extent.max, points[i]);
+    }
+    for (size_t c = 0; c < cells.size(); ++c) {
+      Cell& cell = cells[c];
+      if (cell.count == 0) continue;
+      cell.bounds.min = cell.extent.min - glm::vec3(padding.x, 0.0f, padding.z);
+      cell.bounds.max = cell.extent.max + padding;
+      nonEmpty.push_back(int(c));
+    }
+  }
+
+  // Cells a side for n points spread evenly over a square, about
+  // pointsPerCell to a cell
+  static int cellsPerSide(size_t n, int pointsPerCell = 64,
+                          int maxCells = 256) {
+    return std::clamp(int(std::sqrt(double(n) / pointsPerCell)), 1,
+                      maxCells);
+  }
+
+  int getCellsX() const { return countX; }
+  int getCellsZ() const { return countZ; }
+  const std::vector<Cell>& getCells() const { return cells; }
+  int getNonEmptyCount() const { return int(nonEmpty.size()); }
+  // Point indices, grouped by cell
+  const std::vector<int>& getOrder() const { return order; }
+  // The points in the same order
+  const std::vector<glm::vec3>& getPoints() const { return sorted; }
+
+  // Cell holding a point of the build extent (points outside are clamped)
+  int cellOf(const glm::vec3& p) const {
+    const int x = std::clamp(int((p.x - origin.x) / cellSize.x), 0, countX - 1);
+    const int z = std::clamp(int((p.z - origin.y) / cellSize.y), 0, countZ - 1);
+    return z * countX + x;
+  }
+
+  // Appends the non-empty cells whose padded bounds intersect the frustum,
+  // in ascending order
+  void queryFrustum(const Frustum& frustum, std::vector<int>& out) const {
+    for (int c : nonEmpty)
+      if (frustum.intersects(cells[c].bounds)) out.push_back(c);
+  }
+
+  // Calls fn(point index) for every point within radius of center
+  template <typename Fn>
+  void queryRadius(glm::vec3 center, float radius, Fn&& fn) const {
+    const float radius2 = radius * radius;
+    const int x0 = cellX(center.x - radius), x1 = cellX(center.x + radius);
+    const int z0 = cellZ(center.z - radius), z1 = cellZ(center.z + radius);
+    for (int z = z0; z <= z1; ++z) {
+      for (int x = x0; x <= x1; ++x) {
+        const Cell& cell = cells[size_t(z) * countX + x];
+        if (cell.count == 0 || minDistance2(cell.extent, center) > radius2)
+          continue;
+        const bool inside = maxDistance2(cell.extent, center) <= radius2;
+        for (int k = cell.first; k < cell.first + cell.count; ++k) {
+          const glm::vec3 d = sorted[k] - center;
+          if (inside || glm::dot(d, d) <= radius2) fn(order[k]);
+        }
+      }
+    }
+  }
+
+  // Appends the non-empty cells, in ascending order, whose points may have
+  // a different level at newCenter/newThresholds than at
+  // oldCenter/oldThresholds. A point's level is the number of thresholds
+  // at or below its distance to the center (the thresholds ascending).
+  // Every point of a cell left out keeps its level, so reclassifying the
+  // points of these cells brings a classification up to date.
+  void queryChanged(glm::vec3 oldCenter,
+                    const std::vector<float>& oldThresholds,
+                    glm::vec3 newCenter,
+                    const std::vector<float>& newThresholds,
+                    std::vector<int>& out) const {
+    for (int c : nonEmpty) {
+      const Aabb& box = cells[c].extent;
+      const int oldNear = level(std::sqrt(minDistance2(box, oldCenter)),
+                                oldThresholds);
+      const int oldFar = level(std::sqrt(maxDistance2(box, oldCenter)),
+                               oldThresholds);
+      const int newNear = level(std::sqrt(minDistance2(box, newCenter)),
+                                newThresholds);
+      const int newFar = level(std::sqrt(maxDistance2(box, newCenter)),
+                               newThresholds);
+      if (oldNear != oldFar || newNear != newFar || oldNear != newNear)
+        out.push_back(c);
+    }
+  }
+
+  // Number of thresholds at or below distance
+  static int level(float distance, const std::vector<float>& thresholds) {
+    return int(std::upper_bound(thresholds.begin(), thresholds.end(),
+                                distance) -
+               thresholds.begin());
+  }
+
+  // Squared distances from p to the nearest and furthest point of box
+  static float minDistance2(const Aabb& box, glm::vec3 p) {
+    const glm::vec3 d =
+        glm::max(glm::max(box.min - p, p - box.max), glm::vec3(0.0f));
+    return glm::dot(d, d);
+  }
+  static float maxDistance2(const Aabb& box, glm::vec3 p) {
+    const glm::vec3 d = glm::max(glm::abs(p - box.min), glm::abs(p - box.max));
+    return glm::dot(d, d);
+  }
+
+ private:
+  int countX = 1, countZ = 1;
+  glm::vec2 origin{0.0f};
+  glm::vec2 cellSize{1.0f};
+  std::vector<Cell> cells;
+  std::vector<int> order;
+  std::vector<glm::vec3> sorted;  // points[order[k]]
+  std::vector<int> nonEmpty;  // cell indices, ascending
+
+  int cellX(float x) const {
+    return std::clamp(int(std::floor((x - origin.x) / cellSize.x)), 0,
+                      countX - 1);
+  }
+  int cellZ(float z) const {
+    return std::clamp(int(std::floor((z - origin.y) / cellSize.y)), 0,
+                      countZ - 1);
+  }
+};
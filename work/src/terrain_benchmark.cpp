@@ -0,0 +1,716 @@
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+
+// glm
+#include <glm/gtc/matrix_transform.hpp>
+
+// project
+#include "cdlod_quadtree.hpp"
+#include "lod_selector.hpp"
+#include "spatial_grid.hpp"
+#include "terrain_benchmark.hpp"
+#include "tin_builder.hpp"
+#include "vegetation_scatter.hpp"
+
+using namespace std;
+
+namespace benchmark {
+
+namespace {
+
+// milliseconds taken by fn(), best of `runs`
+template <typename Fn>
+double timeMs(Fn&& fn, int runs = 3) {
+  double best = 1e30;
+  for (int i = 0; i < runs; ++i) {
+    auto start = chrono::steady_clock::now();
+    fn();
+    auto end = chrono::steady_clock::now();
+    best = min(best,
+               chrono::duration<double, milli>(end - start).count());
+  }
+  return best;
+}
+
+bool sameBits(const vector<float>& a, const vector<float>& b) {
+  return a.size() == b.size() &&
+         memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+}
+
+// distance between two floats in units in the last place
+int64_t ulpDistance(float a, float b) {
+  int32_t ia, ib;
+  memcpy(&ia, &a, sizeof(float));
+  memcpy(&ib, &b, sizeof(float));
+  // map to a monotonic integer line so +0/-0 are adjacent
+  int64_t la = ia < 0 ? int64_t(INT32_MIN) - ia : ia;
+  int64_t lb = ib < 0 ? int64_t(INT32_MIN) - ib : ib;
+  return la > lb ? la - lb : lb - la;
+}
+
+// default base fBm on a size x size map, built without a generator so no
+// caches are allocated
+vector<float> defaultBaseMap(int size) {
+  using Params = HeightmapGenerator::DefaultParams;
+  vector<float> heights(size_t(size) * size);
+  parallel::forTiles(0, size, 16, 0, [&](int z0, int z1) {
+    for (int z = z0; z < z1; ++z) {
+      float* row = &heights[size_t(z) * size];
+      perlin::fbm2d_row(0.0f, Params::FREQUENCY, z * Params::FREQUENCY, size,
+                        row, Params::OCTAVES, Params::LACUNARITY,
+                        Params::GAIN);
+      for (int x = 0; x < size; ++x) row[x] *= Params::AMPLITUDE;
+    }
+  });
+  return heights;
+}
+
+// n trees scattered over the 20 x 20 LOD area on rolling ground, so
+// neighbouring trees stand at similar heights
+vector<glm::vec3> scatterTrees(int n) {
+  mt19937 rng(7);
+  uniform_real_distribution<float> xz(-10.0f, 10.0f);
+  vector<glm::vec3> trees(n);
+  for (glm::vec3& p : trees) {
+    p.x = xz(rng);
+    p.z = xz(rng);
+    p.y = 2.0f * sin(p.x * 0.5f) * cos(p.z * 0.4f);
+  }
+  return trees;
+}
+
+// the application's default orbit camera, 20 units out
+glm::mat4 defaultView() {
+  return glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -20.0f)) *
+         glm::rotate(glm::mat4(1.0f), 0.86f, glm::vec3(1.0f, 0.0f, 0.0f)) *
+         glm::rotate(glm::mat4(1.0f), -0.86f, glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+}  // namespace
+
+void regenerateScaling(const HeightmapGenerator& terrain, int maxThreads) {
+  maxThreads = parallel::resolveThreads(maxThreads);
+
+  HeightmapGenerator gen = terrain;
+  gen.setLayerCaching(false);  // time full evaluations
+  gen.setThreadCount(1);
+  gen.regenerate();
+  const vector<float> reference = gen.getHeights();
+
+  cout << "regenerate() scaling on " << gen.getWidth() << "x"
+       << gen.getDepth() << " (" << parallel::hardwareThreads()
+       << " hardware threads)" << endl;
+  cout << " threads       ms  speedup  identical" << endl;
+
+  double serialMs = 0.0;
+  for (int t = 1; t <= maxThreads; ++t) {
+    gen.setThreadCount(t);
+    double ms = timeMs([&]() { gen.regenerate(); });
+    if (t == 1) serialMs = ms;
+    cout << setw(8) << t << setw(9) << fixed << setprecision(1) << ms
+         << setw(8) << setprecision(2) << serialMs / ms << "x"
+         << setw(11) << (sameBits(gen.getHeights(), reference) ? "yes" : "NO")
+         << endl;
+  }
+}
+
+int noiseBatchParity(int rows, int rowLength) {
+  const int octaves = HeightmapGenerator::DefaultParams::OCTAVES;
+  const float lacunarity = HeightmapGenerator::DefaultParams::LACUNARITY;
+  const float gain = HeightmapGenerator::DefaultParams::GAIN;
+
+  mt19937 rng(350);
+  uniform_real_distribution<float> coord(-5000.0f, 5000.0f);
+  uniform_real_distribution<float> step(0.0001f, 0.5f);
+  struct Row {
+    float x0, dx, z;
+  };
+  vector<Row> samples(rows);
+  for (auto& r : samples) r = {coord(rng), step(rng), coord(rng)};
+
+  vector<float> scalar(size_t(rows) * rowLength);
+  vector<float> batch(scalar.size());
+
+  double scalarMs = timeMs([&]() {
+    for (int r = 0; r < rows; ++r) {
+      const Row& s = samples[r];
+      for (int i = 0; i < rowLength; ++i)
+        scalar[size_t(r) * rowLength + i] = perlin::fbm2d(
+            s.x0 + float(i) * s.dx, s.z, octaves, lacunarity, gain);
+    }
+  });
+  double batchMs = timeMs([&]() {
+    for (int r = 0; r < rows; ++r) {
+      const Row& s = samples[r];
+      perlin::fbm2d_row(s.x0, s.dx, s.z, rowLength,
+                        &batch[size_t(r) * rowLength], octaves, lacunarity,
+                        gain);
+    }
+  });
+
+  int64_t maxUlp = 0;
+  for (size_t i = 0; i < scalar.size(); ++i)
+    maxUlp = max(maxUlp, ulpDistance(scalar[i], batch[i]));
+
+  // plain noise rows go through the same kernels with a single octave
+  for (int r = 0; r < rows; ++r) {
+    const Row& s = samples[r];
+    perlin::noise_row(s.x0, s.dx, s.z, rowLength, batch.data());
+    for (int i = 0; i < rowLength; ++i)
+      maxUlp = max(maxUlp, ulpDistance(perlin::noise(s.x0 + float(i) * s.dx,
+                                                     s.z),
+                                       batch[i]));
+  }
+
+  // the gradient kernels, against the scalar fbm2d with gradient
+  vector<float> batchDx(rowLength), batchDz(rowLength);
+  for (int r = 0; r < rows; ++r) {
+    const Row& s = samples[r];
+    perlin::fbm2d_grad_row(s.x0, s.dx, s.z, rowLength, batch.data(),
+                           batchDx.data(), batchDz.data(), octaves,
+                           lacunarity, gain);
+    for (int i = 0; i < rowLength; ++i) {
+      float ddx, ddz;
+      const float value = perlin::fbm2d(s.x0 + float(i) * s.dx, s.z, ddx,
+                                        ddz, octaves, lacunarity, gain);
+      maxUlp = max({maxUlp, ulpDistance(value, batch[i]),
+                    ulpDistance(ddx, batchDx[i]),
+                    ulpDistance(ddz, batchDz[i])});
+    }
+  }
+
+  cout << "fbm2d batch vs scalar (" << scalar.size() << " samples, "
+       << octaves << " octaves): scalar " << fixed << setprecision(1)
+       << scalarMs << " ms, batch " << batchMs << " ms ("
+       << setprecision(2) << scalarMs / batchMs << "x), max error " << maxUlp
+       << " ULP" << (maxUlp == 0 ? "" : "  <-- MISMATCH") << endl;
+  return int(min<int64_t>(maxUlp, INT32_MAX));
+}
+
+float normalPacking(int normals) {
+  mt19937 rng(14);
+  normal_distribution<float> gauss;
+  vector<glm::vec3> dirs = {{0, 1, 0},  {0, -1, 0}, {1, 0, 0},
+                            {-1, 0, 0}, {0, 0, 1},  {0, 0, -1}};
+  for (int i = 0; i < 64; ++i) {
+    const float a = 6.2831853f * float(i) / 64.0f;
+    dirs.push_back({cos(a), 0.0f, sin(a)});
+  }
+  while (int(dirs.size()) < normals) {
+    const glm::vec3 d(gauss(rng), gauss(rng), gauss(rng));
+    if (glm::dot(d, d) > 1e-6f) dirs.push_back(glm::normalize(d));
+  }
+
+  double worst = 0.0;
+  for (const glm::vec3& n : dirs) {
+    int16_t packed[2];
+    TerrainMesh::packNormal(n, packed);
+    const glm::vec3 back = TerrainMesh::unpackNormal(packed);
+    // angle from the chord: acos of the dot product loses precision near 1
+    const double chord = glm::length(glm::dvec3(n) - glm::dvec3(back));
+    worst = max(worst, 2.0 * asin(min(1.0, chord * 0.5)));
+  }
+  const float degrees = float(worst * 180.0 / 3.14159265358979);
+  cout << "normal packing round trip on " << dirs.size()
+       << " unit normals: worst error " << fixed << setprecision(4)
+       << degrees << " degrees" << endl;
+  return degrees;
+}
+
+void fusedEvaluation(const HeightmapGenerator& terrain) {
+  HeightmapGenerator multi = terrain;
+  HeightmapGenerator fused = terrain;
+  multi.setLayerCaching(false);
+  fused.setLayerCaching(false);
+  multi.setFusedEvaluation(false);
+  fused.setFusedEvaluation(true);
+
+  double multiMs = timeMs([&]() { multi.regenerate(); });
+  double fusedMs = timeMs([&]() { fused.regenerate(); });
+
+  // Modelled, not measured, main-memory traffic per regenerate, assuming a
+  // grid much larger than the caches: multi-pass writes the base layer's
+  // heights and gradients, then reads and writes all three once per extra
+  // layer. The fused sweep writes them once.
+  const double cells = double(terrain.getWidth()) * terrain.getDepth();
+  const double layers = double(fused.getLayers().size());
+  const double mb = 3.0 * cells * sizeof(float) / (1024.0 * 1024.0);
+  const double multiMb = mb * (1.0 + 2.0 * layers);
+  const double fusedMb = mb;
+
+  cout << "regenerate() with " << layers << " extra layers on "
+       << terrain.getWidth() << "x" << terrain.getDepth() << ":" << endl;
+  cout << fixed << setprecision(1) << "  multi-pass " << multiMs
+       << " ms, modelled traffic ~" << multiMb << " MB" << endl;
+  cout << "  fused      " << fusedMs << " ms, modelled traffic ~" << fusedMb
+       << " MB (" << setprecision(2) << multiMb / fusedMb
+       << "x less by the model, " << multiMs / fusedMs
+       << "x faster measured), identical: "
+       << (sameBits(multi.getHeights(), fused.getHeights()) &&
+                   sameBits(multi.getGradientX(), fused.getGradientX()) &&
+                   sameBits(multi.getGradientZ(), fused.getGradientZ())
+               ? "yes"
+               : "NO")
+       << endl;
+}
+
+void erosionTiling(int iterations, vector<int> sizes) {
+  ThermalErosion::Params params;
+  params.iterations = iterations;
+  params.reposeAngleDeg = 50.0f;
+
+  cout << "thermal erosion, " << iterations << " iterations, tiles of "
+       << params.tileSize << " x " << params.tileSteps
+       << " steps (traffic figures are a model, not measured)" << endl;
+  for (int size : sizes) {
+    const vector<float> start = defaultBaseMap(size);
+    ThermalErosion erosion;
+    vector<float> dense = start;
+    double denseMs = timeMs([&]() { erosion.run(dense, size, size, params); },
+                            1);
+    vector<float> blocked = start;
+    double blockedMs = timeMs(
+        [&]() { erosion.runBlocked(blocked, size, size, params); }, 1);
+
+    // modelled, not measured, traffic: every dense iteration reads and
+    // writes the map; every blocked pass reads each tile with its halo and
+    // writes the tile once
+    const double mb = double(size) * size * sizeof(float) / (1024.0 * 1024.0);
+    const double halo = double(params.tileSize + 2 * params.tileSteps) /
+                        params.tileSize;
+    const int passes =
+        (iterations + params.tileSteps - 1) / params.tileSteps;
+    const double denseMb = mb * 2.0 * iterations;
+    const double blockedMb = mb * (halo * halo + 1.0) * passes;
+
+    cout << "  " << size << "x" << size << fixed << setprecision(1)
+         << ": dense " << denseMs << " ms (model ~" << denseMb
+         << " MB), blocked " << blockedMs << " ms (model ~" << blockedMb
+         << " MB), " << setprecision(2) << denseMs / blockedMs
+         << "x faster measured, identical: "
+         << (sameBits(dense, blocked) ? "yes" : "NO") << endl;
+  }
+}
+
+void dropletErosion(int droplets, int size) {
+  const vector<float> start = defaultBaseMap(size);
+  HydraulicErosion::Params params;
+  params.droplets = droplets;
+
+  HydraulicErosion erosion;
+  erosion.setThreadCount(1);
+  vector<float> serial = start;
+  double serialMs =
+      timeMs([&]() { erosion.run(serial, size, size, params); }, 1);
+
+  erosion.setThreadCount(0);
+  vector<float> threaded = start;
+  double threadedMs =
+      timeMs([&]() { erosion.run(threaded, size, size, params); }, 1);
+
+  double moved = 0.0;
+  for (size_t i = 0; i < start.size(); ++i)
+    moved += fabs(threaded[i] - start[i]);
+
+  cout << "droplet erosion, " << droplets << " droplets on " << size << "x"
+       << size << fixed << setprecision(1) << ": 1 thread " << serialMs
+       << " ms, " << parallel::hardwareThreads() << " threads " << threadedMs
+       << " ms (" << setprecision(2) << serialMs / threadedMs
+       << "x), total height change " << moved << ", identical: "
+       << (sameBits(serial, threaded) ? "yes" : "NO") << endl;
+}
+
+void meshRegenLoop(const HeightmapGenerator& terrain, TerrainMesh& mesh,
+                   int iterations) {
+  HeightmapGenerator copy = terrain;
+  const int strides[] = {1, HeightmapGenerator::PREVIEW_STRIDE};
+
+  // one warm-up round so both grid sizes have their buffers
+  for (int stride : strides) mesh.update(copy, stride);
+  while (glGetError() != GL_NO_ERROR) {
+  }
+
+  const GLuint vbo = mesh.getVertexBuffer();
+  const int allocations = mesh.getAllocations();
+  const int indexBuilds = mesh.getIndexBuilds();
+  GLint vidmemBefore = 0, vidmemAfter = 0;
+  if (GLEW_NVX_gpu_memory_info)
+    glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX,
+                  &vidmemBefore);
+
+  double regenMs = 0.0, buildMs = 0.0, uploadMs = 0.0;
+  int uploads = 0;
+  for (int i = 0; i < iterations; ++i) {
+    regenMs += timeMs([&]() { copy.regenerate(); }, 1);
+    for (int stride : strides) {
+      mesh.update(copy, stride);
+      buildMs += mesh.getLastBuildMs();
+      uploadMs += mesh.getLastUploadMs();
+      ++uploads;
+    }
+  }
+  glFinish();
+
+  GLint bufferSize = 0;
+  glBindBuffer(GL_ARRAY_BUFFER, mesh.getVertexBuffer());
+  glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &bufferSize);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  const bool stable = mesh.getVertexBuffer() == vbo &&
+                      mesh.getAllocations() == allocations &&
+                      mesh.getIndexBuilds() == indexBuilds &&
+                      size_t(bufferSize) == mesh.getVertexBytes();
+  const GLenum error = glGetError();
+
+  cout << "mesh regeneration loop, " << iterations << " x "
+       << copy.getWidth() << "x" << copy.getDepth() << fixed
+       << setprecision(2) << ": regenerate " << regenMs / iterations
+       << " ms, vertex build " << buildMs / uploads << " ms, upload "
+       << uploadMs / uploads << " ms per update, vertices "
+       << mesh.getVertexBytes() / (1024.0 * 1024.0) << " MB, height texture "
+       << mesh.getTextureBytes() / (1024.0 * 1024.0)
+       << " MB, buffers stable: " << (stable ? "yes" : "NO")
+       << ", GL error: " << (error == GL_NO_ERROR ? "none" : "YES");
+  if (GLEW_NVX_gpu_memory_info) {
+    glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX,
+                  &vidmemAfter);
+    cout << ", free video memory change " << (vidmemAfter - vidmemBefore)
+         << " KB";
+  }
+  cout << endl;
+}
+
+void cdlodBudget(vector<int> sizes) {
+  CdlodQuadtree::Settings settings;
+  // looking across the map from above its first corner, as the app does
+  const glm::vec3 camera = settings.offset + glm::vec3(4.0f, 6.0f, 4.0f);
+  const glm::mat4 viewProj =
+      glm::perspective(1.0f, 16.0f / 9.0f, 0.1f, 1000.0f) *
+      glm::lookAt(camera, camera + glm::vec3(1.0f, -0.4f, 1.0f),
+                  glm::vec3(0, 1, 0));
+  const Frustum frustum(viewProj);
+  const int quadrantTriangles =
+      CdlodQuadtree::GRID * CdlodQuadtree::GRID / 2;
+
+  for (int size : sizes) {
+    const vector<float> heights = defaultBaseMap(size);
+    CdlodQuadtree quadtree;
+    double buildMs = timeMs([&]() { quadtree.build(heights, size, size); }, 1);
+
+    vector<CdlodQuadtree::Node> nodes;
+    int culled = 0;
+    double selectMs = timeMs([&]() {
+      nodes.clear();
+      culled = quadtree.select(camera, frustum, settings, nodes);
+    });
+    long long triangles = 0;
+    for (const CdlodQuadtree::Node& node : nodes) {
+      int quadrants = 0;
+      for (int q = 0; q < 4; ++q) quadrants += (node.quadrants >> q) & 1;
+      triangles += (long long)quadrants * quadrantTriangles;
+    }
+    const long long full = 2LL * (size - 1) * (size - 1);
+
+    cout << "CDLOD " << size << "x" << size << ", "
+         << quadtree.getLevelCount() << " levels" << fixed
+         << setprecision(2) << ": pyramid " << buildMs << " ms, select "
+         << selectMs << " ms, " << nodes.size() << " nodes (" << culled
+         << " culled), " << triangles << " triangles vs " << full
+         << " at full resolution" << endl;
+  }
+}
+
+void tinReduction(vector<float> maxErrors) {
+  const int size = 1024;
+  const vector<float> heights = defaultBaseMap(size);
+  const long long full = 2LL * (size - 1) * (size - 1);
+
+  for (float maxError : maxErrors) {
+    TinBuilder builder;
+    const TinBuilder::Result tin =
+        builder.build(heights, size, size, maxError);
+
+    // interpolate every sample in its triangle: the largest error must stay
+    // within the bound, and the triangles must cover the map exactly once
+    double measured = 0.0;
+    long long covered = 0;
+    for (const glm::ivec3& t : tin.triangles) {
+      const glm::ivec2 p[3] = {tin.vertices[t.x], tin.vertices[t.y],
+                               tin.vertices[t.z]};
+      const double area = double(p[1].x - p[0].x) * (p[2].y - p[0].y) -
+                          double(p[1].y - p[0].y) * (p[2].x - p[0].x);
+      covered -= (long long)area;  // twice the area, wound clockwise
+      const int x0 = min({p[0].x, p[1].x, p[2].x});
+      const int x1 = max({p[0].x, p[1].x, p[2].x});
+      const int z0 = min({p[0].y, p[1].y, p[2].y});
+      const int z1 = max({p[0].y, p[1].y, p[2].y});
+      for (int z = z0; z <= z1; ++z) {
+        for (int x = x0; x <= x1; ++x) {
+          double w[3];
+          for (int i = 0; i < 3; ++i) {
+            const glm::ivec2 a = p[(i + 1) % 3], b = p[(i + 2) % 3];
+            w[i] = (double(b.x - a.x) * (z - a.y) -
+                    double(b.y - a.y) * (x - a.x)) /
+                   area;
+          }
+          if (w[0] < 0.0 || w[1] < 0.0 || w[2] < 0.0) continue;
+          double h = 0.0;
+          for (int i = 0; i < 3; ++i)
+            h += w[i] * heights[size_t(p[i].y) * size + p[i].x];
+          measured =
+              max(measured, abs(heights[size_t(z) * size + x] - h));
+        }
+      }
+    }
+
+    const bool ok = measured <= maxError + 1e-6 && covered == full;
+    cout << "TIN " << size << "x" << size << fixed << setprecision(3)
+         << ", max error " << maxError << ": " << tin.vertices.size()
+         << " vertices, " << tin.triangles.size() << " triangles ("
+         << setprecision(1) << double(full) / tin.triangles.size()
+         << "x fewer) in " << tin.buildMs << " ms, measured error "
+         << setprecision(4) << measured << (ok ? "" : "  <-- MISMATCH")
+         << endl;
+  }
+}
+
+void treeGrid(vector<int> sizes) {
+  const vector<float> thresholds = {10.0f};
+  // the LOD target's default position and a small step of the moving one
+  const glm::vec3 target(0.0f, 3.0f, 0.0f), moved(0.5f, 3.0f, 0.2f);
+  const float radius = 3.0f;
+  const glm::vec3 reach(0.5f, 1.5f, 0.5f);
+  const glm::mat4 proj =
+      glm::perspective(1.0f, 16.0f / 9.0f, 0.1f, 1000.0f);
+  const Frustum frustum(proj * defaultView());
+
+  cout << "Tree grid queries against linear scans\n";
+  for (int n : sizes) {
+    const vector<glm::vec3> trees = scatterTrees(n);
+
+    SpatialGrid grid;
+    const int side = SpatialGrid::cellsPerSide(trees.size());
+    const double buildMs =
+        timeMs([&] { grid.build(trees, side, side, reach); });
+    const auto& cells = grid.getCells();
+    const auto& order = grid.getOrder();
+    const auto& sorted = grid.getPoints();
+
+    // frustum: a linear scan tests every tree's box, the grid every cell's
+    vector<int> visible;
+    size_t scanVisible = 0, gridTrees = 0;
+    const double scanFrustumMs = timeMs([&] {
+      scanVisible = 0;
+      for (const glm::vec3& p : trees)
+        scanVisible += frustum.intersects(
+            {p - glm::vec3(reach.x, 0.0f, reach.z), p + reach});
+    });
+    const double gridFrustumMs = timeMs([&] {
+      visible.clear();
+      grid.queryFrustum(frustum, visible);
+      gridTrees = 0;
+      for (int c : visible) gridTrees += cells[c].count;
+    });
+    // every tree the scan keeps must be in a visible cell
+    vector<char> inVisible(cells.size(), 0);
+    for (int c : visible) inVisible[c] = 1;
+    bool frustumOk = true;
+    for (const glm::vec3& p : trees) {
+      if (frustum.intersects({p - glm::vec3(reach.x, 0.0f, reach.z),
+                              p + reach}) &&
+          !inVisible[grid.cellOf(p)])
+        frustumOk = false;
+    }
+
+    size_t scanNear = 0, gridNear = 0;
+    const double scanRadiusMs = timeMs([&] {
+      scanNear = 0;
+      for (const glm::vec3& p : trees)
+        scanNear += glm::dot(p - target, p - target) <= radius * radius;
+    });
+    const double gridRadiusMs = timeMs([&] {
+      gridNear = 0;
+      grid.queryRadius(target, radius, [&](int) { ++gridNear; });
+    });
+
+    // LOD levels after the move: every tree against the changed cells,
+    // with the levels kept in the grid's order as level_of_detail does
+    auto level = [&](const glm::vec3& p, glm::vec3 center) {
+      return SpatialGrid::level(glm::distance(center, p), thresholds);
+    };
+    vector<int> full(n), partial(n);
+    for (int k = 0; k < n; ++k) partial[k] = level(sorted[k], target);
+    const double fullMs = timeMs([&] {
+      for (int i = 0; i < n; ++i) full[i] = level(trees[i], moved);
+    });
+    bool lodOk = true;
+    size_t touched = 0;
+    vector<int> changed;
+    // repeated runs redo the same update, so partial stays correct
+    const double changedMs = timeMs([&] {
+      changed.clear();
+      grid.queryChanged(target, thresholds, moved, thresholds, changed);
+      touched = 0;
+      for (int c : changed) {
+        for (int k = cells[c].first; k < cells[c].first + cells[c].count; ++k)
+          partial[k] = level(sorted[k], moved);
+        touched += cells[c].count;
+      }
+    });
+
+    for (int k = 0; k < n; ++k) lodOk &= partial[k] == full[order[k]];
+
+    cout << "  " << n << " trees, " << side << "x" << side << " cells"
+         << fixed << setprecision(3) << ": build " << buildMs << " ms\n"
+         << "    frustum: scan " << scanFrustumMs << " ms, grid "
+         << gridFrustumMs << " ms (" << visible.size() << "/"
+         << grid.getNonEmptyCount() << " cells, " << gridTrees << " trees for "
+         << scanVisible << " visible)" << (frustumOk ? "" : "  MISMATCH")
+         << "\n"
+         << "    radius " << radius << ": scan " << scanRadiusMs
+         << " ms, grid " << gridRadiusMs << " ms (" << gridNear << " trees)"
+         << (gridNear == scanNear ? "" : "  MISMATCH") << "\n"
+         << "    LOD update: every tree " << fullMs << " ms, changed cells "
+         << changedMs << " ms (" << touched << " trees touched)"
+         << (lodOk ? "" : "  MISMATCH") << "\n";
+  }
+}
+
+void lodSelection(int trees, int frames) {
+  const vector<glm::vec3> positions = scatterTrees(trees);
+  const glm::mat4 proj =
+      glm::perspective(1.0f, 16.0f / 9.0f, 0.1f, 1000.0f);
+  const float viewportHeight = 720.0f;
+  // a 4-level chain, errors in world units
+  const vector<float> errors = {0.0f, 0.02f, 0.03f, 0.04f};
+
+  LodSelector selector;
+  selector.setErrors(errors);
+  selector.setHysteresis(0.1f);
+  selector.setCamera(defaultView(), proj, viewportHeight);
+
+  // batch against scalar from no level (reruns of the batch start from
+  // its own levels, which select the same again)
+  vector<int> scalar(trees, -1), batch(trees, -1);
+  const double scalarMs = timeMs([&] {
+    for (int i = 0; i < trees; ++i) scalar[i] = selector.select(positions[i], -1);
+  });
+  const double batchMs = timeMs(
+      [&] { selector.selectBatch(positions.data(), trees, batch.data()); });
+  bool same = scalar == batch;
+  vector<int> histogram(errors.size(), 0);
+  for (int level : batch) ++histogram[level];
+
+  // a camera hovering in place: every frame nudges the eye a little
+  // forwards and back, as a hand on the mouse does, and counts the trees
+  // whose level changes with and without hysteresis
+  const glm::vec3 eye = glm::vec3(glm::inverse(defaultView())[3]);
+  const glm::vec3 forward = -glm::normalize(eye);
+  cout << "LOD selection for " << trees << " trees, " << errors.size()
+       << " levels" << fixed << setprecision(3) << ":\n"
+       << "  scalar " << scalarMs << " ms, SSE2 batch " << batchMs << " ms ("
+       << (same ? "identical" : "MISMATCH") << "), levels";
+  for (int count : histogram) cout << " " << count;
+  cout << "\n";
+  for (float hysteresis : {0.0f, 0.05f, 0.1f}) {
+    selector.setHysteresis(hysteresis);
+    selector.setCamera(eye, proj, viewportHeight);
+    vector<int> levels(trees, -1), check;
+    selector.selectBatch(positions.data(), trees, levels.data());
+    long long switches = 0;
+    int lastFrame = 0;
+    for (int f = 1; f <= frames; ++f) {
+      const float nudge = (f % 2 ? 0.05f : -0.05f);
+      selector.setCamera(eye + forward * nudge, proj, viewportHeight);
+      check = levels;
+      lastFrame = selector.selectBatch(positions.data(), trees, levels.data());
+      switches += lastFrame;
+      for (int i = 0; i < trees; ++i)
+        same &= levels[i] == selector.select(positions[i], check[i]);
+    }
+    cout << "  hysteresis " << setprecision(2) << hysteresis << ": "
+         << switches << " level switches over " << frames
+         << " hovering frames, " << lastFrame << " in the last\n";
+  }
+  if (!same) cout << "  batch and scalar levels differ\n";
+}
+
+void vegetationScatter(const HeightmapGenerator& terrain, vector<int> counts) {
+  const VegetationScatter::Params defaults;
+  const float sizeX = (terrain.getWidth() - 1) * defaults.scaleX;
+  const float sizeZ = (terrain.getDepth() - 1) * defaults.scaleZ;
+  // the density rules of level_of_detail::generate_trees
+  const auto range = terrain.computeMinMax();
+  const float grassTop = range.first + 0.3f * (range.second - range.first);
+  const float fade = 0.1f * (grassTop - range.first);
+
+  cout << "vegetation scatter on " << terrain.getWidth() << "x"
+       << terrain.getDepth() << ":" << endl;
+  for (int count : counts) {
+    // the scatter packs about 0.78 samples per spacing squared
+    VegetationScatter::Params params;
+    params.minDistance = sqrt(0.78f * sizeX * sizeZ / float(count));
+
+    VegetationScatter scatter;
+    vector<VegetationScatter::Instance> serial, threaded;
+    scatter.setThreadCount(1);
+    const double serialMs =
+        timeMs([&]() { scatter.run(terrain, params, serial); }, 1);
+    scatter.setThreadCount(0);
+    const double threadedMs =
+        timeMs([&]() { scatter.run(terrain, params, threaded); }, 1);
+    bool same = serial.size() == threaded.size();
+    for (size_t i = 0; same && i < serial.size(); ++i)
+      same = serial[i].position == threaded[i].position &&
+             serial[i].rotation == threaded[i].rotation;
+
+    // every pair of samples in nearby grid cells, which covers every pair
+    // closer than twice the spacing
+    const vector<glm::vec2>& grid = scatter.getGrid();
+    const int cellsX = scatter.getGridWidth();
+    const int cellsZ = int(grid.size()) / cellsX;
+    float closest = numeric_limits<float>::max();
+    long long inGrid = 0;
+    for (int z = 0; z < cellsZ; ++z) {
+      for (int x = 0; x < cellsX; ++x) {
+        const glm::vec2 p = grid[size_t(z) * cellsX + x];
+        if (p.x < 0.0f) continue;
+        ++inGrid;
+        for (int nz = max(0, z - 2); nz <= min(cellsZ - 1, z + 2); ++nz)
+          for (int nx = max(0, x - 2); nx <= min(cellsX - 1, x + 2); ++nx) {
+            const glm::vec2 q = grid[size_t(nz) * cellsX + nx];
+            if (q.x < 0.0f || (nz == z && nx == x)) continue;
+            closest = min(closest, glm::length(q - p));
+          }
+      }
+    }
+
+    params.maxHeight = grassTop - fade;
+    params.heightFade = fade;
+    params.maxSlope = 1.5f;
+    params.slopeFade = 0.3f * params.maxSlope;
+    vector<VegetationScatter::Instance> trees;
+    scatter.run(terrain, params, trees);
+
+    cout << "  spacing " << fixed << setprecision(4) << params.minDistance
+         << ": " << serial.size() << " samples, " << setprecision(1)
+         << "1 thread " << serialMs << " ms, " << parallel::hardwareThreads()
+         << " threads " << threadedMs << " ms, " << trees.size()
+         << " trees after the rules, closest pair " << setprecision(3)
+         << closest / params.minDistance << " spacings, valid: "
+         << (closest >= params.minDistance &&
+                     inGrid == (long long)serial.size()
+                 ? "yes"
+                 : "NO")
+         << ", identical: " << (same ? "yes" : "NO") << endl;
+  }
+}
+
+}  // namespace benchmark
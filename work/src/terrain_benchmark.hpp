@@ -0,0 +1,87 @@
+#pragma once
+
+#include "heightmap_generator.hpp"
+#include "terrain_mesh.hpp"
+
+// Console benchmarks for the terrain pipeline, triggered from the
+// "Performance" panel. Results are printed to std::cout.
+namespace benchmark {
+
+// Times HeightmapGenerator::regenerate() on a copy of `terrain` for every
+// thread count from 1 to maxThreads (<= 0 means every core) and checks
+// each result is bit-identical to the single-threaded one.
+void regenerateScaling(const HeightmapGenerator& terrain, int maxThreads = 0);
+
+// Compares perlin::fbm2d_row/noise_row, and the values and gradients of
+// fbm2d_grad_row, against the scalar reference on random rows, printing the
+// largest difference in ULPs (expected: 0) and the speed-up of the batch
+// kernels. Returns that ULP difference.
+int noiseBatchParity(int rows = 4096, int rowLength = 256);
+
+// Packs `normals` random unit normals, plus the poles and the equator, with
+// TerrainMesh::packNormal and unpacks them with unpackNormal (the shader's
+// decoding), printing the worst angular error in degrees. Returns it.
+float normalPacking(int normals = 1000000);
+
+// Times the fused single-sweep regenerate() against the multi-pass one on a
+// copy of `terrain`. Also prints the main-memory traffic of each as given
+// by a model of the passes over the grid; it is not measured.
+void fusedEvaluation(const HeightmapGenerator& terrain);
+
+// Runs dense and temporally blocked thermal erosion on square default-
+// parameter maps of 2k, 4k and 8k cells a side, printing wall time, the
+// main-memory traffic a model of the passes predicts (not measured) and
+// whether the results match.
+void erosionTiling(int iterations = 24,
+                   std::vector<int> sizes = {2048, 4096, 8192});
+
+// Runs droplet hydraulic erosion on a default-parameter map of size x size
+// cells, timing it on one thread and on every core, and checks the results
+// are bit-identical.
+void dropletErosion(int droplets = 1000000, int size = 2048);
+
+// Regenerates a copy of `terrain` and updates `mesh` from it `iterations`
+// times, alternating full and preview resolution, and checks that no GL
+// buffer is reallocated or leaked along the way. Prints the average vertex
+// build and upload time of whichever path (vertex buffer or height
+// texture) the mesh uses. Needs a current GL context; the caller should
+// update `mesh` from its own terrain afterwards.
+void meshRegenLoop(const HeightmapGenerator& terrain, TerrainMesh& mesh,
+                   int iterations = 100);
+
+// Builds the CDLOD min/max pyramid for square default-parameter maps of
+// each size and selects nodes from the same camera over the same corner,
+// printing the pyramid build time, selection time and triangles drawn
+// next to the triangle count of the full-resolution mesh.
+void cdlodBudget(std::vector<int> sizes = {1024, 2048, 4096, 8192});
+
+// Builds a TIN of a 1024x1024 default-parameter map for each error bound,
+// printing its triangle count against the full grid's and the build time,
+// and checks every sample against the TIN's surface.
+void tinReduction(std::vector<float> maxErrors = {0.005f, 0.01f, 0.02f,
+                                                  0.05f});
+
+// Scatters n trees over the 20 x 20 LOD area for each size and compares
+// SpatialGrid queries against linear scans of every tree: the grid build,
+// frustum culling from the default camera, a radius query around the LOD
+// target, and updating the LOD levels after a small target move through
+// the changed cells against reclassifying every tree. Checks the grid's
+// answers match the scans.
+void treeGrid(std::vector<int> sizes = {10000, 100000, 1000000});
+
+// Selects screen-space-error LOD levels for `trees` scattered trees from
+// the default camera with LodSelector, timing the scalar select() against
+// the SSE2 selectBatch() and checking they agree. Then hovers the camera
+// back and forth by a small step for `frames` frames and counts the level
+// switches for a few hysteresis widths.
+void lodSelection(int trees = 1000000, int frames = 60);
+
+// Scatters about `counts` Poisson-disk samples over `terrain` with
+// VegetationScatter, spacing them for each count, on one thread and on
+// every core. Prints the time and the trees left by the application's
+// height and slope rules, and checks no two samples are closer than the
+// spacing and that both runs place the same trees.
+void vegetationScatter(const HeightmapGenerator& terrain,
+                       std::vector<int> counts = {100000, 1000000});
+
+}  // namespace benchmark
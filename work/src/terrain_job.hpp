@@ -0,0 +1,105 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "heightmap_generator.hpp"
+#include "parallel.hpp"
+
+// Runs one slow terrain operation (regeneration, erosion) on a background
+// thread so the render loop keeps going.
+//
+// The job works on its own back-buffer HeightmapGenerator: the worker
+// first copies the displayed generator into it (reusing the back buffer's
+// allocations), apart from the noise caches, which start() moves over
+// rather than copying them, and then runs the work there, reporting progress through
+// the back buffer's parallel::Progress. Once finished, poll() swaps the
+// back buffer with the displayed generator on the calling thread, so the
+// new terrain appears between two frames and never half-written.
+//
+// While a job is active the displayed generator is read by the worker, so
+// the caller must not modify it until poll() reports the job done.
+class TerrainJob {
+ public:
+  using Work = std::function<void(HeightmapGenerator&)>;
+
+  TerrainJob() = default;
+  TerrainJob(const TerrainJob&) = delete;
+  TerrainJob& operator=(const TerrainJob&) = delete;
+
+  ~TerrainJob() {
+    cancel();
+    if (worker.joinable()) worker.join();
+  }
+
+  // Starts work on a copy of source. Returns false if a job is already
+  // active. Until poll() collects the job, source's noise caches are held
+  // by the job and source has none.
+  bool start(const std::string& jobName, HeightmapGenerator& source,
+             Work work) {
+    if (isActive()) return false;
+    name = jobName;
+    progress.reset();
+    finished = false;
+    startTime = std::chrono::steady_clock::now();
+    caches = source.takeCaches();
+
+    worker = std::thread([this, &source, work = std::move(work)]() {
+      if (back)
+        *back = source;
+      else
+        back = std::make_unique<HeightmapGenerator>(source);
+      back->restoreCaches(std::move(caches));
+      back->setProgress(&progress);
+      work(*back);
+      back->setProgress(nullptr);
+      finished = true;
+    });
+    return true;
+  }
+
+  // Asks the running job to stop; it is dropped instead of swapped in
+  void cancel() { progress.cancel(); }
+
+  // Running, or finished but not yet collected by poll()
+  bool isActive() const { return worker.joinable(); }
+  bool isCancelled() const { return progress.isCancelled(); }
+  float getProgress() const { return progress.fraction(); }
+  const std::string& getName() const { return name; }
+  // Wall time of the last completed job
+  double getLastMs() const { return lastMs; }
+
+  // Call once per frame from the thread that owns target. If the job has
+  // finished, collects it and, unless it was cancelled, swaps its result
+  // into target. A cancelled job only hands the caches back (whatever a
+  // regeneration left half written is marked invalid). Returns true when
+  // target changed.
+  bool poll(HeightmapGenerator& target) {
+    if (!isActive() || !finished) return false;
+    worker.join();
+    if (progress.isCancelled()) {
+      target.restoreCaches(back->takeCaches());
+      return false;
+    }
+
+    lastMs = std::chrono::duration<double, std::milli>(
+                 std::chrono::steady_clock::now() - startTime)
+                 .count();
+    std::swap(target, *back);
+    return true;
+  }
+
+ private:
+  std::thread worker;
+  std::atomic<bool> finished{false};
+  parallel::Progress progress;
+  std::unique_ptr<HeightmapGenerator> back;
+  HeightmapGenerator::Caches caches;  // in transit from source to back
+  std::string name;
+  std::chrono::steady_clock::time_point startTime;
+  double lastMs = 0.0;
+};
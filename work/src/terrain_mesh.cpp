@@ -0,0 +1,339 @@
+// std
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+// glm
+#include <glm/gtc/type_ptr.hpp>
+
+// project
+#include "parallel.hpp"
+#include "terrain_mesh.hpp"
+
+using namespace std;
+using namespace glm;
+
+namespace {
+
+double msSince(chrono::steady_clock::time_point start) {
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start)
+      .count();
+}
+
+}  // namespace
+
+void TerrainMesh::update(const HeightmapGenerator& terrain, int stride) {
+  stride = std::max(1, stride);
+  const int cols = HeightmapGenerator::latticeCount(terrain.getWidth(), stride);
+  const int rows = HeightmapGenerator::latticeCount(terrain.getDepth(), stride);
+  if (cols < 2 || rows < 2) return;
+
+  if (vao == 0) createVertexArray();
+
+  if (useHeightTexture) {
+    lastBuildMs = 0.0;
+    auto start = chrono::steady_clock::now();
+    uploadHeightTexture(terrain);
+    lastUploadMs = msSince(start);
+  } else {
+    auto start = chrono::steady_clock::now();
+    buildVertices(terrain, stride, cols, rows);
+    lastBuildMs = msSince(start);
+
+    start = chrono::steady_clock::now();
+    uploadVertices();
+    lastUploadMs = msSince(start);
+  }
+  current = indexBuffer(cols, rows);
+  computeChunkBounds(terrain, stride);
+
+  terrainWidth = terrain.getWidth();
+  terrainDepth = terrain.getDepth();
+  gridCols = cols;
+  gridStride = stride;
+}
+
+void TerrainMesh::draw(GLuint shader, const mat4& viewProj) {
+  if (vao == 0 || current < 0) return;
+
+  // visible chunks, merging runs that are adjacent in the index buffer
+  const IndexBuffer& buffer = indexBuffers[current];
+  const Frustum frustum(viewProj);
+  drawCounts.clear();
+  drawOffsets.clear();
+  chunksDrawn = chunksCulled = 0;
+  int runEnd = -1;
+  for (size_t i = 0; i < buffer.chunks.size(); ++i) {
+    const Chunk& chunk = buffer.chunks[i];
+    if (culling && !frustum.intersects(chunkBounds[i])) {
+      ++chunksCulled;
+      continue;
+    }
+    ++chunksDrawn;
+    if (chunk.first == runEnd) {
+      drawCounts.back() += chunk.count;
+    } else {
+      drawCounts.push_back(chunk.count);
+      drawOffsets.push_back(
+          (const void*)(size_t(chunk.first) * sizeof(unsigned int)));
+    }
+    runEnd = chunk.first + chunk.count;
+  }
+  if (drawCounts.empty()) return;
+  glUniform2i(glGetUniformLocation(shader, "uTerrainSize"), terrainWidth,
+              terrainDepth);
+  glUniform1i(glGetUniformLocation(shader, "uGridCols"), gridCols);
+  glUniform1i(glGetUniformLocation(shader, "uGridStride"), gridStride);
+  glUniform3fv(glGetUniformLocation(shader, "uTerrainOffset"), 1,
+               value_ptr(offset));
+  glUniform2f(glGetUniformLocation(shader, "uTerrainScale"), scaleX, scaleZ);
+
+  if (useHeightTexture) {
+    // units 0-3 hold the surface textures
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, heightTexture);
+    glUniform1i(glGetUniformLocation(shader, "uHeightMap"), 4);
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  // the element binding is part of the VAO state
+  glBindVertexArray(useHeightTexture ? emptyVao : vao);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer.ibo);
+  glMultiDrawElements(GL_TRIANGLES, drawCounts.data(), GL_UNSIGNED_INT,
+                      drawOffsets.data(), GLsizei(drawCounts.size()));
+}
+
+void TerrainMesh::setHeightTexture(bool enabled) {
+  if (enabled == useHeightTexture) return;
+  useHeightTexture = enabled;
+  if (vao == 0) return;
+
+  if (enabled) {
+    vector<Vertex>().swap(vertices);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    vertexBytes = 0;
+  } else {
+    glDeleteTextures(1, &heightTexture);
+    heightTexture = 0;
+    textureWidth = textureDepth = 0;
+  }
+}
+
+void TerrainMesh::destroy() {
+  for (auto& buffer : indexBuffers) glDeleteBuffers(1, &buffer.ibo);
+  indexBuffers.clear();
+  current = -1;
+  glDeleteBuffers(1, &vbo);
+  glDeleteVertexArrays(1, &vao);
+  glDeleteVertexArrays(1, &emptyVao);
+  glDeleteTextures(1, &heightTexture);
+  vbo = vao = emptyVao = heightTexture = 0;
+  vertexBytes = 0;
+  textureWidth = textureDepth = 0;
+}
+
+void TerrainMesh::packNormal(vec3 n, int16_t out[2]) {
+  // project onto the octahedron |x| + |y| + |z| = 1, then fold the lower
+  // half over the upper one
+  n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+  vec2 e(n.x, n.z);
+  if (n.y < 0.0f) {
+    e = (1.0f - abs(vec2(n.z, n.x))) *
+        vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.z >= 0.0f ? 1.0f : -1.0f);
+  }
+  out[0] = int16_t(std::round(std::clamp(e.x, -1.0f, 1.0f) * 32767.0f));
+  out[1] = int16_t(std::round(std::clamp(e.y, -1.0f, 1.0f) * 32767.0f));
+}
+
+vec3 TerrainMesh::unpackNormal(const int16_t packed[2]) {
+  // GL's snorm16 conversion
+  const vec2 e(std::max(packed[0] / 32767.0f, -1.0f),
+               std::max(packed[1] / 32767.0f, -1.0f));
+  vec3 n(e.x, 1.0f - std::abs(e.x) - std::abs(e.y), e.y);
+  if (n.y < 0.0f) {
+    const vec2 folded = (1.0f - abs(vec2(n.z, n.x))) *
+                        vec2(n.x >= 0.0f ? 1.0f : -1.0f,
+                             n.z >= 0.0f ? 1.0f : -1.0f);
+    n.x = folded.x;
+    n.z = folded.y;
+  }
+  return normalize(n);
+}
+
+void TerrainMesh::createVertexArray() {
+  glGenVertexArrays(1, &vao);
+  glGenBuffers(1, &vbo);
+  glBindVertexArray(vao);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+  const GLsizei stride = sizeof(Vertex);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 1, GL_FLOAT, GL_FALSE, stride,
+                        (void*)(offsetof(Vertex, height)));
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride,
+                        (void*)(offsetof(Vertex, normal)));
+  glBindVertexArray(0);
+
+  // core profiles need a bound VAO even when nothing is read from buffers
+  glGenVertexArrays(1, &emptyVao);
+}
+
+void TerrainMesh::uploadVertices() {
+  const size_t bytes = vertices.size() * sizeof(Vertex);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  if (bytes > vertexBytes) {
+    // grow once; smaller preview grids reuse the front of the storage
+    glBufferData(GL_ARRAY_BUFFER, bytes, vertices.data(), GL_DYNAMIC_DRAW);
+    vertexBytes = bytes;
+    ++allocations;
+  } else {
+    // orphan the old storage, then refill it in place
+    glBufferData(GL_ARRAY_BUFFER, vertexBytes, nullptr, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, vertices.data());
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Uploads the whole heightmap, reallocating only when its size changed.
+// Preview strides upload the full map too; the shader reads only the
+// lattice cells.
+void TerrainMesh::uploadHeightTexture(const HeightmapGenerator& terrain) {
+  const int width = terrain.getWidth(), depth = terrain.getDepth();
+  const float* heights = terrain.getHeights().data();
+  if (heightTexture == 0) glGenTextures(1, &heightTexture);
+  glActiveTexture(GL_TEXTURE4);
+  glBindTexture(GL_TEXTURE_2D, heightTexture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  if (width != textureWidth || depth != textureDepth) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, depth, 0, GL_RED, GL_FLOAT,
+                 heights);
+    textureWidth = width;
+    textureDepth = depth;
+    ++allocations;
+  } else {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, depth, GL_RED, GL_FLOAT,
+                    heights);
+  }
+  glActiveTexture(GL_TEXTURE0);
+}
+
+// Builds the vertices of the stride lattice in parallel over rows. Normals
+// come from the generator's gradients at each lattice sample, which are
+// current for every sample a preview has evaluated, so a coarse lattice is
+// lit like the full-resolution surface.
+void TerrainMesh::buildVertices(const HeightmapGenerator& terrain, int stride,
+                                int cols, int rows) {
+  const int width = terrain.getWidth(), depth = terrain.getDepth();
+  const vector<float>& heights = terrain.getHeights();
+  const vector<float>& gradX = terrain.getGradientX();
+  const vector<float>& gradZ = terrain.getGradientZ();
+  vertices.resize(size_t(cols) * rows);
+
+  vector<int> xs(cols);
+  for (int c = 0; c < cols; ++c)
+    xs[c] = HeightmapGenerator::latticeIndex(width, stride, c);
+
+  parallel::forTiles(0, rows, 16, 0, [&](int r0, int r1) {
+    for (int r = r0; r < r1; ++r) {
+      const size_t row =
+          size_t(HeightmapGenerator::latticeIndex(depth, stride, r)) * width;
+      for (int c = 0; c < cols; ++c) {
+        const size_t i = row + xs[c];
+        Vertex& v = vertices[size_t(r) * cols + c];
+        v.height = heights[i];
+        packNormal(normalize(vec3(-gradX[i] / scaleX, 1.0f,
+                                  -gradZ[i] / scaleZ)),
+                   v.normal);
+      }
+    }
+  });
+}
+
+// World-space boxes of the current index buffer's chunks, from the height
+// range of the lattice samples each one covers
+void TerrainMesh::computeChunkBounds(const HeightmapGenerator& terrain,
+                                     int stride) {
+  const int width = terrain.getWidth(), depth = terrain.getDepth();
+  const vector<float>& heights = terrain.getHeights();
+  const vector<Chunk>& chunks = indexBuffers[current].chunks;
+  chunkBounds.resize(chunks.size());
+
+  parallel::forTiles(0, int(chunks.size()), 4, 0, [&](int i0, int i1) {
+    for (int i = i0; i < i1; ++i) {
+      const Chunk& chunk = chunks[i];
+      float lo = numeric_limits<float>::max();
+      float hi = numeric_limits<float>::lowest();
+      for (int r = chunk.r0; r <= chunk.r1; ++r) {
+        const int z = HeightmapGenerator::latticeIndex(depth, stride, r);
+        const float* row = &heights[size_t(z) * width];
+        for (int c = chunk.c0; c <= chunk.c1; ++c) {
+          const int x = HeightmapGenerator::latticeIndex(width, stride, c);
+          lo = std::min(lo, row[x]);
+          hi = std::max(hi, row[x]);
+        }
+      }
+      const int x0 = HeightmapGenerator::latticeIndex(width, stride, chunk.c0);
+      const int x1 = HeightmapGenerator::latticeIndex(width, stride, chunk.c1);
+      const int z0 = HeightmapGenerator::latticeIndex(depth, stride, chunk.r0);
+      const int z1 = HeightmapGenerator::latticeIndex(depth, stride, chunk.r1);
+      chunkBounds[i].min = offset + vec3(x0 * scaleX, lo, z0 * scaleZ);
+      chunkBounds[i].max = offset + vec3(x1 * scaleX, hi, z1 * scaleZ);
+    }
+  });
+}
+
+// Index buffer for a cols x rows grid, built the first time it is needed.
+// Quads are emitted chunk by chunk so every chunk is one index range.
+int TerrainMesh::indexBuffer(int cols, int rows) {
+  for (size_t i = 0; i < indexBuffers.size(); ++i)
+    if (indexBuffers[i].cols == cols && indexBuffers[i].rows == rows)
+      return int(i);
+
+  IndexBuffer buffer;
+  buffer.cols = cols;
+  buffer.rows = rows;
+
+  vector<unsigned int> indices;
+  indices.reserve(size_t(cols - 1) * (rows - 1) * 6);
+  for (int r0 = 0; r0 < rows - 1; r0 += CHUNK_QUADS) {
+    for (int c0 = 0; c0 < cols - 1; c0 += CHUNK_QUADS) {
+      Chunk chunk;
+      chunk.c0 = c0;
+      chunk.r0 = r0;
+      chunk.c1 = std::min(c0 + CHUNK_QUADS, cols - 1);
+      chunk.r1 = std::min(r0 + CHUNK_QUADS, rows - 1);
+      chunk.first = int(indices.size());
+      for (int z = chunk.r0; z < chunk.r1; ++z) {
+        for (int x = chunk.c0; x < chunk.c1; ++x) {
+          const unsigned int topLeft = z * cols + x;
+          const unsigned int topRight = topLeft + 1;
+          const unsigned int bottomLeft = (z + 1) * cols + x;
+          const unsigned int bottomRight = bottomLeft + 1;
+          indices.insert(indices.end(), {topLeft, bottomLeft, topRight,
+                                         topRight, bottomLeft, bottomRight});
+        }
+      }
+      chunk.count = int(indices.size()) - chunk.first;
+      buffer.chunks.push_back(chunk);
+    }
+  }
+  buffer.count = int(indices.size());
+  glGenBuffers(1, &buffer.ibo);
+  // no VAO bound, so this does not disturb any element binding
+  glBindVertexArray(0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer.ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
+               indices.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  indexBuffers.push_back(buffer);
+  ++indexBuilds;
+  return int(indexBuffers.size()) - 1;
+}
@@ -0,0 +1,152 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "frustum.hpp"
+#include "heightmap_generator.hpp"
+#include "opengl.hpp"
+
+// GPU buffers for the terrain grid that live as long as the terrain.
+//
+// Unlike plane_terrain(), which creates a new VAO/VBO/IBO on every call,
+// TerrainMesh keeps one VAO and one vertex buffer, and one index buffer per
+// grid size it has drawn (the full grid plus the preview strides). Index
+// buffers depend only on the grid size, so they are built once; a height
+// change only rewrites the vertex data, orphaning the old storage so the
+// driver does not stall on frames still using it.
+//
+// Vertices are 8 bytes instead of cgra::mesh_vertex's 36: the height as a
+// float and the normal octahedral-encoded into two snorm16s. The grid
+// position and UV are derived from gl_VertexID in terrain_vert.glsl, which
+// draw() feeds the grid layout through uniforms.
+//
+// With setHeightTexture(true) no vertex data is kept at all: the heights
+// are uploaded as an R32F texture, which terrain_displace_vert.glsl samples
+// for the displacement and the normals. An update is then one texture
+// upload of the full map (4 bytes a cell) and no CPU mesh build.
+//
+// The index buffer is laid out in chunks of CHUNK_QUADS x CHUNK_QUADS
+// quads, each a contiguous index range with a world-space bounding box from
+// its height range. draw() culls the chunks against the view frustum and
+// issues the visible ranges in one glMultiDrawElements call.
+//
+// Like cgra::gl_mesh, GL objects are released by destroy(), not by the
+// destructor, as the context may already be gone by then.
+class TerrainMesh {
+ public:
+  explicit TerrainMesh(glm::vec3 offset = {-10, 0, -10}, float scaleX = 0.02f,
+                       float scaleZ = 0.02f)
+      : offset(offset), scaleX(scaleX), scaleZ(scaleZ) {}
+
+  TerrainMesh(const TerrainMesh&) = delete;
+  TerrainMesh& operator=(const TerrainMesh&) = delete;
+
+  // Uploads terrain's heights sampled on the stride lattice (see
+  // HeightmapGenerator::latticeCount), reusing the existing buffers
+  void update(const HeightmapGenerator& terrain, int stride = 1);
+
+  static constexpr int CHUNK_QUADS = 64;
+
+  // Draws the chunks inside the frustum of viewProj (the full model-view-
+  // projection matrix) with `shader`, which must be built from
+  // terrain_vert.glsl, or terrain_displace_vert.glsl when drawing from the
+  // height texture
+  void draw(GLuint shader, const glm::mat4& viewProj);
+
+  // With culling off every chunk is drawn
+  void setCulling(bool enabled) { culling = enabled; }
+  bool getCulling() const { return culling; }
+
+  // Switches between vertex buffer and height texture rendering, freeing
+  // the storage of the other path. Takes effect at the next update().
+  void setHeightTexture(bool enabled);
+  bool getHeightTexture() const { return useHeightTexture; }
+
+  // Deletes every GL object
+  void destroy();
+
+  // Statistics for the last update() and over the mesh's lifetime
+  double getLastBuildMs() const { return lastBuildMs; }
+  double getLastUploadMs() const { return lastUploadMs; }
+  size_t getVertexBytes() const { return vertexBytes; }
+  size_t getTextureBytes() const {
+    return size_t(textureWidth) * textureDepth * sizeof(float);
+  }
+  int getIndexBuilds() const { return indexBuilds; }
+  int getAllocations() const { return allocations; }
+  GLuint getVertexBuffer() const { return vbo; }
+  // Chunks drawn and culled by the last draw()
+  int getChunksDrawn() const { return chunksDrawn; }
+  int getChunksCulled() const { return chunksCulled; }
+  const std::vector<Aabb>& getChunkBounds() const { return chunkBounds; }
+
+  struct Vertex {
+    float height;
+    int16_t normal[2];  // octahedral, snorm16
+  };
+  static_assert(sizeof(Vertex) == 8, "terrain vertices are 8 bytes");
+
+  // Octahedral normal encoding folded along +y, decoded by
+  // terrain_vert.glsl. n must be unit length.
+  static void packNormal(glm::vec3 n, int16_t out[2]);
+  // The shader's decoding on the CPU, for benchmark::normalPacking
+  static glm::vec3 unpackNormal(const int16_t packed[2]);
+
+ private:
+  // A chunk's lattice vertices [c0, c1] x [r0, r1] and its index range
+  struct Chunk {
+    int c0, r0, c1, r1;
+    int first, count;
+  };
+
+  struct IndexBuffer {
+    int cols = 0, rows = 0;
+    GLuint ibo = 0;
+    int count = 0;
+    std::vector<Chunk> chunks;
+  };
+
+  glm::vec3 offset;
+  float scaleX, scaleZ;
+
+  GLuint vao = 0;
+  GLuint vbo = 0;
+  size_t vertexBytes = 0;  // size of the vbo storage
+  std::vector<IndexBuffer> indexBuffers;
+  int current = -1;  // index buffer in use
+
+  // height texture path: a VAO without attributes and the R32F heights
+  bool useHeightTexture = false;
+  GLuint emptyVao = 0;
+  GLuint heightTexture = 0;
+  int textureWidth = 0, textureDepth = 0;
+
+  // the grid last uploaded, for draw()
+  int terrainWidth = 0, terrainDepth = 0;
+  int gridCols = 0, gridStride = 1;
+
+  // bounds of the current index buffer's chunks, from the last update()
+  std::vector<Aabb> chunkBounds;
+  bool culling = true;
+  int chunksDrawn = 0, chunksCulled = 0;
+  std::vector<GLsizei> drawCounts;
+  std::vector<const void*> drawOffsets;
+
+  // CPU staging, reused between updates
+  std::vector<Vertex> vertices;
+
+  double lastBuildMs = 0.0;
+  double lastUploadMs = 0.0;
+  int indexBuilds = 0;
+  int allocations = 0;  // vertex buffer or height texture storage
+
+  void createVertexArray();
+  void uploadVertices();
+  void uploadHeightTexture(const HeightmapGenerator& terrain);
+  void buildVertices(const HeightmapGenerator& terrain, int stride, int cols,
+                     int rows);
+  void computeChunkBounds(const HeightmapGenerator& terrain, int stride);
+  int indexBuffer(int cols, int rows);
+};
@@ -0,0 +1,410 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <utility>
+#include <vector>
+
+#include "parallel.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define THERMAL_EROSION_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Multi-neighbour thermal erosion over a row-major width x depth heightmap.
+//
+// Material slides from a cell to every lower neighbour whose height
+// difference exceeds the repose angle, moving talusFactor of the excess per
+// iteration. The update is written as a gather: every cell adds what its
+// higher neighbours shed onto it and subtracts what it sheds itself, so
+// rows can run on any number of threads without write conflicts and the
+// result does not depend on the thread count.
+class ThermalErosion {
+ public:
+  struct Params {
+    int iterations = 6;
+    float reposeAngleDeg = 30.0f;
+    float talusFactor = 0.15f;
+    float cellSizeX = 0.02f;
+    float cellSizeZ = 0.02f;
+    // runSparse stops early once no cell moves by more than this
+    float residual = 0.0f;
+    // runBlocked tile edge (cells) and iterations run per tile visit
+    int tileSize = 128;
+    int tileSteps = 8;
+  };
+
+  // neighbour offsets in the order the original scatter loop visited them
+  static constexpr int NEIGHBORS = 8;
+  static constexpr int DX[NEIGHBORS] = {-1, 0, 1, -1, 1, -1, 0, 1};
+  static constexpr int DZ[NEIGHBORS] = {-1, -1, -1, 0, 0, 1, 1, 1};
+
+  void setThreadCount(int threads) { threadCount = std::max(0, threads); }
+
+  // Reports iterations to `progress` and stops early if it is cancelled
+  // (nullptr to run unobserved)
+  void setProgress(parallel::Progress* observer) { progress = observer; }
+
+  // Runs params.iterations iterations on heights in place
+  void run(std::vector<float>& heights, int width, int depth,
+           const Params& params) {
+    prepare(params);
+    scratch.resize(heights.size());
+    beginProgress(params.iterations);
+    for (int iter = 0; iter < params.iterations && !cancelled(); ++iter) {
+      step(heights.data(), scratch.data(), width, depth);
+      std::swap(heights, scratch);
+      advanceProgress(1);
+    }
+  }
+
+  // Same result as run(), but each iteration only visits the active cells:
+  // those with a cell in their 3x3 neighbourhood that changed in the
+  // previous iteration. Every other cell was already at rest with the same
+  // inputs, so skipping it is exact. Stops when nothing is active or the
+  // largest change falls below params.residual, and returns the number of
+  // iterations actually run. Cost per iteration scales with the eroding
+  // area instead of the map size.
+  int runSparse(std::vector<float>& heights, int width, int depth,
+                const Params& params) {
+    prepare(params);
+    const int cells = width * depth;
+    lastActiveCells = 0;
+
+    // first iteration: everything is active
+    active.resize(cells);
+    for (int i = 0; i < cells; ++i) active[i] = i;
+    if (stamp.size() != size_t(cells)) {
+      stamp.assign(cells, 0);
+      epoch = 0;
+    }
+
+    beginProgress(params.iterations);
+    int iter = 0;
+    while (iter < params.iterations && !active.empty() && !cancelled()) {
+      ++iter;
+      advanceProgress(1);
+      lastActiveCells += active.size();
+      const int count = int(active.size());
+      float residual = 0.0f;
+
+      if (count > cells / 4) {
+        // mostly active: a full sweep is cheaper than chasing indices
+        scratch.resize(cells);
+        changed.resize(cells);
+        residual = stepTracked(heights.data(), scratch.data(), width, depth);
+        std::swap(heights, scratch);
+        if (residual <= params.residual) break;
+        dilateMask(width, depth);
+        continue;
+      }
+
+      scratch.resize(count);
+      changed.resize(count);
+
+      // evaluate every active cell against the current heights
+      parallel::forTiles(0, count, SPARSE_TILE, threadCount, [&](int b, int e) {
+        for (int k = b; k < e; ++k) {
+          const int x = active[k] % width, z = active[k] / width;
+          scratch[k] = (x > 0 && x < width - 1 && z > 0 && z < depth - 1)
+                           ? cell<false>(heights.data(), width, depth, x, z)
+                           : cell<true>(heights.data(), width, depth, x, z);
+        }
+      });
+
+      // commit and measure the largest change
+      const int tiles = (count + SPARSE_TILE - 1) / SPARSE_TILE;
+      tileResidual.assign(tiles, 0.0f);
+      parallel::forTiles(0, count, SPARSE_TILE, threadCount, [&](int b, int e) {
+        float& res = tileResidual[b / SPARSE_TILE];
+        for (int k = b; k < e; ++k) {
+          const float delta = scratch[k] - heights[active[k]];
+          changed[k] = delta != 0.0f;
+          res = std::max(res, std::abs(delta));
+          heights[active[k]] = scratch[k];
+        }
+      });
+      for (float r : tileResidual) residual = std::max(residual, r);
+      if (residual <= params.residual) break;
+
+      // next worklist: the 3x3 neighbourhood of every changed cell
+      if (++epoch == 0) {
+        std::fill(stamp.begin(), stamp.end(), 0u);
+        epoch = 1;
+      }
+      next.clear();
+      for (int k = 0; k < count; ++k) {
+        if (!changed[k]) continue;
+        const int x = active[k] % width, z = active[k] / width;
+        for (int nz = std::max(0, z - 1); nz <= std::min(depth - 1, z + 1);
+             ++nz) {
+          for (int nx = std::max(0, x - 1); nx <= std::min(width - 1, x + 1);
+               ++nx) {
+            const int n = nz * width + nx;
+            if (stamp[n] == epoch) continue;
+            stamp[n] = epoch;
+            next.push_back(n);
+          }
+        }
+      }
+      std::swap(active, next);
+    }
+    lastIterations = iter;
+    return iter;
+  }
+
+  // Same result as run(), with temporal blocking: the map is cut into
+  // tileSize tiles and each tile, plus a halo of tileSteps cells, is copied
+  // into a small local buffer that stays in L2 while tileSteps iterations
+  // run on it. The valid region shrinks by one cell per iteration on every
+  // side that is not the map edge, so after the last step exactly the tile
+  // is correct and is written back. Counting passes over the map,
+  // main-memory traffic drops from two per iteration to roughly two per
+  // tileSteps iterations, for a little redundant work in the halos. Tiles are independent, so the
+  // result is the same for any thread count.
+  void runBlocked(std::vector<float>& heights, int width, int depth,
+                  const Params& params) {
+    prepare(params);
+    scratch.resize(heights.size());
+    const int tile = std::max(8, params.tileSize);
+    const int tilesX = (width + tile - 1) / tile;
+    const int tilesZ = (depth + tile - 1) / tile;
+    const int workers =
+        std::min(parallel::resolveThreads(threadCount), tilesX * tilesZ);
+    if (int(halo.size()) < workers) halo.resize(workers);
+
+    beginProgress(params.iterations);
+    for (int done = 0; done < params.iterations && !cancelled();) {
+      const int steps = std::min(std::max(1, params.tileSteps),
+                                 params.iterations - done);
+      const float* in = heights.data();
+      float* out = scratch.data();
+
+      // one task per worker, each taking tiles as it frees up, so every
+      // worker keeps its own halo buffers across tiles and passes
+      std::atomic<int> nextTile{0};
+      parallel::forTiles(0, workers, 1, workers, [&](int w0, int w1) {
+        for (int w = w0; w < w1; ++w) {
+          for (int t = nextTile++; t < tilesX * tilesZ; t = nextTile++) {
+            const int x0 = (t % tilesX) * tile, z0 = (t / tilesX) * tile;
+            const int x1 = std::min(width, x0 + tile);
+            const int z1 = std::min(depth, z0 + tile);
+            runTile(in, out, width, depth, x0, z0, x1, z1, steps,
+                    halo[w].first, halo[w].second);
+          }
+        }
+      });
+
+      std::swap(heights, scratch);
+      done += steps;
+      advanceProgress(steps);
+    }
+  }
+
+  // Cells evaluated by the last runSparse, summed over its iterations
+  size_t getLastActiveCells() const { return lastActiveCells; }
+  // Iterations the last runSparse actually ran
+  int getLastIterations() const { return lastIterations; }
+
+ private:
+  static constexpr int ROW_TILE = 16;
+  static constexpr int SPARSE_TILE = 4096;
+
+  int threadCount = 0;
+  parallel::Progress* progress = nullptr;
+  float talus = 0.0f;
+  float allowed[NEIGHBORS] = {};  // allowed height drop per neighbour
+  std::vector<float> scratch;     // next-iteration heights, reused
+  // runBlocked's local tile buffers, a pair per worker, reused
+  std::vector<std::pair<std::vector<float>, std::vector<float>>> halo;
+
+  // runSparse worklists and bookkeeping, reused between calls
+  std::vector<int> active, next;
+  std::vector<char> changed;
+  std::vector<float> tileResidual;
+  std::vector<uint32_t> stamp;
+  uint32_t epoch = 0;
+  size_t lastActiveCells = 0;
+  int lastIterations = 0;
+
+  void beginProgress(long long units) {
+    if (progress) progress->begin(units);
+  }
+  void advanceProgress(long long units) {
+    if (progress) progress->advance(units);
+  }
+  bool cancelled() const { return progress && progress->isCancelled(); }
+
+  void prepare(const Params& params) {
+    const float reposeRad =
+        glm::radians(glm::clamp(params.reposeAngleDeg, 0.0f, 89.0f));
+    const float tanRepose = std::tan(reposeRad);
+    talus = glm::clamp(params.talusFactor, 0.0f, 1.0f);
+    for (int k = 0; k < NEIGHBORS; ++k) {
+      // horizontal distance to neighbor (handles diagonal)
+      float horizDist =
+          glm::distance(glm::vec2(0.0f), glm::vec2(DX[k] * params.cellSizeX,
+                                                   DZ[k] * params.cellSizeZ));
+      allowed[k] = tanRepose * horizDist;
+    }
+  }
+
+  // New height of the cell at c, global position (x, z) on the width x
+  // depth map, with rows `stride` floats apart. Transfer to a lower
+  // neighbour is talus * (drop - allowed), the original proportional share
+  // of talus * totalExcess simplified, so only float rounding differs.
+  template <bool CheckBounds>
+  float cellAt(const float* c, int stride, int x, int z, int width,
+               int depth) const {
+    const float h = *c;
+    float gain = 0.0f, loss = 0.0f;
+    for (int k = 0; k < NEIGHBORS; ++k) {
+      const int nx = x + DX[k], nz = z + DZ[k];
+      if (CheckBounds && (nx < 0 || nx >= width || nz < 0 || nz >= depth))
+        continue;  // skip outside map
+      const float diff = h - c[DZ[k] * stride + DX[k]];
+      loss += std::max(0.0f, diff - allowed[k]);
+      gain += std::max(0.0f, -diff - allowed[k]);
+    }
+    return h + talus * (gain - loss);
+  }
+
+  // cellAt<false> for `count` consecutive interior cells starting at c,
+  // four at a time with SSE2 (same operations, same order)
+  void interiorSpan(const float* c, int stride, int count, float* dst) const {
+    int i = 0;
+#ifdef THERMAL_EROSION_SSE2
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 vtalus = _mm_set1_ps(talus);
+    for (; i + 4 <= count; i += 4) {
+      const __m128 h = _mm_loadu_ps(c + i);
+      __m128 gain = zero, loss = zero;
+      for (int k = 0; k < NEIGHBORS; ++k) {
+        const __m128 a = _mm_set1_ps(allowed[k]);
+        const __m128 diff =
+            _mm_sub_ps(h, _mm_loadu_ps(c + i + DZ[k] * stride + DX[k]));
+        loss = _mm_add_ps(loss, _mm_max_ps(_mm_sub_ps(diff, a), zero));
+        gain = _mm_add_ps(
+            gain, _mm_max_ps(_mm_sub_ps(_mm_xor_ps(diff, sign), a), zero));
+      }
+      _mm_storeu_ps(dst + i,
+                    _mm_add_ps(h, _mm_mul_ps(vtalus, _mm_sub_ps(gain, loss))));
+    }
+#endif
+    for (; i < count; ++i) dst[i] = cellAt<false>(c + i, stride, 1, 1, 3, 3);
+  }
+
+  template <bool CheckBounds>
+  float cell(const float* in, int width, int depth, int x, int z) const {
+    return cellAt<CheckBounds>(in + z * width + x, width, x, z, width, depth);
+  }
+
+  // `steps` iterations of the tile [x0, x1) x [z0, z1) from in to out, via
+  // the local buffers a and b holding the tile plus its halo
+  void runTile(const float* in, float* out, int width, int depth, int x0,
+               int z0, int x1, int z1, int steps, std::vector<float>& a,
+               std::vector<float>& b) const {
+    const int lx0 = std::max(0, x0 - steps), lx1 = std::min(width, x1 + steps);
+    const int lz0 = std::max(0, z0 - steps), lz1 = std::min(depth, z1 + steps);
+    const int lw = lx1 - lx0;
+    a.resize(size_t(lw) * (lz1 - lz0));
+    b.resize(a.size());
+    for (int z = lz0; z < lz1; ++z)
+      std::copy(in + z * width + lx0, in + z * width + lx1,
+                a.begin() + (z - lz0) * lw);
+
+    for (int s = 1; s <= steps; ++s) {
+      // region still valid after this step
+      const int cx0 = lx0 > 0 ? lx0 + s : 0;
+      const int cx1 = lx1 < width ? lx1 - s : width;
+      const int cz0 = lz0 > 0 ? lz0 + s : 0;
+      const int cz1 = lz1 < depth ? lz1 - s : depth;
+      for (int z = cz0; z < cz1; ++z) {
+        const float* src = a.data() + (z - lz0) * lw - lx0;
+        float* dst = b.data() + (z - lz0) * lw - lx0;
+        if (z == 0 || z == depth - 1) {
+          for (int x = cx0; x < cx1; ++x)
+            dst[x] = cellAt<true>(src + x, lw, x, z, width, depth);
+          continue;
+        }
+        const int ix0 = std::max(cx0, 1), ix1 = std::min(cx1, width - 1);
+        if (cx0 == 0) dst[0] = cellAt<true>(src, lw, 0, z, width, depth);
+        if (ix1 > ix0) interiorSpan(src + ix0, lw, ix1 - ix0, dst + ix0);
+        if (cx1 == width && width > 1)
+          dst[width - 1] =
+              cellAt<true>(src + width - 1, lw, width - 1, z, width, depth);
+      }
+      std::swap(a, b);
+    }
+
+    for (int z = z0; z < z1; ++z)
+      std::copy(a.begin() + (z - lz0) * lw + (x0 - lx0),
+                a.begin() + (z - lz0) * lw + (x1 - lx0), out + z * width + x0);
+  }
+
+  // step() that also flags changed cells in `changed` (one per cell) and
+  // returns the largest absolute change
+  float stepTracked(const float* in, float* out, int width, int depth) {
+    const int tiles = (depth + ROW_TILE - 1) / ROW_TILE;
+    tileResidual.assign(tiles, 0.0f);
+    step(in, out, width, depth, [&](int z, const float* inRow, float* outRow) {
+      char* flags = &changed[z * width];
+      float res = 0.0f;
+      for (int x = 0; x < width; ++x) {
+        const float delta = outRow[x] - inRow[x];
+        flags[x] = delta != 0.0f;
+        res = std::max(res, std::abs(delta));
+      }
+      float& tileRes = tileResidual[z / ROW_TILE];
+      tileRes = std::max(tileRes, res);
+    });
+    float residual = 0.0f;
+    for (float r : tileResidual) residual = std::max(residual, r);
+    return residual;
+  }
+
+  // active = every cell with a changed cell in its 3x3 neighbourhood, from
+  // the per-cell `changed` mask
+  void dilateMask(int width, int depth) {
+    active.clear();
+    std::vector<char> column(width + 2, 0);
+    for (int z = 0; z < depth; ++z) {
+      const char* up = &changed[std::max(0, z - 1) * width];
+      const char* mid = &changed[z * width];
+      const char* down = &changed[std::min(depth - 1, z + 1) * width];
+      for (int x = 0; x < width; ++x) column[x + 1] = up[x] | mid[x] | down[x];
+      for (int x = 0; x < width; ++x)
+        if (column[x] | column[x + 1] | column[x + 2])
+          active.push_back(z * width + x);
+    }
+  }
+
+  // One dense iteration in -> out. rowDone(z, inRow, outRow) runs on the
+  // worker right after each row, while it is still in cache.
+  template <typename RowDone>
+  void step(const float* in, float* out, int width, int depth,
+            RowDone&& rowDone) const {
+    parallel::forTiles(0, depth, ROW_TILE, threadCount, [&](int z0, int z1) {
+      for (int z = z0; z < z1; ++z) {
+        float* row = out + z * width;
+        if (z == 0 || z == depth - 1 || width < 3) {
+          for (int x = 0; x < width; ++x)
+            row[x] = cell<true>(in, width, depth, x, z);
+        } else {
+          row[0] = cell<true>(in, width, depth, 0, z);
+          interiorSpan(in + z * width + 1, width, width - 2, row + 1);
+          row[width - 1] = cell<true>(in, width, depth, width - 1, z);
+        }
+        rowDone(z, in + z * width, row);
+      }
+    });
+  }
+
+  void step(const float* in, float* out, int width, int depth) const {
+    step(in, out, width, depth, [](int, const float*, float*) {});
+  }
+};
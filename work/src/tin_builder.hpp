@@ -0,0 +1,316 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <queue>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Builds a triangulated irregular network (TIN) approximating a row-major
+// width x depth heightmap, by greedy insertion (Garland & Heckbert 1995).
+//
+// The TIN starts as the two triangles spanning the map's corners. Every
+// triangle knows the grid sample inside it with the largest vertical error
+// against its plane; the worst sample over all triangles is inserted next,
+// kept in a priority queue, and the triangulation is restored to Delaunay
+// by edge flips. Only the triangles an insertion changed are rescanned, so
+// flat areas end up with a few large triangles while ridges keep the
+// detail. Insertion stops once no sample is further than maxError from the
+// surface.
+//
+// Vertices are grid samples, so the orientation and in-circle predicates
+// are evaluated exactly in 64-bit integers.
+class TinBuilder {
+ public:
+  struct Result {
+    std::vector<glm::ivec2> vertices;  // grid samples (x, z)
+    // vertex indices, wound like plane_terrain()'s triangles
+    std::vector<glm::ivec3> triangles;
+    float maxError = 0.0f;  // largest remaining vertical error
+    double buildMs = 0.0;
+  };
+
+  // Inserts samples until every sample is within maxError of the TIN or
+  // maxVertices vertices are used
+  Result build(const std::vector<float>& heightmap, int mapWidth,
+               int mapDepth, float maxError,
+               int maxVertices = std::numeric_limits<int>::max()) {
+    const auto start = std::chrono::steady_clock::now();
+    heights = heightmap.data();
+    width = mapWidth;
+    depth = mapDepth;
+    points.clear();
+    tris.clear();
+    queue = {};
+
+    Result result;
+    if (width < 2 || depth < 2) return result;
+
+    // two triangles over the corners
+    const int a = addPoint(0, 0), b = addPoint(width - 1, 0);
+    const int c = addPoint(width - 1, depth - 1), d = addPoint(0, depth - 1);
+    tris.push_back({{a, b, c}, {-1, -1, 1}});
+    tris.push_back({{a, c, d}, {0, -1, -1}});
+    scan(0, maxError);
+    scan(1, maxError);
+
+    while (!queue.empty() && int(points.size()) < maxVertices) {
+      const Candidate top = queue.top();
+      queue.pop();
+      if (top.version != tris[top.tri].version) continue;  // rescanned since
+      if (top.error <= maxError) break;
+
+      touched.clear();
+      insert(top.tri, addPoint(tris[top.tri].bestX, tris[top.tri].bestZ));
+      std::sort(touched.begin(), touched.end());
+      touched.erase(std::unique(touched.begin(), touched.end()),
+                    touched.end());
+      for (int t : touched) scan(t, maxError);
+    }
+
+    result.vertices = points;
+    result.triangles.reserve(tris.size());
+    for (const Triangle& t : tris) {
+      result.maxError = std::max(result.maxError, t.error);
+      // internal triangles have positive orient() in (x, z), the opposite
+      // turn to plane_terrain()'s
+      result.triangles.emplace_back(t.v[0], t.v[2], t.v[1]);
+    }
+    result.buildMs = std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    return result;
+  }
+
+ private:
+  // Vertices v[0..2] counter-clockwise in (x, z); edge i runs from v[i] to
+  // v[i + 1] and n[i] is the triangle across it, or -1 on the map border
+  struct Triangle {
+    int v[3];
+    int n[3];
+    int version = 0;
+    int bestX = 0, bestZ = 0;  // worst sample inside
+    float error = 0.0f;        // and its vertical error
+  };
+
+  struct Candidate {
+    float error;
+    int tri;
+    int version;
+    bool operator<(const Candidate& o) const { return error < o.error; }
+  };
+
+  const float* heights = nullptr;
+  int width = 0, depth = 0;
+  std::vector<glm::ivec2> points;
+  std::vector<Triangle> tris;
+  std::priority_queue<Candidate> queue;
+  std::vector<int> touched;               // triangles changed by an insert
+  std::vector<std::pair<int, int>> flips;  // (triangle, edge) to legalize
+
+  int addPoint(int x, int z) {
+    points.emplace_back(x, z);
+    return int(points.size()) - 1;
+  }
+
+  float height(int x, int z) const { return heights[size_t(z) * width + x]; }
+
+  static int64_t orient(glm::ivec2 a, glm::ivec2 b, glm::ivec2 c) {
+    return int64_t(b.x - a.x) * (c.y - a.y) - int64_t(b.y - a.y) * (c.x - a.x);
+  }
+
+  // > 0 if d is inside the circumcircle of counter-clockwise a, b, c
+  static bool inCircle(glm::ivec2 a, glm::ivec2 b, glm::ivec2 c,
+                       glm::ivec2 d) {
+    const int64_t adx = a.x - d.x, ady = a.y - d.y;
+    const int64_t bdx = b.x - d.x, bdy = b.y - d.y;
+    const int64_t cdx = c.x - d.x, cdy = c.y - d.y;
+    const int64_t ad = adx * adx + ady * ady;
+    const int64_t bd = bdx * bdx + bdy * bdy;
+    const int64_t cd = cdx * cdx + cdy * cdy;
+    return adx * (bdy * cd - bd * cdy) - ady * (bdx * cd - bd * cdx) +
+               ad * (bdx * cdy - bdy * cdx) >
+           0;
+  }
+
+  // Finds the sample inside t (edges included, vertices excluded) with the
+  // largest vertical distance to t's plane, and queues it
+  void scan(int ti, float maxError) {
+    Triangle& t = tris[ti];
+    ++t.version;
+    t.error = 0.0f;
+
+    const glm::ivec2 p0 = points[t.v[0]], p1 = points[t.v[1]],
+                     p2 = points[t.v[2]];
+    const double h0 = height(p0.x, p0.y), h1 = height(p1.x, p1.y),
+                 h2 = height(p2.x, p2.y);
+    // plane h = h0 + gx * (x - x0) + gz * (z - z0)
+    const double area = double(orient(p0, p1, p2));
+    const double e1x = p1.x - p0.x, e1z = p1.y - p0.y;
+    const double e2x = p2.x - p0.x, e2z = p2.y - p0.y;
+    const double gx = ((h1 - h0) * e2z - (h2 - h0) * e1z) / area;
+    const double gz = ((h2 - h0) * e1x - (h1 - h0) * e2x) / area;
+
+    const int x0 = std::min({p0.x, p1.x, p2.x});
+    const int x1 = std::max({p0.x, p1.x, p2.x});
+    const int z0 = std::min({p0.y, p1.y, p2.y});
+    const int z1 = std::max({p0.y, p1.y, p2.y});
+    for (int z = z0; z <= z1; ++z) {
+      // the row's span inside all three edges
+      int lo = x0, hi = x1;
+      const glm::ivec2 v[3] = {p0, p1, p2};
+      for (int e = 0; e < 3 && lo <= hi; ++e) {
+        const glm::ivec2 a = v[e], b = v[(e + 1) % 3];
+        // orient(a, b, (x, z)) = (b.x - a.x)(z - a.z) - (b.z - a.z)(x - a.x)
+        const int64_t dz = b.y - a.y;
+        const int64_t c = int64_t(b.x - a.x) * (z - a.y);
+        // need c - dz * (x - a.x) >= 0
+        if (dz == 0) {
+          if (c < 0) hi = lo - 1;
+        } else if (dz > 0) {
+          // x - a.x <= c / dz
+          hi = std::min<int64_t>(hi, a.x + floorDiv(c, dz));
+        } else {
+          // x - a.x >= c / dz
+          lo = std::max<int64_t>(lo, a.x + ceilDiv(c, dz));
+        }
+      }
+      const float* row = &heights[size_t(z) * width];
+      const double base = h0 + gz * (z - p0.y);
+      for (int x = lo; x <= hi; ++x) {
+        const float error =
+            float(std::abs(row[x] - (base + gx * (x - p0.x))));
+        if (error > t.error) {
+          const glm::ivec2 p(x, z);
+          if (p == p0 || p == p1 || p == p2) continue;
+          t.error = error;
+          t.bestX = x;
+          t.bestZ = z;
+        }
+      }
+    }
+    if (t.error > maxError) queue.push({t.error, ti, t.version});
+  }
+
+  static int64_t floorDiv(int64_t a, int64_t b) {
+    int64_t q = a / b;
+    if ((a % b != 0) && ((a < 0) != (b < 0))) --q;
+    return q;
+  }
+  static int64_t ceilDiv(int64_t a, int64_t b) { return -floorDiv(-a, b); }
+
+  // Neighbour `from` of triangle t is now `to`
+  void relink(int t, int from, int to) {
+    if (t < 0) return;
+    for (int& n : tris[t].n)
+      if (n == from) n = to;
+  }
+
+  // Rotates t's vertices so edge `e` becomes edge 0
+  void rotate(int t, int e) {
+    Triangle& tri = tris[t];
+    std::rotate(tri.v, tri.v + e, tri.v + 3);
+    std::rotate(tri.n, tri.n + e, tri.n + 3);
+  }
+
+  int newTriangle(int a, int b, int c, int na, int nb, int nc) {
+    Triangle t;
+    t.v[0] = a, t.v[1] = b, t.v[2] = c;
+    t.n[0] = na, t.n[1] = nb, t.n[2] = nc;
+    tris.push_back(t);
+    return int(tris.size()) - 1;
+  }
+
+  void set(int t, int a, int b, int c, int na, int nb, int nc) {
+    Triangle& tri = tris[t];
+    tri.v[0] = a, tri.v[1] = b, tri.v[2] = c;
+    tri.n[0] = na, tri.n[1] = nb, tri.n[2] = nc;
+  }
+
+  // Inserts point p, which lies in triangle t (possibly on an edge)
+  void insert(int t, int p) {
+    const glm::ivec2 pp = points[p];
+    int onEdge = -1;
+    for (int e = 0; e < 3; ++e) {
+      const int a = tris[t].v[e], b = tris[t].v[(e + 1) % 3];
+      if (orient(points[a], points[b], pp) == 0) onEdge = e;
+    }
+
+    flips.clear();
+    if (onEdge < 0) {
+      // split t = (a, b, c) into three around p
+      const Triangle old = tris[t];
+      const int a = old.v[0], b = old.v[1], c = old.v[2];
+      const int t1 = int(tris.size()), t2 = t1 + 1;
+      set(t, a, b, p, old.n[0], t1, t2);
+      newTriangle(b, c, p, old.n[1], t2, t);
+      newTriangle(c, a, p, old.n[2], t, t1);
+      relink(old.n[1], t, t1);
+      relink(old.n[2], t, t2);
+      touched.insert(touched.end(), {t, t1, t2});
+      flips.insert(flips.end(), {{t, 0}, {t1, 0}, {t2, 0}});
+    } else {
+      // split t = (a, b, c) and its neighbour u = (b, a, d) across a-b
+      rotate(t, onEdge);
+      const Triangle oldT = tris[t];
+      const int a = oldT.v[0], b = oldT.v[1], c = oldT.v[2];
+      const int u = oldT.n[0];
+      const int t1 = int(tris.size());
+      const int u1 = u >= 0 ? t1 + 1 : -1;
+
+      set(t, a, p, c, u1, t1, oldT.n[2]);
+      newTriangle(p, b, c, u, oldT.n[1], t);
+      relink(oldT.n[1], t, t1);
+      touched.insert(touched.end(), {t, t1});
+      flips.insert(flips.end(), {{t, 2}, {t1, 1}});
+
+      if (u >= 0) {
+        int j = 0;
+        while (tris[u].n[j] != t) ++j;
+        rotate(u, j);
+        const Triangle oldU = tris[u];
+        const int d = oldU.v[2];
+        set(u, b, p, d, t1, u1, oldU.n[2]);
+        newTriangle(p, a, d, t, oldU.n[1], u);
+        relink(oldU.n[1], u, u1);
+        touched.insert(touched.end(), {u, u1});
+        flips.insert(flips.end(), {{u, 2}, {u1, 1}});
+      }
+    }
+
+    // Lawson flips until every edge opposite p is locally Delaunay
+    while (!flips.empty()) {
+      const auto [ti, e] = flips.back();
+      flips.pop_back();
+      legalize(ti, e, p);
+    }
+  }
+
+  // Flips edge e of t (opposite the new point p) if the triangle across it
+  // has p inside its circumcircle
+  void legalize(int t, int e, int p) {
+    const int u = tris[t].n[e];
+    if (u < 0) return;
+    rotate(t, e);  // t = (a, b, p), edge 0 = a-b
+    if (tris[t].v[2] != p) return;  // already flipped away
+    int j = 0;
+    while (tris[u].n[j] != t) ++j;
+    rotate(u, j);  // u = (b, a, d)
+
+    const Triangle T = tris[t], U = tris[u];
+    const int a = T.v[0], b = T.v[1], d = U.v[2];
+    if (!inCircle(points[a], points[b], points[p], points[d])) return;
+
+    // the diagonal p-d replaces a-b
+    set(t, p, a, d, T.n[2], U.n[1], u);
+    set(u, p, d, b, t, U.n[2], T.n[1]);
+    relink(U.n[1], u, t);
+    relink(T.n[1], t, u);
+    touched.insert(touched.end(), {t, u});
+    flips.push_back({t, 1});
+    flips.push_back({u, 1});
+  }
+};
@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "tin_builder.hpp"
+
+// Builds a TIN on a background thread so the render loop keeps going; at
+// the finer error bounds TinBuilder::build takes well over a second.
+//
+// start() copies the heights on the calling thread, so the caller may keep
+// changing its terrain while the worker triangulates the snapshot. Once
+// finished, poll() swaps the result out on the calling thread, which then
+// uploads it. TinBuilder cannot be interrupted, so a running build is
+// always completed; the destructor waits for it.
+class TinJob {
+ public:
+  TinJob() = default;
+  TinJob(const TinJob&) = delete;
+  TinJob& operator=(const TinJob&) = delete;
+
+  ~TinJob() {
+    if (worker.joinable()) worker.join();
+  }
+
+  // Starts building a TIN of the width x depth heights within maxError.
+  // Returns false if a build is already active.
+  bool start(const std::vector<float>& heights, int width, int depth,
+             float maxError) {
+    if (isActive()) return false;
+    input = heights;
+    finished = false;
+    worker = std::thread([this, width, depth, maxError]() {
+      result = builder.build(input, width, depth, maxError);
+      finished = true;
+    });
+    return true;
+  }
+
+  // Running, or finished but not yet collected by poll()
+  bool isActive() const { return worker.joinable(); }
+
+  // Call once per frame from the thread that started the job. If the build
+  // has finished, collects it and swaps its result into target. Returns
+  // true when target changed.
+  bool poll(TinBuilder::Result& target) {
+    if (!isActive() || !finished) return false;
+    worker.join();
+    std::swap(target, result);
+    return true;
+  }
+
+ private:
+  std::thread worker;
+  std::atomic<bool> finished{false};
+  std::vector<float> input;  // snapshot of the heights being triangulated
+  TinBuilder builder;
+  TinBuilder::Result result;
+};
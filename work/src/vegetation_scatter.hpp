@@ -0,0 +1,300 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "heightmap_generator.hpp"
+#include "parallel.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VEGETATION_SCATTER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Poisson-disk scatter of vegetation over a terrain, thinned by density
+// rules on its height and slope.
+//
+// Samples are at least minDistance apart (Bridson's algorithm). A
+// background grid with cells minDistance / sqrt(2) wide holds at most one
+// sample per cell, so a candidate is tested against the 5 x 5 cells around
+// it, four at a time with SSE2 where available. The grid is split into
+// tiles of TILE_CELLS x TILE_CELLS cells, each filled by one worker with
+// its own random stream in a local copy of its cells and a 2-cell halo. A
+// tile's samples can only conflict with those of its 8 neighbours, so
+// tiles are filled in four phases by the parity of their column and row:
+// tiles of one phase never touch, and later phases see the samples of
+// earlier ones across their borders. Like HydraulicErosion, every stream is
+// derived from the seed with splitmix64, so the scatter depends only on the
+// seed and the parameters, not on the thread count.
+//
+// Each sample is then kept with probability density(height, slope),
+// decided by its own hash, which thins the pattern without breaking its
+// minimum distance. Heights and gradients are sampled bilinearly.
+class VegetationScatter {
+ public:
+  struct Params {
+    float minDistance = 0.8f;  // world units
+    uint32_t seed = 1;
+    int candidates = 8;  // attempts around each sample before giving up
+    // Density is 1 inside [minHeight, maxHeight] and below maxSlope (rise
+    // over run), fading to 0 over the given distance outside them
+    float minHeight = -std::numeric_limits<float>::max();
+    float maxHeight = std::numeric_limits<float>::max();
+    float heightFade = 0.0f;
+    float maxSlope = std::numeric_limits<float>::max();
+    float slopeFade = 0.0f;
+    // terrain cell (x, z) lies at offset + (x * scaleX, height, z * scaleZ)
+    glm::vec3 offset{-10.0f, 0.0f, -10.0f};
+    float scaleX = 0.02f, scaleZ = 0.02f;
+  };
+
+  struct Instance {
+    glm::vec3 position;
+    float rotation;  // about y, radians
+    float tint;      // colour multiplier around 1
+  };
+
+  static constexpr int TILE_CELLS = 32;
+
+  void setThreadCount(int threads) { threadCount = std::max(0, threads); }
+
+  // Scatters over the whole of terrain into out, in tile order
+  void run(const HeightmapGenerator& terrain, const Params& params,
+           std::vector<Instance>& out) {
+    const auto start = std::chrono::steady_clock::now();
+    out.clear();
+    samples = 0;
+    const float extentX = (terrain.getWidth() - 1) * params.scaleX;
+    const float extentZ = (terrain.getDepth() - 1) * params.scaleZ;
+    if (extentX <= 0.0f || extentZ <= 0.0f || params.minDistance <= 0.0f)
+      return;
+
+    radius = params.minDistance;
+    cellSize = radius / std::sqrt(2.0f);
+    invCellSize = 1.0f / cellSize;
+    cellsX = std::max(1, int(std::ceil(extentX / cellSize)));
+    cellsZ = std::max(1, int(std::ceil(extentZ / cellSize)));
+    sizeX = extentX;
+    sizeZ = extentZ;
+    grid.assign(size_t(cellsX) * cellsZ, glm::vec2(EMPTY));
+    tilesX = (cellsX + TILE_CELLS - 1) / TILE_CELLS;
+    tilesZ = (cellsZ + TILE_CELLS - 1) / TILE_CELLS;
+    tileOut.resize(size_t(tilesX) * tilesZ);
+    tileSamples.assign(tileOut.size(), 0);
+
+    std::vector<int> phaseTiles;
+    for (int phase = 0; phase < 4; ++phase) {
+      phaseTiles.clear();
+      for (int tz = phase >> 1; tz < tilesZ; tz += 2)
+        for (int tx = phase & 1; tx < tilesX; tx += 2)
+          phaseTiles.push_back(tz * tilesX + tx);
+      parallel::forTiles(0, int(phaseTiles.size()), 1, threadCount,
+                         [&](int b, int e) {
+                           for (int i = b; i < e; ++i)
+                             fillTile(terrain, params, phaseTiles[i]);
+                         });
+    }
+
+    size_t total = 0;
+    for (const auto& tile : tileOut) total += tile.size();
+    out.reserve(total);
+    for (size_t t = 0; t < tileOut.size(); ++t) {
+      out.insert(out.end(), tileOut[t].begin(), tileOut[t].end());
+      samples += tileSamples[t];
+    }
+    lastMs = std::chrono::duration<double, std::milli>(
+                 std::chrono::steady_clock::now() - start)
+                 .count();
+  }
+
+  // Density rule at a terrain position, in [0, 1]
+  static float density(const Params& p, float height, float slope) {
+    auto fade = [](float excess, float width) {
+      if (excess <= 0.0f) return 1.0f;
+      return width > 0.0f ? std::max(0.0f, 1.0f - excess / width) : 0.0f;
+    };
+    return fade(p.minHeight - height, p.heightFade) *
+           fade(height - p.maxHeight, p.heightFade) *
+           fade(slope - p.maxSlope, p.slopeFade);
+  }
+
+  // Statistics for the last run(): Poisson samples before the density
+  // rules and the time taken
+  long long getSamples() const { return samples; }
+  double getLastMs() const { return lastMs; }
+
+  // Sample in each cell of the last run()'s grid, getGridWidth() cells a
+  // row (x < 0 where empty), relative to the terrain's corner: for checking
+  // the minimum distance
+  const std::vector<glm::vec2>& getGrid() const { return grid; }
+  int getGridWidth() const { return cellsX; }
+
+ private:
+  int threadCount = 0;
+  float radius = 1.0f, cellSize = 1.0f, invCellSize = 1.0f;
+  float sizeX = 0.0f, sizeZ = 0.0f;
+  int cellsX = 0, cellsZ = 0, tilesX = 0, tilesZ = 0;
+  std::vector<glm::vec2> grid;
+  std::vector<std::vector<Instance>> tileOut;
+  std::vector<long long> tileSamples;
+  long long samples = 0;
+  double lastMs = 0.0;
+
+  // splitmix64, as HydraulicErosion
+  static uint64_t mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+  }
+  static float unit(uint64_t bits) {
+    return float(bits >> 40) * (1.0f / 16777216.0f);
+  }
+
+  // Marks an empty grid cell: far enough from everything to never conflict,
+  // so the distance checks need no branch on emptiness
+  static constexpr float EMPTY = -1e18f;
+  // Side of a tile's local grid: its cells and a halo of 2 around them
+  static constexpr int LOCAL = TILE_CELLS + 4;
+
+  int cellOf(float v) const { return int(v * invCellSize); }
+
+  // False if a sample in the 5 x 5 cells around `cell`, a cell of a local
+  // grid, lies within sqrt(r2) of q. No other cell can hold one.
+  static bool clear(const glm::vec2* cell, glm::vec2 q, float r2) {
+    const float* row = &cell[-2 * LOCAL - 2].x;
+#ifdef VEGETATION_SCATTER_SSE2
+    static_assert(sizeof(glm::vec2) == 2 * sizeof(float),
+                  "cells are read as packed floats");
+    const __m128 qq = _mm_setr_ps(q.x, q.y, q.x, q.y);
+    const __m128 limit = _mm_set1_ps(r2);
+    __m128 hit = _mm_setzero_ps();
+    for (int z = 0; z < 5; ++z, row += 2 * LOCAL) {
+      // cells 0-1, 2-3 and 4 of the row, each as x y pairs
+      __m128 a = _mm_sub_ps(_mm_loadu_ps(row), qq);
+      __m128 b = _mm_sub_ps(_mm_loadu_ps(row + 4), qq);
+      __m128 c = _mm_sub_ps(
+          _mm_loadl_pi(qq, reinterpret_cast<const __m64*>(row + 8)), qq);
+      a = _mm_mul_ps(a, a);
+      b = _mm_mul_ps(b, b);
+      c = _mm_mul_ps(c, c);
+      const __m128 ab =
+          _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)),
+                     _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+      const __m128 cc =
+          _mm_add_ss(c, _mm_shuffle_ps(c, c, _MM_SHUFFLE(1, 1, 1, 1)));
+      hit = _mm_or_ps(hit, _mm_or_ps(_mm_cmplt_ps(ab, limit),
+                                     _mm_cmplt_ss(cc, limit)));
+    }
+    // the single-cell compare leaves lanes 1-3 as c's squares, whose sign
+    // bits are clear
+    return _mm_movemask_ps(hit) == 0;
+#else
+    bool hit = false;
+    for (int z = 0; z < 5; ++z, row += 2 * LOCAL)
+      for (int x = 0; x < 10; x += 2) {
+        const float dx = row[x] - q.x, dy = row[x + 1] - q.y;
+        hit |= dx * dx + dy * dy < r2;
+      }
+    return !hit;
+#endif
+  }
+
+  void fillTile(const HeightmapGenerator& terrain, const Params& p,
+                int tile) {
+    const int tx = tile % tilesX, tz = tile / tilesX;
+    const int cx0 = tx * TILE_CELLS, cz0 = tz * TILE_CELLS;
+    const int cx1 = std::min(cellsX, cx0 + TILE_CELLS);
+    const int cz1 = std::min(cellsZ, cz0 + TILE_CELLS);
+    const float x0 = cx0 * cellSize, z0 = cz0 * cellSize;
+    const float x1 = std::min(sizeX, cx1 * cellSize);
+    const float z1 = std::min(sizeZ, cz1 * cellSize);
+    const uint64_t tileSeed = mix(uint64_t(p.seed) << 32 ^ uint32_t(tile));
+    uint64_t state = tileSeed;
+    auto next = [&]() { return state = mix(state); };
+
+    // The tile's cells and the neighbours' within 2 of them, copied into a
+    // local grid so the checks below need no bounds tests. Tiles filled at
+    // the same time are a tile apart, so none of these change meanwhile.
+    std::vector<glm::vec2> local(LOCAL * LOCAL, glm::vec2(EMPTY));
+    for (int z = std::max(0, cz0 - 2); z < std::min(cellsZ, cz1 + 2); ++z)
+      for (int x = std::max(0, cx0 - 2); x < std::min(cellsX, cx1 + 2); ++x)
+        local[(z - cz0 + 2) * LOCAL + x - cx0 + 2] =
+            grid[size_t(z) * cellsX + x];
+
+    const float r2 = radius * radius;
+    std::vector<glm::vec2> placed, active;
+    auto tryPlace = [&](glm::vec2 q) {
+      const int cx = cellOf(q.x), cz = cellOf(q.y);
+      if (cx < cx0 || cx >= cx1 || cz < cz0 || cz >= cz1 || q.x < 0.0f ||
+          q.y < 0.0f || q.x >= sizeX || q.y >= sizeZ)
+        return false;
+      glm::vec2* cell = &local[(cz - cz0 + 2) * LOCAL + cx - cx0 + 2];
+      if (cell->x != EMPTY || !clear(cell, q, r2)) return false;
+      *cell = q;
+      placed.push_back(q);
+      active.push_back(q);
+      return true;
+    };
+
+    // Bridson's algorithm from a random seed point, reseeded until
+    // `candidates` throws in a row find no room. Candidates lie just past
+    // radius at evenly spaced angles from a random start, stepped by a
+    // rotation rather than a sine and cosine each, which packs the samples
+    // tighter than throws across the annulus [radius, 2 radius] and needs
+    // fewer of them.
+    const float reach = radius * 1.0001f;
+    const float turn = 6.2831853f / float(std::max(1, p.candidates));
+    const glm::vec2 step(std::cos(turn), std::sin(turn));
+    for (;;) {
+      bool seeded = false;
+      for (int k = 0; k < p.candidates && !seeded; ++k) {
+        const uint64_t r = next();
+        seeded = tryPlace({x0 + unit(r) * (x1 - x0),
+                           z0 + unit(r << 24) * (z1 - z0)});
+      }
+      if (!seeded) break;
+      while (!active.empty()) {
+        const size_t i = next() % active.size();
+        const glm::vec2 a = active[i];
+        const float start = unit(next()) * 6.2831853f;
+        glm::vec2 dir(std::cos(start), std::sin(start));
+        bool found = false;
+        for (int k = 0; k < p.candidates && !found; ++k) {
+          found = tryPlace(a + reach * dir);
+          dir = glm::vec2(dir.x * step.x - dir.y * step.y,
+                          dir.x * step.y + dir.y * step.x);
+        }
+        if (!found) {
+          active[i] = active.back();
+          active.pop_back();
+        }
+      }
+    }
+    for (int z = cz0; z < cz1; ++z)
+      std::copy_n(&local[(z - cz0 + 2) * LOCAL + 2], cx1 - cx0,
+                  &grid[size_t(z) * cellsX + cx0]);
+
+    // density rules, each sample decided by its own hash
+    std::vector<Instance>& out = tileOut[tile];
+    out.clear();
+    tileSamples[tile] = (long long)placed.size();
+    for (size_t i = 0; i < placed.size(); ++i) {
+      const glm::vec2 q = placed[i];
+      const float cx = q.x / p.scaleX, cz = q.y / p.scaleZ;
+      const float height = terrain.getHeightBilinear(cx, cz);
+      const glm::vec2 g = terrain.getGradientBilinear(cx, cz);
+      const float slope = glm::length(g / glm::vec2(p.scaleX, p.scaleZ));
+      const uint64_t r = mix(tileSeed ^ mix(i));
+      if (unit(r) >= density(p, height, slope)) continue;
+      out.push_back({p.offset + glm::vec3(q.x, height, q.y),
+                     unit(r << 24) * 6.2831853f,
+                     0.8f + 0.4f * unit(mix(r))});
+    }
+  }
+};